@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <memory>
@@ -9,7 +10,6 @@
 #include <kaldi-native-fbank/csrc/online-feature.h>
 
 #include "asr.h"
-#include "audio.h"
 #include "kaldi-native-fbank/csrc/feature-fbank.h"
 
 int ASR::init(const nlohmann::json& config) {
@@ -35,11 +35,32 @@ int ASR::init(const nlohmann::json& config) {
     chunk_time = config.value("chunk_time", 2000);
     overlap_time = config.value("overlap_time", 800);
     if (overlap_time > chunk_time) overlap_time = chunk_time;
+    max_parallel = std::max(config.value("max_parallel", 2), 1);
+    load = load_t();
+    load.parallel = max_parallel;
+
+    auto& registry = Metrics::instance();
+    metrics.wait = &registry.histogram("voicelint_asr_wait_seconds", 
+        "Time a window waited for an inference turn");
+    metrics.inference = &registry.histogram("voicelint_asr_inference_seconds", 
+        "Model time per window");
+    metrics.rtf = &registry.histogram("voicelint_asr_rtf", 
+        "Model time over audio time per window", {}, 1e-4);
+    metrics.samples = &registry.counter("voicelint_asr_samples_total", 
+        "Samples recognized, overlaps counted again");
+    if (metrics.collector < 0) {
+        metrics.collector = registry.addCollector([this](Metrics& registry) {
+            auto current = getLoad();
+            registry.gauge("voicelint_asr_busy", "Windows being recognized").set(current.busy);
+            registry.gauge("voicelint_asr_waiting", "Windows waiting for a turn").set(current.waiting);
+            registry.gauge("voicelint_asr_parallel", "Inference turns").set(current.parallel);
+        });
+    }
 
     static Ort::Env env(ORT_LOGGING_LEVEL_ERROR, "echonote-asr");
     Ort::SessionOptions so;
     so.SetGraphOptimizationLevel(ORT_ENABLE_ALL);
-    so.SetIntraOpNumThreads(4);
+    so.SetIntraOpNumThreads(config.value("threads", 4));
     session = std::make_unique<Ort::Session>(
         env, model_file.c_str(), so
     );
@@ -56,60 +77,26 @@ int ASR::init(const nlohmann::json& config) {
 
 int ASR::shutdown() {
     // Shutdown logic here
-    asr_running = false; // Stop the ASR thread if it's running
-    if (asrThread.joinable()) {
-        asrThread.join(); // Wait for the ASR thread to finish
-    }
-
     if (session) {
         session->release();
     }
 
     if (save) out.close();
 
-    return 0; // Return 0 on success
-}
-
-int ASR::setAudio(const Audio* audio, asr_callback func) {
-    if (!audio) {
-        std::cerr << "Invalid audio pointer." << std::endl;
-        return -1; // Return -1 on failure
-    }
-
-    if (asr_running) {
-        std::cerr << "ASR is already running." << std::endl;
-        return -1; // Return -1 if ASR is already running
+    if (metrics.collector >= 0) {
+        Metrics::instance().removeCollector(metrics.collector);
+        metrics.collector = -1;
     }
 
-    asr_running = true;
-    asrThread = std::thread([this, audio, func]() {
-        std::vector<float> audio_data;
-        const int min_chunk_length = chunk_time * model_config.asr_sample_rate / 1000;
-        const int overlap_chunk_length = overlap_time * model_config.asr_sample_rate / 1000;
-
-        while (asr_running) {
-            std::vector<float> chunk = 
-                const_cast<Audio *>(audio)->readAudio(chunk_time);
-            if (chunk.empty()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue; // Skip if no audio data is available
-            }
-            audio_data.insert(audio_data.end(), chunk.begin(), chunk.end());
-            if (audio_data.size() >= min_chunk_length) {
-                std::string result = asr(audio_data); // Process ASR with the accumulated audio data
-                if (func) func(result);
-                if (save) out << result;
-                audio_data.erase(audio_data.begin(), 
-                    audio_data.begin() + audio_data.size() - overlap_chunk_length);
-            }
-        }
-
-        return 0; // Return 0 on success
-    });
-
     return 0; // Return 0 on success
 }
 
+void ASR::saveResult(const std::string& text) {
+    if (!save) return;
+    std::lock_guard<std::mutex> lk(out_mtx);
+    out << text;
+}
+
 int ASR::load_config(const std::string& path) {
     try {
         YAML::Node config = YAML::LoadFile(path);
@@ -340,7 +327,45 @@ std::string ASR::ctc_search(const float * data,
     return str_lang + str_emo + str_event + " " + text;
 }
 
-std::string ASR::asr(const std::vector<float>& data) {
+std::string ASR::recognize(const std::vector<float>& data) {
+    auto queued = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lk(load_mtx);
+        ++load.waiting;
+        load_cv.wait(lk, [this] { return load.busy < max_parallel; });
+        --load.waiting;
+        ++load.busy;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::string text = infer(data);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    double audio_ms = data.size() * 1000.0 / model_config.asr_sample_rate;
+    if (metrics.inference) {
+        metrics.wait->observe(start - queued);
+        metrics.inference->observe(ms / 1000);
+        if (audio_ms > 0) metrics.rtf->observe(ms / audio_ms);
+        metrics.samples->add(data.size());
+    }
+    {
+        std::lock_guard<std::mutex> lk(load_mtx);
+        --load.busy;
+        load.busy_ms += ms;
+        if (audio_ms > 0) {
+            double rtf = ms / audio_ms;
+            load.rtf = load.rtf == 0 ? rtf : load.rtf * 0.9 + rtf * 0.1;
+        }
+    }
+    load_cv.notify_one();
+    return text;
+}
+
+ASR::load_t ASR::getLoad() {
+    std::lock_guard<std::mutex> lk(load_mtx);
+    return load;
+}
+
+std::string ASR::infer(const std::vector<float>& data) {
     //std::cout << "Processing ASR for data size: " << data.size() << std::endl;
     std::vector<std::vector<float>> features;
     if (extract_features(data, features) != 0) {
@@ -1,16 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <string>
-#include <thread>
 #include <vector>
 #include <onnxruntime/onnxruntime_cxx_api.h>
 
-#include "audio.h"
+#include "metrics.h"
 
-typedef void (* asr_callback)(const std::string&);
 class ASR {
 public:
     static ASR& instance() {
@@ -22,10 +23,36 @@ public:
 
     int init(const nlohmann::json& config);
     int shutdown();
-    int setAudio(const Audio* audio, asr_callback func);
+
+    // text of a window of 16 kHz mono audio; safe to call from several
+    // threads, they share the model and at most max_parallel run at once,
+    // the others wait their turn
+    std::string recognize(const std::vector<float>& data);
+    // append to the asr output file when "save" is on
+    void saveResult(const std::string& text);
+
+    // window length and how much of it is fed again with the next one
+    int getChunkTime() const {
+        return chunk_time;
+    }
+    int getOverlapTime() const {
+        return overlap_time;
+    }
+    int getSampleRate() const {
+        return model_config.asr_sample_rate;
+    }
+
+    typedef struct _load_t {
+        int parallel = 1; // max_parallel
+        int busy = 0; // windows being recognized
+        int waiting = 0; // windows waiting for a turn
+        double rtf = 0; // model time per audio time, averaged
+        double busy_ms = 0; // model time since init, summed over the turns
+    } load_t;
+    load_t getLoad();
 
     std::string getOutFile() const {
-        return asr_out_path; // Return the path to the ASR output file
+        return save ? asr_out_path : ""; // Return the path to the ASR output file
     }
 
 private:
@@ -53,6 +80,22 @@ private:
     int chunk_time = 2000;
     int overlap_time = 800;
 
+    // the inference capacity every caller shares
+    int max_parallel = 2;
+    std::mutex load_mtx;
+    std::condition_variable load_cv;
+    load_t load;
+    std::string infer(const std::vector<float>& data);
+
+    typedef struct _asr_metrics_t {
+        Histogram * wait = nullptr; // for a turn
+        Histogram * inference = nullptr;
+        Histogram * rtf = nullptr;
+        Counter * samples = nullptr;
+        int collector = -1;
+    } asr_metrics_t;
+    asr_metrics_t metrics;
+
     int load_config(const std::string& path);
     int load_mvn(const std::string& path);
     int load_tokens(const std::string& path);
@@ -62,17 +105,14 @@ private:
         OrtArenaAllocator, OrtMemTypeDefault
     );
 
-    std::thread asrThread;
-    bool asr_running = false;
-
     int extract_features(const std::vector<float>& data, 
         std::vector<std::vector<float>>& features);
     int normalize_features(std::vector<std::vector<float>>& features);
     std::string ctc_search(const float * data, 
         const std::vector<int>& speech_length, const std::vector<int64_t>& data_shape);
-    std::string asr(const std::vector<float>& data);
 
     bool save = false;
     std::string asr_out_path = "output/asr.txt"; // Path to save ASR results
     std::ofstream out;
+    std::mutex out_mtx;
 };
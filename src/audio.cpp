@@ -86,14 +86,26 @@ int Audio::init(const nlohmann::json& config) {
         return paUnanticipatedHostError; // Return error if SwrContext initialization fails
     }
 
+    auto& metrics = Metrics::instance();
+    callbackLatency = &metrics.histogram("voicelint_audio_callback_to_buffer_seconds", 
+        "Time from the audio callback to the samples being in the capture buffer");
+    metricsCollector = metrics.addCollector([this](Metrics& metrics) {
+        static const char * help = "Samples dropped before anyone read them";
+        metrics.counter("voicelint_audio_dropped_samples_total", help, {{"where", "queue"}})
+            .set(audioQueue.dropped);
+        metrics.counter("voicelint_audio_dropped_samples_total", help, {{"where", "buffer"}})
+            .set(bufferDropped);
+    });
+
     resampleThread = std::thread([this, inputSampleRate]() {
         resample_running = true; // Set resample running flag to true
         while (resample_running) {
             auto data = audioQueue.pop(); // Pop data from the audio queue
-            if (data.empty()) {
+            if (data.samples.empty()) {
                 continue; // Skip if no data is available
             }
-            process(data, (inputSampleRate != sampleRate)); // Call resample function with the popped data
+            process(data.samples, (inputSampleRate != sampleRate)); // Call resample function with the popped data
+            callbackLatency->observe(std::chrono::steady_clock::now() - data.time);
         }
     });
 
@@ -105,6 +117,10 @@ int Audio::shutdown() {
     if (resampleThread.joinable()) {
         resampleThread.join(); // Wait for the resample thread to finish
     }
+    if (metricsCollector >= 0) {
+        Metrics::instance().removeCollector(metricsCollector);
+        metricsCollector = -1;
+    }
 
     if (sndFile) {
         sf_close(sndFile); // Close the sound file
@@ -171,8 +187,10 @@ int Audio::audioCallback(const void* inputBuffer, void* outputBuffer,
         return paContinue; // Continue processing audio if no valid audio object or input buffer
     }
     const float* in = static_cast<const float*>(inputBuffer);
-    std::vector<float> data(in, in + framesPerBuffer); // Copy input data to vector
-    audio->audioQueue.push(data); // Push data to the audio queue
+    AudioBlock data;
+    data.samples.assign(in, in + framesPerBuffer); // Copy input data to vector
+    data.time = std::chrono::steady_clock::now();
+    audio->audioQueue.push(std::move(data)); // Push data to the audio queue
     return paContinue; // Continue processing audio
 }
 
@@ -202,7 +220,7 @@ int Audio::process(const std::vector<float>& audioData, bool resample /* = true
         resampledData = audioData; // Copy the original audio data
     }
     // For simplicity, we will just write the audio data to the buffer
-    audioBuffer.write(resampledData.data(), resampledData.size()); // Write only the number of samples actually written
+    bufferDropped += audioBuffer.write(resampledData.data(), resampledData.size()); // Write only the number of samples actually written
     if (sndFile) {
         // Write the resampled audio data to the sound file
         sf_count_t framesWritten = sf_writef_float(sndFile, resampledData.data(), resampledData.size()); // Mono output
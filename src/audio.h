@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <nlohmann/json.hpp>
@@ -8,6 +10,7 @@
 #include <thread>
 #include <vector>
 #include <sndfile.h>
+#include "metrics.h"
 
 extern "C" {
 #include <libswresample/swresample.h>
@@ -38,10 +41,13 @@ public:
     };
 
     std::string getOutFile() const {
-        return audio_out_path; // Return the path to the audio file
+        return saveAudio ? audio_out_path : ""; // Return the path to the audio file
     }
 
     std::vector<float> readAudio(int ms);
+    int getSampleRate() const {
+        return sampleRate;
+    }
 
 private:
     Audio() = default;
@@ -49,23 +55,31 @@ private:
 
     PaStream* stream = nullptr;
 
+    // samples from the callback and when they arrived
+    typedef struct _AudioBlock {
+        std::vector<float> samples;
+        std::chrono::steady_clock::time_point time;
+    } AudioBlock;
+
     typedef struct _AudioQueue {
-        std::queue<std::vector<float>> q;
+        std::queue<AudioBlock> q;
         std::mutex mtx;
         std::condition_variable cv;
         int maxSize = 100000; // Maximum size of the queue
+        std::atomic<uint64_t> dropped = 0; // samples of the blocks removed when full
 
-        int push(const std::vector<float>& data) {
+        int push(AudioBlock data) {
             std::lock_guard<std::mutex> lock(mtx);
             if (q.size() >= maxSize) {
+                dropped += q.front().samples.size();
                 q.pop(); // Remove the oldest element if queue is full
             }
-            q.push(data);
+            q.push(std::move(data));
             cv.notify_one(); // Notify one waiting thread
             return 0; // Return 0 on success
         }
 
-        std::vector<float> pop() {
+        AudioBlock pop() {
             std::unique_lock<std::mutex> lock(mtx);
             if (!cv.wait_for(lock, 
                 std::chrono::milliseconds(100), 
@@ -73,7 +87,7 @@ private:
                 return {}; // Return an empty vector if timeout occurs
             }
 
-            auto data = q.front();
+            auto data = std::move(q.front());
             q.pop();
             return data; // Return the popped data
         }
@@ -107,15 +121,18 @@ private:
             return *this; // Return the current object
         }
 
-        int write(const float* input, size_t size) {
+        // the number of samples overwritten before they were read
+        size_t write(const float* input, size_t size) {
+            size_t overwritten = 0;
             for (size_t i = 0; i < size; ++i) {
                 data[writeIndex] = input[i];
                 writeIndex = (writeIndex + 1) % capacity; // Wrap around if necessary
                 if (writeIndex == readIndex) {
                     readIndex = (readIndex + 1) % capacity; // Move read index if buffer is full
+                    ++overwritten;
                 }
             }
-            return 0; // Return 0 on success
+            return overwritten;
         }
 
         std::vector<float> read(size_t size) {
@@ -131,6 +148,7 @@ private:
         }
     } AudioBuffer;
     AudioBuffer audioBuffer; // Audio buffer for storing audio data
+    std::atomic<uint64_t> bufferDropped = 0; // samples overwritten in audioBuffer
 
     SwrContext* swrContext = nullptr; // SwrContext for resampling audio
 
@@ -141,5 +159,8 @@ private:
     std::string audio_out_path = "output/output.mp3"; // Path to save the audio file
     SNDFILE* sndFile = nullptr; // SNDFILE handle for audio file operations
 
+    Histogram* callbackLatency = nullptr; // callback to capture buffer
+    int metricsCollector = -1;
+
     int process(const std::vector<float>& audioData, bool resample = true);
 };
@@ -0,0 +1,334 @@
+#include "backend.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static void set_timeout(httplib::Client * client, std::chrono::milliseconds timeout) {
+    auto ms = std::max<int64_t>(1, timeout.count());
+    client->set_read_timeout(ms / 1000, (ms % 1000) * 1000);
+    client->set_write_timeout(ms / 1000, (ms % 1000) * 1000);
+}
+
+BackendPool::~BackendPool() {
+    shutdown();
+}
+
+int BackendPool::init(const nlohmann::json& config, 
+    const std::string& schema_host_port) {
+    std::vector<std::string> servers = config.value("servers", 
+        std::vector<std::string>());
+    if (servers.empty()) servers.push_back(schema_host_port);
+    for (const auto& url: servers) {
+        auto backend = std::make_unique<backend_t>();
+        backend->url = url;
+        backends.push_back(std::move(backend));
+    }
+    timeout_ms = config.value("timeout", 120) * 1000;
+    health_interval = config.value("health_interval", 5);
+    hedge = config.value("hedge", true) && backends.size() > 1;
+    hedge_percentile = config.value("hedge_percentile", 0.95);
+    hedge_min_delay = config.value("hedge_min_delay", 1000);
+
+    running = true;
+    if (health_interval > 0) {
+        health_thread = std::thread(&BackendPool::health_worker, this);
+    }
+    return 0;
+}
+
+int BackendPool::shutdown() {
+    if (!running.exchange(false)) return 0;
+    health_cv.notify_all();
+    if (health_thread.joinable()) {
+        health_thread.join();
+    }
+    // cut the requests still running, their callers see a failure
+    for (auto& backend: backends) {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        for (auto client: backend->active) client->stop();
+    }
+    // queued attempts see !running and finish without a request
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lk(attempts_mtx);
+        threads.swap(attempt_threads);
+    }
+    attempts_cv.notify_all();
+    for (auto& thread: threads) thread.join();
+    for (auto& backend: backends) {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        backend->idle.clear();
+    }
+    return 0;
+}
+
+bool BackendPool::submit(std::function<void()> task) {
+    std::lock_guard<std::mutex> lk(attempts_mtx);
+    if (!running) return false;
+    attempts.push_back(std::move(task));
+    if (attempts.size() > idle_threads) {
+        attempt_threads.emplace_back(&BackendPool::attempt_worker, this);
+    }
+    attempts_cv.notify_one();
+    return true;
+}
+
+void BackendPool::attempt_worker() {
+    std::unique_lock<std::mutex> lk(attempts_mtx);
+    while (true) {
+        ++idle_threads;
+        attempts_cv.wait(lk, [this] { return !attempts.empty() || !running; });
+        --idle_threads;
+        if (attempts.empty()) return;
+        auto task = std::move(attempts.front());
+        attempts.pop_front();
+        lk.unlock();
+        task();
+        lk.lock();
+    }
+}
+
+// llama-server answers /health with 503 while the model is loading
+void BackendPool::health_worker() {
+    while (running) {
+        for (auto& backend: backends) {
+            httplib::Client client(backend->url);
+            client.set_connection_timeout(2);
+            client.set_read_timeout(2);
+            auto res = client.Get("/health");
+            bool healthy = res && res->status == 200;
+            if (healthy != backend->healthy) {
+                std::cout << "LLM backend " << backend->url
+                    << (healthy ? " is up" : " is down") << std::endl;
+            }
+            backend->healthy = healthy;
+            if (healthy) backend->failures = 0;
+        }
+        std::unique_lock<std::mutex> lk(health_mtx);
+        health_cv.wait_for(lk, std::chrono::seconds(health_interval), 
+            [this] { return !running; });
+    }
+}
+
+// least outstanding requests among the healthy backends not tried yet; when
+// all are down the first attempt still goes to the least loaded one
+BackendPool::backend_t * BackendPool::pick(const std::vector<backend_t *>& tried) {
+    backend_t * best = nullptr;
+    backend_t * fallback = nullptr;
+    for (auto& backend: backends) {
+        if (std::find(tried.begin(), tried.end(), backend.get()) != tried.end()) {
+            continue;
+        }
+        if (!fallback || backend->outstanding < fallback->outstanding) {
+            fallback = backend.get();
+        }
+        if (backend->healthy &&
+            (!best || backend->outstanding < best->outstanding)) {
+            best = backend.get();
+        }
+    }
+    if (!best && tried.empty()) best = fallback;
+    return best;
+}
+
+// the backend's latency percentile, or -1 until there are enough samples
+double BackendPool::hedge_delay(backend_t * backend) {
+    std::vector<double> latencies;
+    {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        latencies.assign(backend->latencies.begin(), backend->latencies.end());
+    }
+    if (latencies.size() < 16) return -1;
+    size_t index = std::min(latencies.size() - 1, 
+        size_t(hedge_percentile * latencies.size()));
+    std::nth_element(latencies.begin(), latencies.begin() + index, 
+        latencies.end());
+    return std::max(double(hedge_min_delay), latencies[index]);
+}
+
+std::unique_ptr<httplib::Client> BackendPool::acquire(backend_t * backend) {
+    std::unique_ptr<httplib::Client> client;
+    {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        if (!backend->idle.empty()) {
+            client = std::move(backend->idle.back());
+            backend->idle.pop_back();
+        }
+    }
+    if (!client) {
+        client = std::make_unique<httplib::Client>(backend->url);
+        client->set_keep_alive(true);
+        client->set_connection_timeout(5);
+    }
+    return client;
+}
+
+// connections that failed or were stopped are dropped, not reused
+void BackendPool::release(backend_t * backend, 
+    std::unique_ptr<httplib::Client> client, bool reuse) {
+    std::lock_guard<std::mutex> lk(backend->mtx);
+    if (reuse && backend->idle.size() < max_idle) {
+        backend->idle.push_back(std::move(client));
+    }
+}
+
+void BackendPool::attempt(backend_t * backend, std::shared_ptr<call_t> call, 
+    const std::string& path, const std::string& body, time_point deadline) {
+    auto client = acquire(backend);
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lk(call->mtx);
+        cancelled = call->done;
+        if (!cancelled) call->clients.push_back(client.get());
+    }
+    {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        backend->active.push_back(client.get());
+    }
+
+    int status = 0;
+    std::string response;
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!cancelled && running) {
+        set_timeout(client.get(), std::chrono::duration_cast<
+            std::chrono::milliseconds>(deadline - start));
+        auto res = client->Post(path, body, "application/json");
+        if (res) {
+            status = res->status;
+            response = res->body;
+            if (status != 200) error = std::to_string(status) + " " + res->body;
+        } else {
+            error = httplib::to_string(res.error());
+        }
+    }
+    double latency_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    {
+        std::lock_guard<std::mutex> lk(backend->mtx);
+        auto it = std::find(backend->active.begin(), backend->active.end(), 
+            client.get());
+        if (it != backend->active.end()) backend->active.erase(it);
+        if (status == 200) {
+            backend->latencies.push_back(latency_ms);
+            if (backend->latencies.size() > max_samples) {
+                backend->latencies.pop_front();
+            }
+        }
+    }
+
+    bool lost = false;
+    {
+        std::lock_guard<std::mutex> lk(call->mtx);
+        lost = call->done;
+        auto it = std::find(call->clients.begin(), call->clients.end(), 
+            client.get());
+        if (it != call->clients.end()) call->clients.erase(it);
+        --call->pending;
+        if (!call->done && (status == 200 || (status >= 400 && status < 500))) {
+            // a 4xx is the request's fault and would fail anywhere
+            call->done = true;
+            call->ok = status == 200;
+            call->response = response;
+            for (auto other: call->clients) other->stop();
+        }
+        if (!call->ok && !error.empty()) {
+            call->error = backend->url + ": " + error;
+        }
+    }
+    call->cv.notify_all();
+
+    // a request stopped because another backend won says nothing about
+    // this backend's health
+    if (status == 200 || (status >= 400 && status < 500)) {
+        backend->failures = 0;
+    } else if (!lost && running && ++backend->failures >= max_failures) {
+        if (backend->healthy.exchange(false)) {
+            std::cout << "LLM backend " << backend->url << " is down: "
+                << error << std::endl;
+        }
+    }
+    release(backend, std::move(client), status == 200 && !lost);
+    --backend->outstanding;
+}
+
+nlohmann::json BackendPool::post(const std::string& path, 
+    const nlohmann::json& body, int timeout_ms /* = 0 */) {
+    if (!running) throw std::runtime_error("backends are shut down");
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(
+        timeout_ms > 0 ? timeout_ms : this->timeout_ms);
+    auto call = std::make_shared<call_t>();
+    std::string payload = body.dump();
+    std::vector<backend_t *> tried;
+    auto hedge_at = time_point::max();
+
+    std::unique_lock<std::mutex> lk(call->mtx);
+    while (!call->done) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || !running) break;
+        // first attempt, failover after an error, or the hedge is due
+        if (call->pending == 0 || now >= hedge_at) {
+            backend_t * backend = pick(tried);
+            hedge_at = time_point::max();
+            if (!backend) {
+                if (call->pending == 0) break;
+                continue;
+            }
+            if (hedge && tried.empty()) {
+                double delay = hedge_delay(backend);
+                if (delay >= 0) {
+                    hedge_at = now + std::chrono::milliseconds(int64_t(delay));
+                }
+            }
+            tried.push_back(backend);
+            ++call->pending;
+            ++backend->outstanding;
+            if (!submit([this, backend, call, path, payload, deadline] {
+                attempt(backend, call, path, payload, deadline);
+            })) {
+                --call->pending;
+                --backend->outstanding;
+                break;
+            }
+            continue;
+        }
+        call->cv.wait_until(lk, std::min(deadline, hedge_at));
+    }
+
+    if (!call->done) {
+        // stop the attempts still running, they finish on the pool
+        call->done = true;
+        for (auto client: call->clients) client->stop();
+        throw std::runtime_error(call->error.empty() ? 
+            "no LLM backend answered in time" : call->error);
+    }
+    if (!call->ok) throw std::runtime_error(call->error);
+    return nlohmann::json::parse(call->response);
+}
+
+int BackendPool::broadcast(const std::string& path, const nlohmann::json& body) {
+    int failures = 0;
+    std::string payload = body.dump();
+    for (auto& backend: backends) {
+        auto client = acquire(backend.get());
+        set_timeout(client.get(), std::chrono::milliseconds(timeout_ms));
+        auto res = client->Post(path, payload, "application/json");
+        bool ok = res && res->status == 200;
+        if (!ok) {
+            std::cout << "LLM backend " << backend->url << " " << path << " failed: "
+                << (res ? res->body : httplib::to_string(res.error())) << std::endl;
+            ++failures;
+        }
+        release(backend.get(), std::move(client), ok);
+    }
+    return failures;
+}
+
+int BackendPool::slot(int id, const std::string& action, 
+    const std::string& filename) {
+    nlohmann::json body = {{"filename", filename}};
+    return broadcast("/slots/" + std::to_string(id) + "?action=" + action, 
+        body) == 0 ? 0 : -1;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "httplib.h"
+
+// a set of llama-server instances behind one call: each request goes to the
+// healthy backend with the fewest outstanding requests, over a pool of
+// keep-alive connections. A request that runs past the backend's p95
+// latency is duplicated on a second backend and the first answer wins.
+class BackendPool : public ChatEngine {
+public:
+    BackendPool() = default;
+    ~BackendPool() override;
+    BackendPool(const BackendPool&) = delete;
+    BackendPool operator=(const BackendPool&) = delete;
+
+    // config: {"servers": ["http://host:8080", ...], "timeout": 120 (s),
+    //   "health_interval": 5 (s), "hedge": true, "hedge_percentile": 0.95,
+    //   "hedge_min_delay": 1000 (ms)}; without servers schema_host_port is used
+    int init(const nlohmann::json& config, const std::string& schema_host_port);
+    int shutdown() override;
+
+    nlohmann::json chat(const nlohmann::json& request) override {
+        return post("/v1/chat/completions", request);
+    }
+    // llama-server slots, applied on every backend
+    int slot(int id, const std::string& action, 
+        const std::string& filename) override;
+
+    // POST body to path on one backend and return the parsed response,
+    // throws std::runtime_error when no backend answers within the deadline
+    nlohmann::json post(const std::string& path, const nlohmann::json& body, 
+        int timeout_ms = 0);
+    // POST body to path on every backend, returns the number of failures
+    int broadcast(const std::string& path, const nlohmann::json& body);
+
+private:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    typedef struct _backend_t {
+        std::string url;
+        std::atomic<int> outstanding = 0;
+        std::atomic<bool> healthy = true;
+        std::atomic<int> failures = 0; // consecutive
+        std::mutex mtx;
+        std::vector<std::unique_ptr<httplib::Client>> idle; // keep-alive
+        std::vector<httplib::Client *> active;
+        std::deque<double> latencies; // ms of the last successful requests
+    } backend_t;
+
+    // one post() call, shared with the attempts racing for it
+    typedef struct _call_t {
+        std::mutex mtx;
+        std::condition_variable cv;
+        int pending = 0;
+        bool done = false;
+        bool ok = false;
+        std::string response;
+        std::string error;
+        std::vector<httplib::Client *> clients;
+    } call_t;
+
+    std::vector<std::unique_ptr<backend_t>> backends;
+    int timeout_ms = 120000;
+    int health_interval = 5;
+    bool hedge = true;
+    double hedge_percentile = 0.95;
+    int hedge_min_delay = 1000;
+    const size_t max_idle = 8; // connections kept per backend
+    const size_t max_samples = 128;
+    const int max_failures = 3; // before a backend is taken out
+
+    std::atomic<bool> running = false;
+    std::thread health_thread;
+    std::mutex health_mtx;
+    std::condition_variable health_cv;
+    void health_worker();
+
+    // the attempts run on threads of the pool, started when all are busy
+    // and joined in shutdown
+    std::mutex attempts_mtx;
+    std::condition_variable attempts_cv;
+    std::deque<std::function<void()>> attempts;
+    std::vector<std::thread> attempt_threads;
+    size_t idle_threads = 0;
+    bool submit(std::function<void()> task);
+    void attempt_worker();
+
+    backend_t * pick(const std::vector<backend_t *>& tried);
+    double hedge_delay(backend_t * backend);
+    void attempt(backend_t * backend, std::shared_ptr<call_t> call, 
+        const std::string& path, const std::string& body, time_point deadline);
+    std::unique_ptr<httplib::Client> acquire(backend_t * backend);
+    void release(backend_t * backend, std::unique_ptr<httplib::Client> client, 
+        bool reuse);
+};
@@ -0,0 +1,220 @@
+#include "cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <openssl/evp.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+static const char cache_magic[8] = {'V', 'L', 'C', 'A', 'C', 'H', 'E', '1'};
+
+// records are padded to 8 bytes to keep their headers aligned in the map
+static size_t record_stride(size_t size) {
+    return (sizeof(ResponseCache::record_t) + size + 7) & ~size_t(7);
+}
+
+ResponseCache::~ResponseCache() {
+    shutdown();
+}
+
+int ResponseCache::init(const nlohmann::json& config) {
+    if (!config.value("enabled", false)) return 0;
+
+    path = config.value("path", "cache/llm.cache");
+    capacity = size_t(config.value("max_size", 64)) * 1024 * 1024;
+    if (capacity < sizeof(header_t) + sizeof(record_t)) return -1;
+
+    auto dir = std::filesystem::path(path).parent_path();
+    if (!dir.empty() && !std::filesystem::exists(dir)) {
+        std::filesystem::create_directories(dir);
+    }
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open cache file: " << path << std::endl;
+        return -1;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size < off_t(capacity) && ftruncate(fd, capacity) != 0) {
+        std::cerr << "Failed to resize cache file: " << path << std::endl;
+        shutdown();
+        return -1;
+    }
+    // an existing larger file keeps its size, extra space is used as well
+    if (size > off_t(capacity)) capacity = size;
+
+    void * addr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, 
+        MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Failed to map cache file: " << path << std::endl;
+        shutdown();
+        return -1;
+    }
+    data = static_cast<char *>(addr);
+    int ret = load();
+    enabled = ret == 0;
+    return ret;
+}
+
+int ResponseCache::shutdown() {
+    enabled = false;
+    std::lock_guard<std::mutex> lk(mtx);
+    if (data) {
+        msync(data, capacity, MS_SYNC);
+        munmap(data, capacity);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    entries.clear();
+    return 0;
+}
+
+// rebuild the index; record order stands in for access order after restart
+int ResponseCache::load() {
+    if (memcmp(header()->magic, cache_magic, sizeof(cache_magic)) != 0
+        || header()->data_end < sizeof(header_t)
+        || header()->data_end > capacity) {
+        memcpy(header()->magic, cache_magic, sizeof(cache_magic));
+        header()->data_end = sizeof(header_t);
+        return 0;
+    }
+
+    uint64_t offset = sizeof(header_t);
+    while (offset + sizeof(record_t) <= header()->data_end) {
+        const record_t * record = reinterpret_cast<const record_t *>(data + offset);
+        if (offset + record_stride(record->size) > header()->data_end) break;
+        std::string k(reinterpret_cast<const char *>(record->key), 
+            sizeof(record->key));
+        entries[k] = {offset, record->size, ++tick};
+        offset += record_stride(record->size);
+    }
+    header()->data_end = offset;
+    return 0;
+}
+
+std::string ResponseCache::key(const nlohmann::json& request) {
+    nlohmann::json content = request;
+    content.erase("id_slot");
+    content.erase("cache_prompt");
+    content.erase("stream");
+    // ASR text is not always valid UTF-8, dump() would throw on it
+    std::string text = content.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size = 0;
+    EVP_Digest(text.data(), text.size(), digest, &size, EVP_sha256(), nullptr);
+    return std::string(reinterpret_cast<const char *>(digest), size);
+}
+
+bool ResponseCache::get(const std::string& key, std::string& value) {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!data) return false;
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        ++misses;
+        return false;
+    }
+    it->second.tick = ++tick;
+    value.assign(data + it->second.offset + sizeof(record_t), it->second.size);
+    ++hits;
+    return true;
+}
+
+int ResponseCache::put(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!data || key.size() != sizeof(record_t::key)) return -1;
+    if (entries.count(key)) return 0;
+
+    size_t need = record_stride(value.size());
+    if (sizeof(header_t) + need > capacity) return -1;
+    if (header()->data_end + need > capacity && evict(need) != 0) return -1;
+
+    uint64_t offset = header()->data_end;
+    record_t * record = reinterpret_cast<record_t *>(data + offset);
+    memcpy(record->key, key.data(), sizeof(record->key));
+    record->size = value.size();
+    record->reserved = 0;
+    memcpy(data + offset + sizeof(record_t), value.data(), value.size());
+    // publish the record only once it is completely written
+    header()->data_end = offset + need;
+    entries[key] = {offset, uint32_t(value.size()), ++tick};
+    return 0;
+}
+
+// keep the most recently used entries that fit in half the capacity (and
+// leave room for need bytes). They are written to a new file that is
+// renamed over the old one, so a crash never leaves a half-moved cache
+int ResponseCache::evict(size_t need) {
+    std::vector<std::pair<std::string, entry_t>> keep(entries.begin(), 
+        entries.end());
+    std::sort(keep.begin(), keep.end(), [](const auto& a, const auto& b) {
+        return a.second.tick > b.second.tick;
+    });
+
+    size_t budget = std::min(capacity / 2, capacity - sizeof(header_t) - need);
+    size_t used = 0;
+    size_t n = 0;
+    while (n < keep.size() &&
+        used + record_stride(keep[n].second.size) <= budget) {
+        used += record_stride(keep[n].second.size);
+        ++n;
+    }
+    keep.resize(n);
+
+    std::string tmp = path + ".tmp";
+    int tmp_fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (tmp_fd < 0) {
+        std::cerr << "Failed to open cache file: " << tmp << std::endl;
+        return -1;
+    }
+    void * addr = MAP_FAILED;
+    if (ftruncate(tmp_fd, capacity) == 0) {
+        addr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, 
+            MAP_SHARED, tmp_fd, 0);
+    }
+    if (addr == MAP_FAILED) {
+        std::cerr << "Failed to compact cache file: " << path << std::endl;
+        close(tmp_fd);
+        unlink(tmp.c_str());
+        return -1;
+    }
+    char * next = static_cast<char *>(addr);
+
+    // oldest first, load() takes record order as access order
+    std::sort(keep.begin(), keep.end(), [](const auto& a, const auto& b) {
+        return a.second.tick < b.second.tick;
+    });
+    std::unordered_map<std::string, entry_t> kept;
+    uint64_t offset = sizeof(header_t);
+    for (auto& [k, entry]: keep) {
+        size_t size = record_stride(entry.size);
+        memcpy(next + offset, data + entry.offset, size);
+        entry.offset = offset;
+        kept[k] = entry;
+        offset += size;
+    }
+    header_t * next_header = reinterpret_cast<header_t *>(next);
+    memcpy(next_header->magic, cache_magic, sizeof(cache_magic));
+    next_header->data_end = offset;
+
+    if (msync(next, capacity, MS_SYNC) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to replace cache file: " << path << std::endl;
+        munmap(next, capacity);
+        close(tmp_fd);
+        unlink(tmp.c_str());
+        return -1;
+    }
+    munmap(data, capacity);
+    close(fd);
+    data = next;
+    fd = tmp_fd;
+    entries = std::move(kept);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+
+// disk-backed LLM completion cache keyed by the SHA-256 of the request.
+// Records are appended to a memory-mapped file of fixed capacity; when it
+// is full the least recently used half is dropped by compacting the rest
+// into a new file that replaces the old one.
+class ResponseCache {
+public:
+    ResponseCache() = default;
+    ~ResponseCache();
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache operator=(const ResponseCache&) = delete;
+
+    // config: {"enabled": true, "path": "cache/llm.cache", "max_size": 64} (MB)
+    int init(const nlohmann::json& config);
+    int shutdown();
+
+    // key over everything that affects the completion: model, sampling
+    // parameters and messages; transport hints like id_slot are left out
+    static std::string key(const nlohmann::json& request);
+
+    bool get(const std::string& key, std::string& value);
+    int put(const std::string& key, const std::string& value);
+
+    bool isEnabled() const {
+        return enabled;
+    }
+    uint64_t getHits() const {
+        return hits;
+    }
+    uint64_t getMisses() const {
+        return misses;
+    }
+
+    typedef struct _record_t {
+        unsigned char key[32];
+        uint32_t size;
+        uint32_t reserved;
+    } record_t;
+
+private:
+    typedef struct _header_t {
+        char magic[8];
+        uint64_t data_end;
+    } header_t;
+
+    typedef struct _entry_t {
+        uint64_t offset; // of the record header
+        uint32_t size;
+        uint64_t tick; // last access, for LRU
+    } entry_t;
+
+    std::string path;
+    int fd = -1;
+    char * data = nullptr;
+    size_t capacity = 0;
+    uint64_t tick = 0;
+    std::unordered_map<std::string, entry_t> entries;
+    std::mutex mtx;
+
+    // data is replaced under mtx when compacting, readers outside it ask this
+    std::atomic<bool> enabled = false;
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+
+    header_t * header() {
+        return reinterpret_cast<header_t *>(data);
+    }
+    int load();
+    int evict(size_t need);
+};
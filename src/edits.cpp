@@ -0,0 +1,170 @@
+#include "edits.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+// a result shorter than this share of the input is more likely a misread
+// span than a cleanup
+static const double min_kept = 0.5;
+
+static bool is_word_char(unsigned char c) {
+    return std::isalnum(c) || c == '_' || c == '\'' || c == '-';
+}
+
+static size_t sequence_length(unsigned char c) {
+    if (c >= 0xF0) return 4;
+    if (c >= 0xE0) return 3;
+    if (c >= 0xC0) return 2;
+    return 1;
+}
+
+static std::string trim(const std::string& text) {
+    const char * spaces = " \t\r\n";
+    size_t start = text.find_first_not_of(spaces);
+    if (start == std::string::npos) return std::string();
+    size_t end = text.find_last_not_of(spaces);
+    // the full-width space is whitespace too
+    while (text.compare(start, 3, "　") == 0 && start + 3 <= end) start += 3;
+    return text.substr(start, end - start + 1);
+}
+
+std::vector<std::string> Edits::split(const std::string& text) {
+    std::vector<std::string> units;
+    std::string space;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        unsigned char c = text[pos];
+        if (text.compare(pos, 2, "<|") == 0) {
+            size_t end = text.find("|>", pos + 2);
+            if (end != std::string::npos) {
+                pos = end + 2;
+                continue;
+            }
+        }
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            space += char(c);
+            ++pos;
+            continue;
+        }
+        if (text.compare(pos, 3, "　") == 0) {
+            space += "　";
+            pos += 3;
+            continue;
+        }
+        size_t end = pos + 1;
+        if (c < 0x80 && is_word_char(c)) {
+            while (end < text.size() && is_word_char(text[end])) ++end;
+        } else if (c == '<') {
+            // <BGM> and the like are one unit, so they go with one delete
+            size_t close = text.find('>', pos + 1);
+            if (close != std::string::npos && close - pos < 32
+                && text.find_first_of(" \n<", pos + 1) > close) {
+                end = close + 1;
+            }
+        } else if (c >= 0x80) {
+            end = std::min(text.size(), pos + sequence_length(c));
+        }
+        units.push_back(space + text.substr(pos, end - pos));
+        space.clear();
+        pos = end;
+    }
+    if (!units.empty()) units.back() += space;
+    return units;
+}
+
+std::string Edits::render(const std::vector<std::string>& units) {
+    std::string result;
+    for (size_t i = 0; i < units.size(); ++i) {
+        if (i > 0) result += ' ';
+        result += std::to_string(i) + ':' + trim(units[i]);
+    }
+    return result;
+}
+
+static bool read_index(const std::string& line, size_t& pos, int& value) {
+    while (pos < line.size() && line[pos] == ' ') ++pos;
+    size_t start = pos;
+    while (pos < line.size() && std::isdigit((unsigned char)line[pos])) ++pos;
+    if (pos == start || pos - start > 9) return false;
+    value = std::stoi(line.substr(start, pos - start));
+    return true;
+}
+
+int Edits::parse(const std::string& line, int size, op_t& op) {
+    op.type = line[0];
+    if (op.type != 'D' && op.type != 'R' && op.type != 'I') return -1;
+    if (line.size() < 2 || line[1] != ' ') return -1;
+    size_t pos = 1;
+    if (!read_index(line, pos, op.first)) return -1;
+    if (op.type == 'I') {
+        op.last = op.first - 1;
+        if (op.first > size) return -1;
+    } else {
+        if (!read_index(line, pos, op.last)) return -1;
+        if (op.first > op.last || op.last >= size) return -1;
+    }
+    if (pos < line.size() && line[pos] != ' ') return -1;
+    op.text = trim(line.substr(pos));
+    if (op.type == 'D' && !op.text.empty()) return -1;
+    if (op.type == 'I' && op.text.empty()) return -1;
+    return 0;
+}
+
+int Edits::apply(const std::vector<std::string>& units, 
+    const std::string& ops, std::string& result, std::string * error /* = nullptr */) {
+    auto fail = [&](const std::string& reason) {
+        if (error) *error = reason;
+        result.clear();
+        return -1;
+    };
+    int size = int(units.size());
+    std::vector<op_t> edits;
+    std::istringstream stream(ops);
+    std::string line;
+    while (std::getline(stream, line)) {
+        line = trim(line);
+        // tolerate a code fence around the list
+        if (line.empty() || line == "NONE" || line.rfind("```", 0) == 0) continue;
+        op_t op;
+        if (parse(line, size, op) != 0) return fail("bad edit: " + line);
+        edits.push_back(op);
+    }
+
+    // inserts go before a span starting at the same unit
+    std::stable_sort(edits.begin(), edits.end(), [](const op_t& a, const op_t& b) {
+        if (a.first != b.first) return a.first < b.first;
+        return a.type == 'I' && b.type != 'I';
+    });
+    int next = 0; // first unit not covered by a span yet
+    for (const auto& op: edits) {
+        if (op.first < next) return fail("overlapping edits at " + std::to_string(op.first));
+        next = std::max(next, op.last + 1);
+    }
+
+    result.clear();
+    size_t k = 0;
+    size_t input_size = 0;
+    for (int i = 0; i <= size; ++i) {
+        while (k < edits.size() && edits[k].type == 'I' && edits[k].first == i) {
+            result += edits[k++].text;
+        }
+        if (i == size) break;
+        input_size += units[i].size();
+        if (k < edits.size() && edits[k].first == i) {
+            const op_t& op = edits[k++];
+            if (op.type == 'R') {
+                // keep the space in front of a replaced word
+                result += units[i].substr(0, units[i].find(trim(units[i]))) + op.text;
+            }
+            for (int j = i + 1; j <= op.last; ++j) input_size += units[j].size();
+            i = op.last;
+            continue;
+        }
+        result += units[i];
+    }
+    if (result.size() < min_kept * input_size) {
+        return fail("edits removed " + std::to_string(input_size - result.size()) +
+            " of " + std::to_string(input_size) + " bytes");
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// refine as edit operations: the input is split into numbered units (a CJK
+// character, a Latin word or number, a punctuation mark or a tag) and the
+// model answers with edits against the numbers instead of the whole text,
+// one per line:
+//   D a b         delete units a..b
+//   R a b text    replace units a..b with text
+//   I a text      insert text before unit a, a == size appends
+//   NONE          nothing to change
+class Edits {
+public:
+    // whitespace before a unit stays with it; <|...|> ASR tags are dropped
+    static std::vector<std::string> split(const std::string& text);
+    // "0:嗯 1:， 2:今 ..." with the units' whitespace left out
+    static std::string render(const std::vector<std::string>& units);
+    // parse and check ops against units, then apply them; returns -1 and
+    // leaves result empty when any line is malformed, a span is out of
+    // range or overlaps another, or the result lost too much of the input
+    static int apply(const std::vector<std::string>& units, 
+        const std::string& ops, std::string& result, std::string * error = nullptr);
+
+private:
+    typedef struct _op_t {
+        char type = 0; // 'D', 'R' or 'I'
+        int first = 0;
+        int last = -1; // first - 1 for an insert
+        std::string text;
+    } op_t;
+
+    static int parse(const std::string& line, int size, op_t& op);
+};
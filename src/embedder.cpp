@@ -0,0 +1,243 @@
+#include "embedder.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+// the code point at text[i], advancing i; invalid bytes read as U+FFFD
+static uint32_t next_code_point(const std::string& text, size_t& i) {
+    unsigned char c = text[i++];
+    if (c < 0x80) return c;
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (extra == 0) return 0xFFFD;
+    uint32_t cp = c & (0x3F >> extra);
+    for (int k = 0; k < extra; ++k) {
+        if (i >= text.size() || (text[i] & 0xC0) != 0x80) return 0xFFFD;
+        cp = (cp << 6) | (text[i++] & 0x3F);
+    }
+    return cp;
+}
+
+static bool is_cjk(uint32_t cp) {
+    return (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0x3400 && cp <= 0x4DBF)
+        || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x20000 && cp <= 0x2FA1F);
+}
+
+// ASCII punctuation plus the CJK and full-width punctuation blocks, as the
+// BERT basic tokenizer splits them off
+static bool is_punct(uint32_t cp) {
+    return (cp >= 33 && cp <= 47) || (cp >= 58 && cp <= 64) || (cp >= 91 && cp <= 96)
+        || (cp >= 123 && cp <= 126) || (cp >= 0x2000 && cp <= 0x206F)
+        || (cp >= 0x3000 && cp <= 0x303F) || (cp >= 0xFF00 && cp <= 0xFF0F)
+        || (cp >= 0xFF1A && cp <= 0xFF20) || (cp >= 0xFF3B && cp <= 0xFF40)
+        || (cp >= 0xFF5B && cp <= 0xFF65);
+}
+
+Embedder::~Embedder() {
+    shutdown();
+}
+
+int Embedder::init(const nlohmann::json& config) {
+    const std::string model_path = config.value("model_path", "models/bge-small-zh-v1.5");
+    const std::string model_file = model_path + "/model.onnx";
+    const std::string vocab_file = model_path + "/vocab.txt";
+
+    if (load_vocab(vocab_file) != 0) {
+        std::cerr << "Failed to load vocab from " << vocab_file << std::endl;
+        return -1;
+    }
+    max_length = config.value("max_length", 256);
+    if (max_length < 3) max_length = 3;
+    mean_pooling = config.value("pooling", "cls") == "mean";
+    query_prefix = config.value("query_prefix", "");
+
+    static Ort::Env env(ORT_LOGGING_LEVEL_ERROR, "echonote-embedder");
+    Ort::SessionOptions so;
+    so.SetGraphOptimizationLevel(ORT_ENABLE_ALL);
+    // the callers run batches in parallel, keep each run narrow
+    so.SetIntraOpNumThreads(config.value("intra_threads", 2));
+    try {
+        session = std::make_unique<Ort::Session>(
+            env, model_file.c_str(), so
+        );
+
+        // exports differ in which of input_ids, attention_mask and
+        // token_type_ids they take
+        Ort::AllocatorWithDefaultOptions allocator;
+        input_names.clear();
+        for (size_t i = 0; i < session->GetInputCount(); ++i) {
+            input_names.emplace_back(session->GetInputNameAllocated(i, allocator).get());
+        }
+        output_name = session->GetOutputNameAllocated(0, allocator).get();
+    } catch (const Ort::Exception& e) {
+        std::cerr << "Failed to load embedding model " << model_file << ": " << e.what() << std::endl;
+        session.reset();
+        return -1;
+    }
+    return 0;
+}
+
+int Embedder::shutdown() {
+    if (session) {
+        session->release();
+        session.reset();
+    }
+    return 0;
+}
+
+int Embedder::load_vocab(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) return -1;
+    vocab.clear();
+    std::string token;
+    for (int64_t id = 0; std::getline(file, token); ++id) {
+        if (!token.empty() && token.back() == '\r') token.pop_back();
+        vocab.emplace(token, id);
+    }
+    auto special = [this](const char * name, int64_t& id) {
+        auto it = vocab.find(name);
+        if (it != vocab.end()) id = it->second;
+    };
+    special("[CLS]", cls_id);
+    special("[SEP]", sep_id);
+    special("[UNK]", unk_id);
+    special("[PAD]", pad_id);
+    return vocab.empty() ? -1 : 0;
+}
+
+// greedy longest match, pieces after the first carry the ## prefix; a word
+// that cannot be covered is a single [UNK]
+void Embedder::word_piece(const std::string& word, std::vector<int64_t>& ids) const {
+    if (word.size() > 200) {
+        ids.push_back(unk_id);
+        return;
+    }
+    std::vector<int64_t> pieces;
+    size_t start = 0;
+    while (start < word.size()) {
+        size_t end = word.size();
+        int64_t found = -1;
+        while (end > start) {
+            std::string piece = word.substr(start, end - start);
+            if (start > 0) piece = "##" + piece;
+            auto it = vocab.find(piece);
+            if (it != vocab.end()) {
+                found = it->second;
+                break;
+            }
+            // never cut inside a UTF-8 sequence
+            do { --end; } while (end > start && (word[end] & 0xC0) == 0x80);
+        }
+        if (found < 0) {
+            ids.push_back(unk_id);
+            return;
+        }
+        pieces.push_back(found);
+        start = end;
+    }
+    ids.insert(ids.end(), pieces.begin(), pieces.end());
+}
+
+std::vector<int64_t> Embedder::encode(const std::string& text) const {
+    std::vector<int64_t> ids{cls_id};
+    std::string word;
+    auto flush = [&]() {
+        if (!word.empty()) word_piece(word, ids);
+        word.clear();
+    };
+    for (size_t i = 0; i < text.size() && ids.size() < max_length - 1;) {
+        // special tokens from the recognizer, such as <|zh|>
+        if (text.compare(i, 2, "<|") == 0) {
+            size_t end = text.find("|>", i + 2);
+            if (end != std::string::npos) {
+                flush();
+                i = end + 2;
+                continue;
+            }
+        }
+        size_t begin = i;
+        uint32_t cp = next_code_point(text, i);
+        if (cp <= ' ' || cp == 0x3000 || cp == 0xFFFD) {
+            flush();
+        } else if (is_cjk(cp) || is_punct(cp)) {
+            flush();
+            word_piece(text.substr(begin, i - begin), ids);
+        } else if (cp < 0x80) {
+            word += char(std::tolower(int(cp)));
+        } else {
+            word.append(text, begin, i - begin);
+        }
+    }
+    flush();
+    if (ids.size() > max_length - 1) ids.resize(max_length - 1);
+    ids.push_back(sep_id);
+    return ids;
+}
+
+std::vector<std::vector<float>> Embedder::embed(const std::vector<std::string>& texts, 
+    bool query /* = false */) {
+    if (!session || texts.empty()) return {};
+
+    std::vector<std::vector<int64_t>> encoded;
+    size_t length = 0;
+    for (const auto& text: texts) {
+        encoded.push_back(encode(query ? query_prefix + text : text));
+        length = std::max(length, encoded.back().size());
+    }
+    const int64_t batch = texts.size();
+    std::vector<int64_t> input_ids(batch * length, pad_id);
+    std::vector<int64_t> attention_mask(batch * length, 0);
+    std::vector<int64_t> token_type_ids(batch * length, 0);
+    for (int64_t b = 0; b < batch; ++b) {
+        std::copy(encoded[b].begin(), encoded[b].end(), input_ids.begin() + b * length);
+        std::fill_n(attention_mask.begin() + b * length, encoded[b].size(), 1);
+    }
+
+    Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(
+        OrtArenaAllocator, OrtMemTypeDefault);
+    const std::vector<int64_t> shape{batch, int64_t(length)};
+    std::vector<Ort::Value> inputs;
+    std::vector<const char *> names;
+    for (const auto& name: input_names) {
+        auto& data = name == "input_ids" ? input_ids :
+            name == "attention_mask" ? attention_mask : token_type_ids;
+        inputs.emplace_back(Ort::Value::CreateTensor<int64_t>(memoryInfo, 
+            data.data(), data.size(), shape.data(), shape.size()));
+        names.push_back(name.c_str());
+    }
+    const char * output_names[] = {output_name.c_str()};
+
+    Ort::RunOptions options(nullptr);
+    auto outputs = session->Run(options, names.data(), 
+        inputs.data(), inputs.size(), output_names, 1);
+    const float * data = outputs[0].GetTensorData<float>();
+    auto out_shape = outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+    // last_hidden_state [batch, tokens, hidden], or already pooled
+    // [batch, hidden] for exports that include the pooling
+    const bool pooled = out_shape.size() == 2;
+    const int64_t tokens = pooled ? 1 : out_shape[1];
+    const int dim = out_shape.back();
+    hidden = dim;
+
+    std::vector<std::vector<float>> vectors(batch, std::vector<float>(dim, 0.f));
+    for (int64_t b = 0; b < batch; ++b) {
+        auto& vec = vectors[b];
+        const float * rows = data + b * tokens * dim;
+        if (pooled || !mean_pooling) {
+            std::copy(rows, rows + dim, vec.begin());
+        } else {
+            const size_t n = encoded[b].size();
+            for (size_t t = 0; t < n; ++t) {
+                for (int h = 0; h < dim; ++h) vec[h] += rows[t * dim + h];
+            }
+        }
+        double norm = 0;
+        for (float v: vec) norm += double(v) * v;
+        norm = std::sqrt(norm);
+        if (norm > 0) {
+            for (float& v: vec) v = float(v / norm);
+        }
+    }
+    return vectors;
+}
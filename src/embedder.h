@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <onnxruntime/onnxruntime_cxx_api.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// sentence embeddings from a BERT-style ONNX model (bge-small-zh and the
+// like): a WordPiece tokenizer over the model's vocab.txt, one batched run,
+// then CLS or mean pooling and L2 normalisation, so a dot product of two
+// vectors is their cosine similarity. embed() may be called from several
+// threads, they share the one session.
+class Embedder {
+public:
+    Embedder() = default;
+    ~Embedder();
+    Embedder(const Embedder&) = delete;
+    Embedder operator=(const Embedder&) = delete;
+
+    int init(const nlohmann::json& config);
+    int shutdown();
+
+    bool ready() const {
+        return session != nullptr;
+    }
+    // known after the first embed()
+    int dims() const {
+        return hidden;
+    }
+
+    // query prepends query_prefix, which retrieval models such as bge are
+    // trained with
+    std::vector<std::vector<float>> embed(const std::vector<std::string>& texts, 
+        bool query = false);
+
+    std::vector<int64_t> encode(const std::string& text) const;
+
+private:
+    std::unique_ptr<Ort::Session> session;
+    std::vector<std::string> input_names;
+    std::string output_name;
+
+    std::unordered_map<std::string, int64_t> vocab;
+    int64_t cls_id = 101;
+    int64_t sep_id = 102;
+    int64_t unk_id = 100;
+    int64_t pad_id = 0;
+
+    size_t max_length = 256; // tokens, with [CLS] and [SEP]
+    bool mean_pooling = false;
+    std::string query_prefix;
+    std::atomic<int> hidden = 0;
+
+    int load_vocab(const std::string& filename);
+    void word_piece(const std::string& word, std::vector<int64_t>& ids) const;
+};
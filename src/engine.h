@@ -0,0 +1,19 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <string>
+
+// where chat completions are computed: llama-server instances over HTTP
+// (BackendPool) or llama.cpp linked into the process (LlamaEngine)
+class ChatEngine {
+public:
+    virtual ~ChatEngine() = default;
+
+    virtual int shutdown() = 0;
+    // OpenAI-style chat completion request in, response out; throws
+    // std::runtime_error when the completion fails
+    virtual nlohmann::json chat(const nlohmann::json& request) = 0;
+    // save or restore the KV cache of a slot, action is "save" or "restore"
+    virtual int slot(int id, const std::string& action, 
+        const std::string& filename) = 0;
+};
@@ -0,0 +1,318 @@
+#include "fonts.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+static const char atlas_magic[8] = {'V', 'L', 'F', 'O', 'N', 'T', '1', '\0'};
+
+static uint64_t fnv1a(const void * data, size_t size, 
+    uint64_t hash = 14695981039346656037ull) {
+    auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t hash_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        hash = fnv1a(buffer, file.gcount(), hash);
+    }
+    return hash;
+}
+
+// the full range of a language, or the common subset in dynamic mode
+static const ImWchar * language_ranges(ImFontAtlas * atlas, 
+    const std::string& language, bool dynamic) {
+    if (language.empty()) return atlas->GetGlyphRangesDefault();
+    if (language == "chinese") {
+        return dynamic ? atlas->GetGlyphRangesChineseSimplifiedCommon() :
+            atlas->GetGlyphRangesChineseFull();
+    }
+    if (language == "greek") return atlas->GetGlyphRangesGreek();
+    if (language == "korean") return atlas->GetGlyphRangesKorean();
+    if (language == "japanese") return atlas->GetGlyphRangesJapanese();
+    if (language == "cyrillic") return atlas->GetGlyphRangesCyrillic();
+    if (language == "thai") return atlas->GetGlyphRangesThai();
+    if (language == "vietnamese") return atlas->GetGlyphRangesVietnamese();
+    return nullptr;
+}
+
+int Fonts::init(const nlohmann::json& fonts, const nlohmann::json& config) {
+    cache_path = config.value("path", "output/fonts");
+    dynamic = config.value("dynamic", false);
+    oversample = config.value("oversample", 3);
+    min_interval = std::chrono::milliseconds(config.value("min_interval", 1000));
+
+    ImFontAtlas * atlas = ImGui::GetIO().Fonts;
+    faces.clear();
+    for (size_t i = 0; i < fonts.size(); ++i) {
+        face_t face;
+        face.filename = fonts[i].value("filename", "");
+        face.size = fonts[i].value("size", 16.f);
+        // the first face is the Latin one, the rest are merged into it
+        face.language = i == 0 ? "" : fonts[i].value("language", "");
+        if (i > 0 && !language_ranges(atlas, face.language, false)) continue;
+        face.hash = hash_file(face.filename);
+        faces.push_back(face);
+    }
+    if (faces.empty()) {
+        std::cout << "No fonts configured." << std::endl;
+        return -1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(cache_path, ec);
+    if (dynamic) {
+        std::ifstream file(cache_path + "/glyphs.txt", std::ios::binary);
+        std::string text((std::istreambuf_iterator<char>(file)), 
+            std::istreambuf_iterator<char>());
+        ImFontGlyphRangesBuilder builder;
+        builder.AddText(text.data(), text.data() + text.size());
+        ImVector<ImWchar> chars;
+        builder.BuildRanges(&chars);
+        for (int i = 0; i + 1 < chars.Size && chars[i]; i += 2) {
+            for (unsigned c = chars[i]; c <= chars[i + 1]; ++c) extra.insert(ImWchar(c));
+        }
+    }
+    build();
+    return 0;
+}
+
+void Fonts::mark(const ImWchar * ranges) {
+    for (; ranges && ranges[0]; ranges += 2) {
+        for (unsigned c = ranges[0]; c <= ranges[1] && c < 0x10000; ++c) {
+            baked[c >> 6] |= uint64_t(1) << (c & 63);
+        }
+    }
+}
+
+uint64_t Fonts::key() const {
+    uint64_t hash = fnv1a(atlas_magic, sizeof(atlas_magic));
+    hash = fnv1a(&oversample, sizeof(oversample), hash);
+    for (size_t i = 0; i < faces.size(); ++i) {
+        hash = fnv1a(&faces[i].hash, sizeof(faces[i].hash), hash);
+        hash = fnv1a(&faces[i].size, sizeof(faces[i].size), hash);
+        const auto& ranges = face_ranges[i];
+        hash = fnv1a(ranges.Data, ranges.Size * sizeof(ImWchar), hash);
+    }
+    return hash;
+}
+
+void Fonts::build() {
+    ImGuiIO& io = ImGui::GetIO();
+    ImFontAtlas * atlas = io.Fonts;
+    atlas->Clear();
+
+    face_ranges.assign(faces.size(), ImVector<ImWchar>());
+    for (size_t i = 0; i < faces.size(); ++i) {
+        ImFontGlyphRangesBuilder builder;
+        builder.AddRanges(language_ranges(atlas, faces[i].language, dynamic));
+        if (dynamic && faces[i].language == "chinese") {
+            for (ImWchar c: extra) builder.AddChar(c);
+        }
+        builder.BuildRanges(&face_ranges[i]);
+    }
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "atlas-%016llx.bin", (unsigned long long)key());
+    const std::string filename = cache_path + "/" + name;
+    if (!load(filename)) {
+        ImFontConfig fc;
+        fc.OversampleH = fc.OversampleV = oversample;
+        fc.PixelSnapH = false;
+        for (size_t i = 0; i < faces.size(); ++i) {
+            fc.MergeMode = i > 0;
+            atlas->AddFontFromFileTTF(faces[i].filename.c_str(), faces[i].size, 
+                &fc, face_ranges[i].Data);
+        }
+        atlas->Build();
+        if (save(filename) == 0) {
+            // an atlas for other ranges or older font files is stale now
+            std::error_code ec;
+            for (auto it = std::filesystem::directory_iterator(cache_path, ec);
+                !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+                std::string other = it->path().filename().string();
+                if (other.rfind("atlas-", 0) == 0 && other != name) {
+                    std::filesystem::remove(it->path(), ec);
+                }
+            }
+        }
+    }
+    if (atlas->Fonts.Size > 0) io.FontDefault = atlas->Fonts[0];
+
+    std::fill(baked.begin(), baked.end(), 0);
+    for (const auto& ranges: face_ranges) mark(ranges.Data);
+    last_build = std::chrono::steady_clock::now();
+}
+
+void Fonts::require(const char * begin, const char * end) {
+    if (!dynamic) return;
+    for (const char * p = begin; p < end;) {
+        unsigned char c = *p;
+        int extra_bytes = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+        unsigned cp = extra_bytes ? c & (0x3F >> extra_bytes) : c;
+        ++p;
+        for (int k = 0; k < extra_bytes && p < end; ++k, ++p) cp = (cp << 6) | (*p & 0x3F);
+        if (cp < 0x80 || cp >= 0x10000) continue;
+        if (!(baked[cp >> 6] & (uint64_t(1) << (cp & 63)))) {
+            baked[cp >> 6] |= uint64_t(1) << (cp & 63);
+            pending.insert(ImWchar(cp));
+        }
+    }
+}
+
+bool Fonts::update() {
+    if (!dynamic || pending.empty()) return false;
+    // new characters come in bursts while text streams in, bake them together
+    if (std::chrono::steady_clock::now() - last_build < min_interval) return false;
+    extra.insert(pending.begin(), pending.end());
+    pending.clear();
+    build();
+
+    std::string text;
+    for (ImWchar c: extra) {
+        if (c < 0x800) {
+            text += char(0xC0 | (c >> 6));
+        } else {
+            text += char(0xE0 | (c >> 12));
+            text += char(0x80 | ((c >> 6) & 0x3F));
+        }
+        text += char(0x80 | (c & 0x3F));
+    }
+    std::ofstream file(cache_path + "/glyphs.txt", std::ios::binary | std::ios::trunc);
+    file << text;
+    return true;
+}
+
+// header, then per font its metrics and glyphs, then the alpha texture;
+// only valid for the ImGui version that wrote it, which the key does not
+// cover, so a mismatch in sizes is treated as a miss
+int Fonts::save(const std::string& filename) {
+    ImFontAtlas * atlas = ImGui::GetIO().Fonts;
+    unsigned char * pixels = nullptr;
+    int width = 0, height = 0;
+    atlas->GetTexDataAsAlpha8(&pixels, &width, &height);
+    if (!pixels) return -1;
+
+    const std::string tmp = filename + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return -1;
+    auto put = [&out](const auto& value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+    out.write(atlas_magic, sizeof(atlas_magic));
+    put(uint32_t(sizeof(ImFontGlyph)));
+    put(int32_t(width));
+    put(int32_t(height));
+    put(atlas->TexUvScale);
+    put(atlas->TexUvWhitePixel);
+    put(atlas->TexUvLines);
+    put(int32_t(atlas->Fonts.Size));
+    for (const ImFont * font: atlas->Fonts) {
+        put(font->FontSize);
+        put(font->Ascent);
+        put(font->Descent);
+        put(int32_t(font->Glyphs.Size));
+        for (const ImFontGlyph& glyph: font->Glyphs) {
+            put(uint32_t(glyph.Codepoint));
+            put(glyph.AdvanceX);
+            const float box[8] = {glyph.X0, glyph.Y0, glyph.X1, glyph.Y1,
+                glyph.U0, glyph.V0, glyph.U1, glyph.V1};
+            put(box);
+        }
+    }
+    out.write(reinterpret_cast<const char *>(pixels), size_t(width) * height);
+    out.close();
+    if (!out) {
+        std::remove(tmp.c_str());
+        return -1;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, filename, ec);
+    return ec ? -1 : 0;
+}
+
+bool Fonts::load(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    auto get = [&in](auto& value) {
+        return bool(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    };
+    typedef struct _font_t {
+        float size, ascent, descent;
+        std::vector<std::pair<uint32_t, std::array<float, 9>>> glyphs;
+    } font_t;
+
+    char magic[8];
+    uint32_t glyph_size;
+    int32_t width, height, n_fonts;
+    ImVec2 uv_scale, uv_white;
+    decltype(ImFontAtlas::TexUvLines) uv_lines;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, atlas_magic, sizeof(magic)) != 0
+        || !get(glyph_size) || glyph_size != sizeof(ImFontGlyph)
+        || !get(width) || !get(height) || width <= 0 || height <= 0
+        || !get(uv_scale) || !get(uv_white) || !get(uv_lines)
+        || !get(n_fonts) || n_fonts <= 0 || n_fonts > 64) {
+        return false;
+    }
+    std::vector<font_t> fonts(n_fonts);
+    for (auto& font: fonts) {
+        int32_t n_glyphs;
+        if (!get(font.size) || !get(font.ascent) || !get(font.descent)
+            || !get(n_glyphs) || n_glyphs < 0 || n_glyphs > 0x20000) {
+            return false;
+        }
+        font.glyphs.resize(n_glyphs);
+        for (auto& [codepoint, values]: font.glyphs) {
+            if (!get(codepoint) || !get(values)) return false;
+        }
+    }
+    unsigned char * pixels = static_cast<unsigned char *>(IM_ALLOC(size_t(width) * height));
+    if (!in.read(reinterpret_cast<char *>(pixels), size_t(width) * height)) {
+        IM_FREE(pixels);
+        return false;
+    }
+
+    // what Build() would have left behind, without the font data
+    ImFontAtlas * atlas = ImGui::GetIO().Fonts;
+    atlas->TexPixelsAlpha8 = pixels;
+    atlas->TexWidth = width;
+    atlas->TexHeight = height;
+    atlas->TexUvScale = uv_scale;
+    atlas->TexUvWhitePixel = uv_white;
+    std::memcpy(atlas->TexUvLines, uv_lines, sizeof(uv_lines));
+    for (const auto& font: fonts) {
+        ImFontConfig config;
+        config.FontDataOwnedByAtlas = false;
+        config.SizePixels = font.size;
+        atlas->ConfigData.push_back(config);
+    }
+    for (size_t i = 0; i < fonts.size(); ++i) {
+        ImFont * font = IM_NEW(ImFont);
+        font->FontSize = fonts[i].size;
+        font->Ascent = fonts[i].ascent;
+        font->Descent = fonts[i].descent;
+        font->ContainerAtlas = atlas;
+        font->ConfigData = &atlas->ConfigData[int(i)];
+        font->ConfigDataCount = 1;
+        atlas->ConfigData[int(i)].DstFont = font;
+        for (const auto& [codepoint, v]: fonts[i].glyphs) {
+            // v: advance, then x0 y0 x1 y1 u0 v0 u1 v1
+            font->AddGlyph(nullptr, ImWchar(codepoint), v[1], v[2], v[3], v[4], 
+                v[5], v[6], v[7], v[8], v[0]);
+        }
+        font->BuildLookupTable();
+        atlas->Fonts.push_back(font);
+    }
+    atlas->TexReady = true;
+    return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "imgui.h"
+
+// the ImGui font atlas for the ui "fonts" list. A baked atlas is cached on
+// disk under a key made of the font files' contents, sizes and glyph
+// ranges, so later launches read it back instead of rasterizing. In
+// dynamic mode the Chinese faces start with the common characters and any
+// other character met in the text is baked before the next frame.
+class Fonts {
+public:
+    Fonts() = default;
+    Fonts(const Fonts&) = delete;
+    Fonts operator=(const Fonts&) = delete;
+
+    // fonts is the ui "fonts" list, config the "font_cache" block; needs an
+    // ImGui context
+    int init(const nlohmann::json& fonts, const nlohmann::json& config);
+
+    // note the characters of text that have no glyph yet
+    void require(const char * begin, const char * end);
+    void require(const std::string& text) {
+        require(text.data(), text.data() + text.size());
+    }
+
+    // rebuild with the missing glyphs, call between frames; true when the
+    // font texture has to be uploaded again
+    bool update();
+
+private:
+    typedef struct _face_t {
+        std::string filename;
+        float size;
+        std::string language;
+        uint64_t hash; // of the file contents
+    } face_t;
+
+    std::vector<face_t> faces;
+    std::string cache_path = "output/fonts";
+    bool dynamic = false;
+    int oversample = 3;
+    std::chrono::milliseconds min_interval{1000}; // between dynamic rebuilds
+
+    std::vector<uint64_t> baked = std::vector<uint64_t>(1024, 0); // a bit per BMP code point
+    std::set<ImWchar> extra; // baked on demand, kept across launches
+    std::set<ImWchar> pending;
+    // the atlas points into these until it is rebuilt
+    std::vector<ImVector<ImWchar>> face_ranges;
+    std::chrono::steady_clock::time_point last_build;
+
+    void build();
+    void mark(const ImWchar * ranges);
+    uint64_t key() const;
+    bool load(const std::string& filename);
+    int save(const std::string& filename);
+};
@@ -0,0 +1,152 @@
+#include "graph.h"
+#include <iostream>
+#include <set>
+
+Port * Stage::input(const std::string& port) const {
+    auto it = inputs.find(port);
+    return it == inputs.end() ? nullptr : it->second.get();
+}
+
+Port * Stage::output(const std::string& port) const {
+    auto it = outputs.find(port);
+    return it == outputs.end() ? nullptr : it->second.get();
+}
+
+Graph::~Graph() {
+    stop();
+}
+
+void Graph::define(const std::string& type, factory_t factory) {
+    factories[type] = std::move(factory);
+}
+
+bool Graph::split(const std::string& endpoint, std::string& stage, std::string& port) {
+    size_t dot = endpoint.find('.');
+    if (dot == std::string::npos || dot == 0 || dot + 1 == endpoint.size()) return false;
+    stage = endpoint.substr(0, dot);
+    port = endpoint.substr(dot + 1);
+    return true;
+}
+
+int Graph::build(const nlohmann::json& config) {
+    stop();
+    nodes.clear();
+    std::map<std::string, node_t> named;
+    for (const auto& entry: config.value("stages", nlohmann::json::array())) {
+        std::string name = entry.value("name", "");
+        std::string type = entry.value("type", name);
+        auto factory = factories.find(type);
+        if (name.empty() || named.count(name)) {
+            std::cerr << "Graph: stage without a name or named twice: " << name << std::endl;
+            return -1;
+        }
+        if (factory == factories.end()) {
+            std::cerr << "Graph: unknown stage type " << type << std::endl;
+            return -1;
+        }
+        node_t node;
+        node.stage = factory->second();
+        node.stage->name = name;
+        node.stage->threads = std::max(entry.value("threads", 1), 1);
+        if (node.stage->init(entry) != 0) {
+            std::cerr << "Graph: failed to init stage " << name << std::endl;
+            return -1;
+        }
+        named[name] = std::move(node);
+    }
+
+    size_t default_capacity = config.value("queue_capacity", 64);
+    std::map<std::string, std::set<std::string>> downstream;
+    std::map<std::string, int> indegree;
+    for (const auto& [name, node]: named) indegree[name] = 0;
+    for (const auto& edge: config.value("edges", nlohmann::json::array())) {
+        std::string from = edge.value("from", ""), to = edge.value("to", "");
+        std::string from_stage, from_port, to_stage, to_port;
+        if (!split(from, from_stage, from_port) || !split(to, to_stage, to_port)
+            || !named.count(from_stage) || !named.count(to_stage)) {
+            std::cerr << "Graph: bad edge " << from << " -> " << to << std::endl;
+            return -1;
+        }
+        Port * output = named[from_stage].stage->output(from_port);
+        Port * input = named[to_stage].stage->input(to_port);
+        if (!output || !input) {
+            std::cerr << "Graph: no such port in " << from << " -> " << to << std::endl;
+            return -1;
+        }
+        if (output->type() != input->type()) {
+            std::cerr << "Graph: " << from << " and " << to << " carry different types" << std::endl;
+            return -1;
+        }
+        if (output->connect(*input, edge.value("capacity", default_capacity)) != 0) {
+            std::cerr << "Graph: cannot connect " << from << " -> " << to << std::endl;
+            return -1;
+        }
+        if (downstream[from_stage].insert(to_stage).second) ++indegree[to_stage];
+    }
+
+    // sources first, so stop() can drain the graph front to back
+    std::vector<std::string> ready;
+    for (const auto& [name, degree]: indegree) {
+        if (degree == 0) ready.push_back(name);
+    }
+    while (!ready.empty()) {
+        std::string name = ready.back();
+        ready.pop_back();
+        nodes.push_back(std::move(named[name]));
+        for (const auto& next: downstream[name]) {
+            if (--indegree[next] == 0) ready.push_back(next);
+        }
+    }
+    if (nodes.size() != named.size()) {
+        std::cerr << "Graph: the edges form a cycle" << std::endl;
+        nodes.clear();
+        return -1;
+    }
+    return 0;
+}
+
+int Graph::start() {
+    if (running || nodes.empty()) return -1;
+    for (auto& node: nodes) {
+        node.stage->stop_requested = false;
+        Stage * stage = node.stage.get();
+        for (int i = 0; i < stage->threads; ++i) {
+            node.workers.emplace_back([stage, i]() { stage->run(i); });
+        }
+    }
+    running = true;
+    return 0;
+}
+
+void Graph::stop() {
+    if (!running) return;
+    for (auto& node: nodes) {
+        node.stage->stop_requested = true;
+        node.stage->stop();
+        for (auto& worker: node.workers) {
+            if (worker.joinable()) worker.join();
+        }
+        node.workers.clear();
+        node.stage->drain();
+        for (auto& [port, output]: node.stage->outputs) output->close();
+    }
+    running = false;
+}
+
+Stage * Graph::stage(const std::string& name) const {
+    for (const auto& node: nodes) {
+        if (node.stage->name == name) return node.stage.get();
+    }
+    return nullptr;
+}
+
+nlohmann::json Graph::stats() const {
+    nlohmann::json stats = nlohmann::json::object();
+    for (const auto& node: nodes) {
+        for (const auto& [port, input]: node.stage->inputs) {
+            auto queue = input->stats();
+            if (!queue.is_null()) stats[node.stage->name + "." + port] = queue;
+        }
+    }
+    return stats;
+}
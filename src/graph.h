@@ -0,0 +1,268 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// a bounded queue with any number of producers. push waits while it is
+// full, which is how a slow stage slows down the ones feeding it. It closes
+// once every producer has released it, and pop drains what is left first.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity = 64) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    // false once the queue is closed
+    bool push(T value) {
+        std::unique_lock<std::mutex> lk(mtx);
+        if (!closed && items.size() >= capacity) {
+            ++blocked;
+            not_full.wait(lk, [this] { return closed || items.size() < capacity; });
+        }
+        if (closed) return false;
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // false when the queue is closed and empty
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lk(mtx);
+        not_empty.wait(lk, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void acquire() {
+        std::lock_guard<std::mutex> lk(mtx);
+        ++producers;
+    }
+    void release() {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (producers > 0 && --producers == 0) close_locked();
+    }
+    void close() {
+        std::lock_guard<std::mutex> lk(mtx);
+        close_locked();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return items.size();
+    }
+    size_t getCapacity() const {
+        return capacity;
+    }
+    uint64_t getBlocked() const {
+        std::lock_guard<std::mutex> lk(mtx);
+        return blocked;
+    }
+
+private:
+    const size_t capacity;
+    mutable std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    int producers = 0;
+    bool closed = false;
+    uint64_t blocked = 0; // pushes that had to wait
+
+    void close_locked() {
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+class Port {
+public:
+    virtual ~Port() = default;
+    virtual std::type_index type() const = 0;
+    // outputs only: feed an input of the same type, the first edge into an
+    // input sizes its queue
+    virtual int connect(Port& input, size_t capacity) {
+        (void)input;
+        (void)capacity;
+        return -1;
+    }
+    // outputs only: let go of the inputs, they close when all producers have
+    virtual void close() {}
+    // inputs only: depth, capacity and waits of the queue
+    virtual nlohmann::json stats() const {
+        return nullptr;
+    }
+};
+
+template <typename T>
+class Input : public Port {
+public:
+    std::type_index type() const override {
+        return typeid(T);
+    }
+
+    // waits for a message; false once every producer is done and the
+    // queue is drained, or when nothing was ever connected
+    bool pop(T& value) {
+        return queue ? queue->pop(value) : false;
+    }
+
+    nlohmann::json stats() const override {
+        if (!queue) return nullptr;
+        return {
+            {"size", queue->size()},
+            {"capacity", queue->getCapacity()},
+            {"blocked", queue->getBlocked()}
+        };
+    }
+
+private:
+    template <typename> friend class Output;
+    std::shared_ptr<BoundedQueue<T>> queue;
+};
+
+template <typename T>
+class Output : public Port {
+public:
+    std::type_index type() const override {
+        return typeid(T);
+    }
+
+    int connect(Port& port, size_t capacity) override {
+        auto input = dynamic_cast<Input<T> *>(&port);
+        if (!input) return -1;
+        if (!input->queue) input->queue = std::make_shared<BoundedQueue<T>>(capacity);
+        input->queue->acquire();
+        targets.push_back(input->queue);
+        return 0;
+    }
+
+    // a copy to every connected input, waiting on the fullest; false when
+    // none took it
+    bool emit(const T& value) {
+        bool delivered = false;
+        for (const auto& target: targets) delivered |= target->push(value);
+        return delivered;
+    }
+
+    void close() override {
+        for (const auto& target: targets) target->release();
+        targets.clear();
+    }
+
+private:
+    std::vector<std::shared_ptr<BoundedQueue<T>>> targets;
+};
+
+// a node of the graph. Ports are declared in the constructor; run() is
+// called once per worker thread and returns when the inputs are drained,
+// or for a source when stopping() turns true.
+class Stage {
+public:
+    virtual ~Stage() = default;
+
+    // config is the stage's entry in the graph, after "threads" is applied
+    virtual int init(const nlohmann::json& config) {
+        (void)config;
+        return 0;
+    }
+    virtual void run(int worker) = 0;
+    // a source that blocks on something else than stopping() wakes it here
+    virtual void stop() {}
+    // after the workers returned, before the outputs close
+    virtual void drain() {}
+
+    const std::string& getName() const {
+        return name;
+    }
+    int getThreads() const {
+        return threads;
+    }
+    bool isSource() const {
+        return inputs.empty();
+    }
+    Port * input(const std::string& port) const;
+    Port * output(const std::string& port) const;
+
+protected:
+    template <typename T>
+    Input<T>& add_input(const std::string& port) {
+        auto input = std::make_unique<Input<T>>();
+        auto& ref = *input;
+        inputs[port] = std::move(input);
+        return ref;
+    }
+    template <typename T>
+    Output<T>& add_output(const std::string& port) {
+        auto output = std::make_unique<Output<T>>();
+        auto& ref = *output;
+        outputs[port] = std::move(output);
+        return ref;
+    }
+
+    bool stopping() const {
+        return stop_requested;
+    }
+    int threads = 1;
+
+private:
+    friend class Graph;
+    std::string name;
+    std::atomic<bool> stop_requested = false;
+    std::map<std::string, std::unique_ptr<Port>> inputs;
+    std::map<std::string, std::unique_ptr<Port>> outputs;
+};
+
+// stages and the queues between them, built from config:
+//   {"queue_capacity": 64,
+//    "stages": [{"name": "mic", "type": "capture", "threads": 1, ...}],
+//    "edges": [{"from": "mic.audio", "to": "asr.audio", "capacity": 64}]}
+// Stage types are looked up in the factories defined on the graph, so
+// every graph binds its own modules and several can run side by side.
+class Graph {
+public:
+    typedef std::function<std::unique_ptr<Stage>()> factory_t;
+
+    Graph() = default;
+    ~Graph();
+    Graph(const Graph&) = delete;
+    Graph operator=(const Graph&) = delete;
+
+    void define(const std::string& type, factory_t factory);
+    int build(const nlohmann::json& config);
+    int start();
+    // sources first; every stage drains what reached it before the next
+    // one in line is stopped
+    void stop();
+
+    Stage * stage(const std::string& name) const;
+    // queue depths per input, "stage.port"
+    nlohmann::json stats() const;
+
+private:
+    typedef struct _node_t {
+        std::unique_ptr<Stage> stage;
+        std::vector<std::thread> workers;
+    } node_t;
+
+    std::map<std::string, factory_t> factories;
+    std::vector<node_t> nodes; // in topological order after build()
+    bool running = false;
+
+    static bool split(const std::string& endpoint, std::string& stage, 
+        std::string& port);
+};
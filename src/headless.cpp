@@ -0,0 +1,196 @@
+#include "headless.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile std::sig_atomic_t stop_signal = 0;
+
+static void signal_handler(int) {
+    stop_signal = 1;
+}
+
+void EchoNote::Headless::run(const nlohmann::json& config, Audio * audio, 
+    LLM * llm, std::ostream& out) {
+    this->audio = audio;
+    this->llm = llm;
+    this->out = &out;
+    show_log = config.value("log", false);
+    socket_path = config.value("socket", "");
+
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+    // a socket client going away must not take the process with it
+    std::signal(SIGPIPE, SIG_IGN);
+    running = true;
+
+    std::thread accept_thread;
+    if (!socket_path.empty()) {
+        listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        ::unlink(socket_path.c_str());
+        if (listen_fd < 0
+            || ::bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0
+            || ::listen(listen_fd, 4) != 0) {
+            std::cerr << "Failed to listen on " << socket_path << ": "
+                << std::strerror(errno) << std::endl;
+            if (listen_fd >= 0) ::close(listen_fd);
+            listen_fd = -1;
+        } else {
+            ++inputs;
+            accept_thread = std::thread(&Headless::accept_worker, this);
+        }
+    }
+    if (config.value("stdin", true)) {
+        ++inputs;
+        // std::getline cannot be interrupted, the thread ends with the process
+        std::thread(&Headless::stdin_worker, this).detach();
+    }
+
+    if (config.value("autostart", false)) command("start");
+    emit({{"event", "ready"}});
+
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        while (running && !stop_signal) {
+            cv.wait_for(lk, std::chrono::milliseconds(200));
+        }
+    }
+    running = false;
+    audio->stop();
+
+    if (listen_fd >= 0) {
+        ::shutdown(listen_fd, SHUT_RDWR);
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+    if (accept_thread.joinable()) {
+        accept_thread.join();
+    }
+    if (!socket_path.empty()) ::unlink(socket_path.c_str());
+    {
+        // the client threads see end of stream and close their sockets
+        std::lock_guard<std::mutex> lk(out_mtx);
+        for (int fd: clients) ::shutdown(fd, SHUT_RDWR);
+        clients.clear();
+    }
+    emit({{"event", "exit"}});
+}
+
+// name: "asr", "refine", "summarize", "log"
+void EchoNote::Headless::show(const std::string& name, const std::string& text) {
+    if (name == "log" && !show_log) return;
+    emit({{"event", name}, {"text", text}});
+}
+
+// one JSON line to stdout and every socket client. A client whose socket
+// buffer is full is dropped rather than waited for, it would hold up the
+// display stage and through it the pipeline; a line is never half sent.
+void EchoNote::Headless::emit(const nlohmann::json& event) {
+    std::string line = event.dump(-1, ' ', false, 
+        nlohmann::json::error_handler_t::replace) + "\n";
+    std::lock_guard<std::mutex> lk(out_mtx);
+    if (out) {
+        *out << line;
+        out->flush();
+    }
+    for (auto it = clients.begin(); it != clients.end();) {
+        ssize_t sent = ::send(*it, line.data(), line.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent != static_cast<ssize_t>(line.size())) {
+            ::shutdown(*it, SHUT_RDWR);
+            it = clients.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void EchoNote::Headless::command(const std::string& line) {
+    std::string cmd = line;
+    cmd.erase(0, cmd.find_first_not_of(" \t\r"));
+    cmd.erase(cmd.find_last_not_of(" \t\r") + 1);
+    if (cmd.empty()) return;
+
+    if (cmd == "start") {
+        audio->start();
+    } else if (cmd == "stop") {
+        audio->stop();
+    } else if (cmd == "refine") {
+        llm->refine("");
+    } else if (cmd == "summarize") {
+        llm->summarize();
+    } else if (cmd == "quit") {
+        std::lock_guard<std::mutex> lk(mtx);
+        running = false;
+        cv.notify_all();
+        return;
+    } else if (cmd != "status") {
+        emit({{"event", "error"}, {"text", "unknown command: " + cmd}});
+        return;
+    }
+    emit({
+        {"event", "status"},
+        {"command", cmd},
+        {"recording", audio->isRecording()},
+        {"refine", llm->isRefine()},
+        {"summarize", llm->isSummarize()},
+        {"pending", llm->getPendingSize()}
+    });
+}
+
+void EchoNote::Headless::stdin_worker() {
+    std::string line;
+    while (running && std::getline(std::cin, line)) {
+        command(line);
+    }
+    close_input();
+}
+
+void EchoNote::Headless::accept_worker() {
+    while (running) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lk(out_mtx);
+            clients.push_back(fd);
+        }
+        std::thread(&Headless::client_worker, this, fd).detach();
+    }
+    close_input();
+}
+
+void EchoNote::Headless::client_worker(int fd) {
+    std::string buffer;
+    char data[1024];
+    ssize_t n = 0;
+    while (running && (n = ::recv(fd, data, sizeof(data), 0)) > 0) {
+        buffer.append(data, n);
+        size_t pos = 0;
+        while ((pos = buffer.find('\n')) != std::string::npos) {
+            command(buffer.substr(0, pos));
+            buffer.erase(0, pos + 1);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(out_mtx);
+        std::erase(clients, fd);
+    }
+    ::close(fd);
+}
+
+// when the last input closes there is nobody left to send quit
+void EchoNote::Headless::close_input() {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (--inputs == 0) {
+        running = false;
+        cv.notify_all();
+    }
+}
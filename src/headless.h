@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "audio.h"
+#include "llm.h"
+
+namespace EchoNote {
+// runs the pipeline without a window: commands come one per line on stdin
+// or a local socket (start, stop, refine, summarize, status, quit) and
+// results go out as JSON lines, {"event": "asr", "text": "..."}
+class Headless {
+public:
+    static Headless& instance() {
+        static Headless _inst;
+        return _inst;
+    }
+
+    Headless(const Headless&) = delete;
+    Headless operator =(const Headless&) = delete;
+
+    // config: {"stdin": true, "socket": "/tmp/voicelint.sock" or "" for
+    //   none, "autostart": false, "log": false}
+    // out receives the JSON lines; returns when quit is received, stdin
+    // and the socket are closed, or on SIGINT/SIGTERM
+    void run(const nlohmann::json& config, Audio * audio, LLM * llm, 
+        std::ostream& out);
+
+    // name: "asr", "refine", "summarize", "log"
+    void show(const std::string& name, const std::string& text);
+
+private:
+    Headless() = default;
+    ~Headless() = default;
+
+    Audio * audio = nullptr;
+    LLM * llm = nullptr;
+    std::ostream * out = nullptr;
+    bool show_log = false;
+
+    std::atomic<bool> running = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int inputs = 0; // stdin and socket listeners still open
+
+    std::mutex out_mtx; // guards out and clients
+    std::vector<int> clients; // socket connections receiving events
+
+    int listen_fd = -1;
+    std::string socket_path;
+
+    void emit(const nlohmann::json& event);
+    void command(const std::string& line);
+    void stdin_worker();
+    void accept_worker();
+    void client_worker(int fd);
+    void close_input();
+};
+};
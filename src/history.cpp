@@ -0,0 +1,216 @@
+#include "history.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+#include <sys/event.h>
+#endif
+
+// map path and call line for every line in it, without the line break;
+// processed is advanced by the bytes consumed. Returns false when line
+// asks to stop.
+static bool read_lines(const std::string& path, std::atomic<size_t>& processed, 
+    const std::function<bool(const char *, size_t)>& line) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return true;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return true;
+    }
+    size_t size = st.st_size;
+    void * data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return true;
+    ::madvise(data, size, MADV_SEQUENTIAL);
+
+    const char * begin = static_cast<const char *>(data);
+    const char * end = begin + size;
+    bool ok = true;
+    for (const char * p = begin; p < end && ok;) {
+        const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        ok = line(p, eol - p);
+        processed += eol - p + 1;
+        p = eol + 1;
+    }
+    ::munmap(data, size);
+    return ok;
+}
+
+History::~History() {
+    shutdown();
+}
+
+int History::init(const std::string& root /* = "data" */) {
+    this->root = root;
+    std::error_code ec;
+    std::filesystem::create_directories(root, ec);
+    rescan();
+
+    if (::pipe(wake_pipe) != 0) {
+        wake_pipe[0] = wake_pipe[1] = -1;
+        std::cerr << "History watcher disabled: " << std::strerror(errno) << std::endl;
+        return 0;
+    }
+#if defined(__linux__)
+    watch_fd = ::inotify_init();
+    if (watch_fd >= 0 && ::inotify_add_watch(watch_fd, root.c_str(), 
+        IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_ONLYDIR) < 0) {
+        ::close(watch_fd);
+        watch_fd = -1;
+    }
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+    watch_fd = ::kqueue();
+    int dir_fd = ::open(root.c_str(), O_RDONLY);
+    if (watch_fd >= 0 && dir_fd >= 0) {
+        struct kevent changes[2];
+        // the directory is written to whenever an entry is added or removed
+        EV_SET(&changes[0], dir_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, 
+            NOTE_WRITE, 0, nullptr);
+        EV_SET(&changes[1], wake_pipe[0], EVFILT_READ, EV_ADD, 0, 0, nullptr);
+        if (::kevent(watch_fd, changes, 2, nullptr, 0, nullptr) < 0) {
+            ::close(watch_fd);
+            watch_fd = -1;
+        }
+    }
+#endif
+    if (watch_fd < 0) {
+        std::cerr << "No change notification for " << root
+            << ", rescanning every few seconds." << std::endl;
+    }
+    running = true;
+    watch_thread = std::thread(&History::watch_worker, this);
+    return 0;
+}
+
+int History::shutdown() {
+    cancel = true;
+    if (loader.joinable()) {
+        loader.join();
+    }
+    if (!running.exchange(false)) return 0;
+    char c = 0;
+    if (::write(wake_pipe[1], &c, 1) < 0) {
+        std::cerr << "History watcher wake-up failed." << std::endl;
+    }
+    if (watch_thread.joinable()) {
+        watch_thread.join();
+    }
+    if (watch_fd >= 0) ::close(watch_fd);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    watch_fd = wake_pipe[0] = wake_pipe[1] = -1;
+    return 0;
+}
+
+// a session is a directory named by its start time, so names sort by age;
+// hidden ones are the search index and sessions being archived. The list
+// is published only when it changed
+void History::rescan() {
+    auto list = std::make_shared<entries_t>();
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(root, ec);
+        !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (it->is_directory(ec) && name[0] != '.') list->push_back(name);
+    }
+    std::sort(list->begin(), list->end(), std::greater<std::string>());
+
+    std::lock_guard<std::mutex> lk(entries_mtx);
+    if (*list == *entries_list) return;
+    entries_list = std::move(list);
+    ++entries_version;
+}
+
+std::shared_ptr<const History::entries_t> History::entries(
+    uint64_t& snapshot_version) {
+    std::lock_guard<std::mutex> lk(entries_mtx);
+    snapshot_version = entries_version;
+    return entries_list;
+}
+
+// the notifications only say that the directory changed, a rescan of the
+// top level names is cheap and never misses a rename
+void History::watch_worker() {
+    while (running) {
+        bool changed = false;
+#if defined(__linux__)
+        if (watch_fd >= 0) {
+            pollfd fds[2] = {{watch_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0 && errno != EINTR) break;
+            if (fds[0].revents & POLLIN) {
+                char events[4096];
+                changed = ::read(watch_fd, events, sizeof(events)) > 0;
+            }
+        }
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+        if (watch_fd >= 0) {
+            struct kevent event;
+            int n = ::kevent(watch_fd, nullptr, 0, &event, 1, nullptr);
+            if (n < 0 && errno != EINTR) break;
+            changed = n > 0 && event.filter == EVFILT_VNODE;
+        }
+#endif
+        if (watch_fd < 0) {
+            pollfd fds[1] = {{wake_pipe[0], POLLIN, 0}};
+            ::poll(fds, 1, 3000);
+            changed = true;
+        }
+        if (running && changed) rescan();
+    }
+}
+
+void History::load(const std::string& name, done_t done) {
+    cancel = true;
+    if (loader.joinable()) {
+        loader.join();
+    }
+    cancel = false;
+    load_progress = 0.f;
+    loading = true;
+    loader = std::thread(&History::load_worker, this, name, std::move(done));
+}
+
+void History::load_worker(const std::string& name, done_t done) {
+    const std::string path = root + "/" + name;
+    const std::string files[] = {
+        path + "/asr.txt", path + "/refine.txt", path + "/summarize.txt"
+    };
+    size_t total = 0;
+    for (const auto& file: files) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(file, ec);
+        if (!ec) total += size;
+    }
+    std::atomic<size_t> processed = 0;
+    auto transcript = std::make_shared<transcript_t>();
+    transcript->name = name;
+
+    auto add_to = [&](std::vector<std::string>& lines) {
+        return [&](const char * text, size_t size) {
+            lines.emplace_back(text, size);
+            load_progress = total ? float(processed) / total : 1.f;
+            return !cancel;
+        };
+    };
+    bool ok = read_lines(files[0], processed, add_to(transcript->asr))
+        && read_lines(files[1], processed, add_to(transcript->refine))
+        && read_lines(files[2], processed, [&](const char * text, size_t size) {
+            if (!transcript->summary.empty()) transcript->summary += '\n';
+            transcript->summary.append(text, size);
+            return !cancel;
+        });
+    load_progress = 1.f;
+    if (ok && !cancel && done) done(transcript);
+    loading = false;
+}
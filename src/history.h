@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// saved sessions under data/: the list follows the directory through
+// change notifications (inotify, kqueue elsewhere), and a session is read
+// on a background thread so the render thread never touches the files
+class History {
+public:
+    History() = default;
+    ~History();
+    History(const History&) = delete;
+    History operator=(const History&) = delete;
+
+    typedef std::vector<std::string> entries_t;
+
+    typedef struct _transcript_t {
+        std::string name;
+        std::vector<std::string> asr;
+        std::vector<std::string> refine;
+        std::string summary;
+    } transcript_t;
+    typedef std::function<void(std::shared_ptr<const transcript_t>)> done_t;
+
+    int init(const std::string& root = "data");
+    int shutdown();
+
+    // session names, newest first; snapshot only when version moved
+    std::shared_ptr<const entries_t> entries(uint64_t& snapshot_version);
+    uint64_t version() const {
+        return entries_version;
+    }
+
+    // read a session in the background and hand it to done on the loader
+    // thread; a load started meanwhile cancels this one
+    void load(const std::string& name, done_t done);
+    bool isLoading() const {
+        return loading;
+    }
+    float progress() const {
+        return load_progress;
+    }
+
+private:
+    std::string root = "data";
+
+    std::mutex entries_mtx;
+    std::shared_ptr<const entries_t> entries_list = std::make_shared<entries_t>();
+    std::atomic<uint64_t> entries_version = 0;
+    void rescan();
+
+    std::atomic<bool> running = false;
+    std::thread watch_thread;
+    int watch_fd = -1; // inotify or kqueue
+    int wake_pipe[2] = {-1, -1}; // unblocks the watcher on shutdown
+    void watch_worker();
+
+    std::thread loader;
+    std::atomic<bool> cancel = false;
+    std::atomic<bool> loading = false;
+    std::atomic<float> load_progress = 0.f;
+    void load_worker(const std::string& name, done_t done);
+};
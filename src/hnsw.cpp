@@ -0,0 +1,345 @@
+#include "hnsw.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <queue>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define HNSW_AVX2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define HNSW_NEON 1
+#endif
+
+static const char hnsw_magic[8] = {'V', 'L', 'H', 'N', 'S', 'W', '1', '\0'};
+
+// four accumulators so the compiler can keep several adds in flight
+static float dot_scalar(const float * a, const float * b, int n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+#if defined(HNSW_AVX2)
+// built for AVX2 regardless of the compiler flags, picked at run time
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float * a, const float * b, int n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    float s = _mm_cvtss_f32(sum);
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+static float (*const dot_impl)(const float *, const float *, int) =
+    __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? dot_avx2 : dot_scalar;
+#elif defined(HNSW_NEON)
+static float dot_neon(const float * a, const float * b, int n) {
+    float32x4_t acc0 = vdupq_n_f32(0.f);
+    float32x4_t acc1 = vdupq_n_f32(0.f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float s = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) s += a[i] * b[i];
+    return s;
+}
+
+static float (*const dot_impl)(const float *, const float *, int) = dot_neon;
+#else
+static float (*const dot_impl)(const float *, const float *, int) = dot_scalar;
+#endif
+
+float HNSW::dot(const float * a, const float * b, int n) {
+    return dot_impl(a, b, n);
+}
+
+HNSW::HNSW(int dims /* = 0 */, int M /* = 16 */, int ef_construction /* = 200 */)
+    : dims(dims), M(std::max(M, 2)), M0(2 * std::max(M, 2)),
+      ef_construction(std::max(ef_construction, 1)),
+      level_mult(1.0 / std::log(double(std::max(M, 2)))) {
+}
+
+size_t HNSW::size() const {
+    std::shared_lock<std::shared_mutex> lk(mtx);
+    return levels.size();
+}
+
+// a visited mark per node, reset by bumping the generation instead of
+// clearing; one per thread so searches do not contend
+static std::vector<uint32_t>& visited_marks(size_t n, uint32_t& generation) {
+    thread_local std::vector<uint32_t> marks;
+    thread_local uint32_t current = 0;
+    if (marks.size() < n) marks.resize(n, 0);
+    if (++current == 0) {
+        std::fill(marks.begin(), marks.end(), 0);
+        current = 1;
+    }
+    generation = current;
+    return marks;
+}
+
+std::vector<HNSW::result_t> HNSW::search_layer(const float * query, 
+    uint32_t entry_point, size_t ef, int level) const {
+    uint32_t generation;
+    auto& visited = visited_marks(levels.size(), generation);
+
+    // candidates closest first, results farthest first
+    std::priority_queue<result_t, std::vector<result_t>, std::greater<result_t>> candidates;
+    std::priority_queue<result_t> results;
+    float d = distance(query, entry_point);
+    candidates.emplace(d, entry_point);
+    results.emplace(d, entry_point);
+    visited[entry_point] = generation;
+
+    while (!candidates.empty()) {
+        auto [dist, node] = candidates.top();
+        if (dist > results.top().first && results.size() >= ef) break;
+        candidates.pop();
+        for (uint32_t next: links[node][level]) {
+            if (visited[next] == generation) continue;
+            visited[next] = generation;
+            float next_dist = distance(query, next);
+            if (results.size() < ef || next_dist < results.top().first) {
+                candidates.emplace(next_dist, next);
+                results.emplace(next_dist, next);
+                if (results.size() > ef) results.pop();
+            }
+        }
+    }
+    std::vector<result_t> found;
+    found.reserve(results.size());
+    while (!results.empty()) {
+        found.push_back(results.top());
+        results.pop();
+    }
+    return found;
+}
+
+std::vector<uint32_t> HNSW::select_neighbors(std::vector<result_t> candidates, 
+    size_t m) const {
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<uint32_t> selected;
+    for (const auto& [dist, id]: candidates) {
+        if (selected.size() >= m) break;
+        const float * vec = &vectors[size_t(id) * dims];
+        bool keep = true;
+        for (uint32_t other: selected) {
+            if (distance(vec, other) < dist) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) selected.push_back(id);
+    }
+    return selected;
+}
+
+uint32_t HNSW::add(const float * vec) {
+    std::unique_lock<std::shared_mutex> lk(mtx);
+    const uint32_t id = levels.size();
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const int level = int(-std::log(std::max(uniform(rng), 1e-12)) * level_mult);
+
+    vectors.insert(vectors.end(), vec, vec + dims);
+    levels.push_back(level);
+    links.emplace_back(level + 1);
+    if (max_level < 0) {
+        entry = id;
+        max_level = level;
+        return id;
+    }
+
+    // greedy descent through the layers above the new node's top layer
+    uint32_t current = entry;
+    float current_dist = distance(vec, current);
+    for (int l = max_level; l > level; --l) {
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (uint32_t next: links[current][l]) {
+                float d = distance(vec, next);
+                if (d < current_dist) {
+                    current_dist = d;
+                    current = next;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (int l = std::min(level, max_level); l >= 0; --l) {
+        auto candidates = search_layer(vec, current, ef_construction, l);
+        const size_t m = l == 0 ? M0 : M;
+        auto neighbors = select_neighbors(candidates, M);
+        links[id][l] = neighbors;
+        for (uint32_t n: neighbors) {
+            auto& back = links[n][l];
+            back.push_back(id);
+            if (back.size() > m) {
+                // over capacity, prune with the same heuristic
+                const float * n_vec = &vectors[size_t(n) * dims];
+                std::vector<result_t> pool;
+                pool.reserve(back.size());
+                for (uint32_t b: back) pool.emplace_back(distance(n_vec, b), b);
+                back = select_neighbors(std::move(pool), m);
+            }
+        }
+        current = std::min_element(candidates.begin(), candidates.end())->second;
+    }
+    if (level > max_level) {
+        max_level = level;
+        entry = id;
+    }
+    return id;
+}
+
+std::vector<HNSW::result_t> HNSW::search(const float * query, size_t k, 
+    size_t ef) const {
+    std::shared_lock<std::shared_mutex> lk(mtx);
+    if (max_level < 0 || k == 0) return {};
+
+    uint32_t current = entry;
+    float current_dist = distance(query, current);
+    for (int l = max_level; l > 0; --l) {
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (uint32_t next: links[current][l]) {
+                float d = distance(query, next);
+                if (d < current_dist) {
+                    current_dist = d;
+                    current = next;
+                    changed = true;
+                }
+            }
+        }
+    }
+    auto found = search_layer(query, current, std::max(ef, k), 0);
+    std::sort(found.begin(), found.end());
+    if (found.size() > k) found.resize(k);
+    return found;
+}
+
+// magic, dims, M, ef_construction, count, entry, max_level, the vectors,
+// then per node its level and the neighbour lists bottom up
+int HNSW::save(const std::string& filename) const {
+    std::shared_lock<std::shared_mutex> lk(mtx);
+    const std::string tmp = filename + ".tmp";
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return -1;
+    auto put = [&out](const auto& value) {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    };
+    out.write(hnsw_magic, sizeof(hnsw_magic));
+    put(int32_t(dims));
+    put(int32_t(M));
+    put(int32_t(ef_construction));
+    put(uint64_t(levels.size()));
+    put(uint32_t(entry));
+    put(int32_t(max_level));
+    out.write(reinterpret_cast<const char *>(vectors.data()), vectors.size() * sizeof(float));
+    for (size_t i = 0; i < levels.size(); ++i) {
+        put(int32_t(levels[i]));
+        for (const auto& neighbors: links[i]) {
+            put(uint32_t(neighbors.size()));
+            out.write(reinterpret_cast<const char *>(neighbors.data()), 
+                neighbors.size() * sizeof(uint32_t));
+        }
+    }
+    out.close();
+    if (!out) {
+        std::remove(tmp.c_str());
+        return -1;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, filename, ec);
+    return ec ? -1 : 0;
+}
+
+int HNSW::load(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return -1;
+    auto get = [&in](auto& value) {
+        return bool(in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+    };
+    char magic[8];
+    int32_t file_dims, file_M, file_ef, file_max_level;
+    uint64_t count;
+    uint32_t file_entry;
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, hnsw_magic, sizeof(magic)) != 0
+        || !get(file_dims) || !get(file_M) || !get(file_ef) || !get(count)
+        || !get(file_entry) || !get(file_max_level) || file_dims <= 0 || file_M < 2) {
+        return -1;
+    }
+    // a corrupt count must not turn into a huge allocation
+    std::error_code ec;
+    const uint64_t file_size = std::filesystem::file_size(filename, ec);
+    if (ec || count > file_size / (uint64_t(file_dims) * sizeof(float))) return -1;
+    std::vector<float> file_vectors(count * file_dims);
+    if (!in.read(reinterpret_cast<char *>(file_vectors.data()), 
+        file_vectors.size() * sizeof(float))) {
+        return -1;
+    }
+    std::vector<int> file_levels(count);
+    std::vector<std::vector<std::vector<uint32_t>>> file_links(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        int32_t level;
+        if (!get(level) || level < 0 || level > 64) return -1;
+        file_levels[i] = level;
+        file_links[i].resize(level + 1);
+        for (auto& neighbors: file_links[i]) {
+            uint32_t n;
+            if (!get(n) || n > uint32_t(2 * file_M)) return -1;
+            neighbors.resize(n);
+            if (!in.read(reinterpret_cast<char *>(neighbors.data()), n * sizeof(uint32_t))) {
+                return -1;
+            }
+            for (uint32_t id: neighbors) {
+                if (id >= count) return -1;
+            }
+        }
+    }
+    // search starts at the entry on max_level and walks its links down
+    if (count > 0 && (file_entry >= count || file_max_level < 0
+        || file_max_level > file_levels[file_entry])) {
+        return -1;
+    }
+
+    std::unique_lock<std::shared_mutex> lk(mtx);
+    dims = file_dims;
+    M = file_M;
+    M0 = 2 * file_M;
+    ef_construction = file_ef;
+    level_mult = 1.0 / std::log(double(M));
+    vectors = std::move(file_vectors);
+    levels = std::move(file_levels);
+    links = std::move(file_links);
+    entry = file_entry;
+    max_level = count ? file_max_level : -1;
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// approximate nearest neighbours over unit vectors (Malkov & Yashunin's
+// hierarchical navigable small world graph). Distance is 1 - dot product,
+// computed with AVX2/FMA or NEON where the CPU has them. Searches run
+// concurrently, an add takes the graph exclusively.
+class HNSW {
+public:
+    HNSW(int dims = 0, int M = 16, int ef_construction = 200);
+
+    typedef std::pair<float, uint32_t> result_t; // distance, id
+
+    // ids are assigned in insertion order from 0
+    uint32_t add(const float * vec);
+    // the k nearest, closest first; ef >= k trades speed for recall
+    std::vector<result_t> search(const float * query, size_t k, size_t ef) const;
+
+    size_t size() const;
+    int dimensions() const {
+        return dims;
+    }
+
+    int save(const std::string& filename) const;
+    int load(const std::string& filename);
+
+    static float dot(const float * a, const float * b, int n);
+
+private:
+    int dims;
+    int M;
+    int M0; // on the bottom layer, where most of the graph lives
+    int ef_construction;
+    double level_mult;
+    std::mt19937 rng{42};
+
+    std::vector<float> vectors; // size() * dims
+    std::vector<int> levels;
+    // links[node][level], the neighbours of node on that level
+    std::vector<std::vector<std::vector<uint32_t>>> links;
+    uint32_t entry = 0;
+    int max_level = -1;
+
+    mutable std::shared_mutex mtx;
+
+    float distance(const float * query, uint32_t id) const {
+        return 1.f - dot(query, &vectors[size_t(id) * dims], dims);
+    }
+    // best ef candidates reachable from entry_point on level, unsorted
+    std::vector<result_t> search_layer(const float * query, uint32_t entry_point, 
+        size_t ef, int level) const;
+    // keeps a candidate only if it is closer to the query than to every
+    // neighbour kept so far, which spreads links in different directions
+    std::vector<uint32_t> select_neighbors(std::vector<result_t> candidates, 
+        size_t m) const;
+};
@@ -0,0 +1,539 @@
+#include "llama_engine.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start, 
+    std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+LlamaEngine::~LlamaEngine() {
+    shutdown();
+}
+
+int LlamaEngine::init(const nlohmann::json& config) {
+    std::string path = config.value("model", "");
+    n_ctx = config.value("n_ctx", 8192);
+    n_batch = config.value("n_batch", 512);
+    int n_seq = std::max(1, config.value("n_seq", 4));
+    int n_threads = config.value("n_threads", 0);
+    slot_save_path = config.value("slot_save_path", "cache/slots");
+
+    llama_backend_init();
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = config.value("n_gpu_layers", 99);
+    model = llama_model_load_from_file(path.c_str(), model_params);
+    if (!model) {
+        std::cerr << "Failed to load model: " << path << std::endl;
+        return -1;
+    }
+    vocab = llama_model_get_vocab(model);
+    const char * tmpl = llama_model_chat_template(model, nullptr);
+    chat_template = tmpl ? tmpl : "chatml";
+
+    // the context is split evenly between the sequences
+    llama_context_params ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = n_ctx * n_seq;
+    ctx_params.n_batch = n_batch;
+    ctx_params.n_seq_max = n_seq;
+    if (n_threads > 0) {
+        ctx_params.n_threads = n_threads;
+        ctx_params.n_threads_batch = n_threads;
+    }
+    ctx = llama_init_from_model(model, ctx_params);
+    if (!ctx) {
+        std::cerr << "Failed to create llama context." << std::endl;
+        llama_model_free(model);
+        model = nullptr;
+        return -1;
+    }
+    sequences.resize(n_seq);
+    batch = llama_batch_init(n_batch, 0, 1);
+
+    running = true;
+    worker = std::thread(&LlamaEngine::run, this);
+    return 0;
+}
+
+int LlamaEngine::shutdown() {
+    // chat() and slot() check running under the lock they queue with, so
+    // nothing is queued after this
+    bool was_running = false;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        was_running = running.exchange(false);
+    }
+    if (was_running) {
+        cv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    std::lock_guard<std::mutex> lk(mtx);
+    // slot tasks still queued run now so their callers do not wait forever
+    for (auto& task: tasks) task();
+    tasks.clear();
+    for (auto& sequence: sequences) {
+        if (sequence.request) fail(sequence, "llama engine shut down");
+    }
+    for (auto& request: pending) {
+        request->result.set_exception(std::make_exception_ptr(
+            std::runtime_error("llama engine shut down")));
+        llama_sampler_free(request->sampler);
+    }
+    pending.clear();
+    if (ctx) {
+        llama_batch_free(batch);
+        llama_free(ctx);
+        ctx = nullptr;
+    }
+    if (model) {
+        llama_model_free(model);
+        model = nullptr;
+        llama_backend_free();
+    }
+    return 0;
+}
+
+std::string LlamaEngine::apply_template(const nlohmann::json& messages) {
+    std::vector<std::string> roles;
+    std::vector<std::string> contents;
+    for (const auto& message: messages) {
+        roles.push_back(message.value("role", "user"));
+        contents.push_back(message.value("content", ""));
+    }
+    std::vector<llama_chat_message> chat;
+    for (size_t i = 0; i < roles.size(); ++i) {
+        chat.push_back({roles[i].c_str(), contents[i].c_str()});
+    }
+    std::vector<char> buf(4096);
+    int n = llama_chat_apply_template(chat_template.c_str(), chat.data(), 
+        chat.size(), true, buf.data(), buf.size());
+    if (n > int(buf.size())) {
+        buf.resize(n);
+        n = llama_chat_apply_template(chat_template.c_str(), chat.data(), 
+            chat.size(), true, buf.data(), buf.size());
+    }
+    if (n < 0) throw std::runtime_error("unsupported chat template");
+    return std::string(buf.data(), n);
+}
+
+std::vector<llama_token> LlamaEngine::tokenize(const std::string& text) {
+    std::vector<llama_token> tokens(text.size() + 8);
+    int n = llama_tokenize(vocab, text.data(), text.size(), tokens.data(), 
+        tokens.size(), true, true);
+    if (n < 0) {
+        tokens.resize(-n);
+        n = llama_tokenize(vocab, text.data(), text.size(), tokens.data(), 
+            tokens.size(), true, true);
+    }
+    tokens.resize(std::max(0, n));
+    return tokens;
+}
+
+// the same sampling parameters llama-server takes from the request
+llama_sampler * LlamaEngine::make_sampler(const nlohmann::json& request) {
+    float temperature = request.value("temperature", 0.8f);
+    llama_sampler * sampler = llama_sampler_chain_init(
+        llama_sampler_chain_default_params());
+    llama_sampler_chain_add(sampler, llama_sampler_init_penalties(64, 1.0f, 
+        0.0f, request.value("presence_penalty", 0.0f)));
+    if (temperature <= 0) {
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+        return sampler;
+    }
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(
+        request.value("top_k", 40)));
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(
+        request.value("top_p", 0.95f), 1));
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(temperature));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    return sampler;
+}
+
+nlohmann::json LlamaEngine::chat(const nlohmann::json& request) {
+    if (!running) throw std::runtime_error("llama engine is not running");
+    auto r = std::make_shared<request_t>();
+    r->slot = request.value("id_slot", -1);
+    nlohmann::json messages = request["messages"];
+    // the built-in templates take no kwargs, Qwen3 also obeys a soft switch
+    bool thinking = request.value("chat_template_kwargs", 
+        nlohmann::json::object()).value("enable_thinking", true);
+    if (!thinking && !messages.empty()) {
+        auto& last = messages.back();
+        last["content"] = last.value("content", "") + " /no_think";
+    }
+    r->prompt = tokenize(apply_template(messages));
+    r->max_tokens = request.value("max_tokens", -1);
+    // llama-server's speculative settings turn on prompt lookup drafting
+    r->n_draft = request.value("speculative.n_max", 0);
+    r->n_draft_min = request.value("speculative.n_min", 0);
+    if (request.contains("stop")) {
+        r->stop = request["stop"].get<std::vector<std::string>>();
+    }
+    if (r->prompt.empty() || int(r->prompt.size()) >= n_ctx) {
+        throw std::runtime_error("prompt of " + std::to_string(r->prompt.size()) +
+            " tokens does not fit the context");
+    }
+    r->sampler = make_sampler(request);
+    auto result = r->result.get_future();
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (!running) {
+            llama_sampler_free(r->sampler);
+            throw std::runtime_error("llama engine is not running");
+        }
+        pending.push_back(r);
+    }
+    cv.notify_all();
+    return result.get();
+}
+
+int LlamaEngine::slot(int id, const std::string& action, 
+    const std::string& filename) {
+    if (!running || sequences.empty()) return -1;
+    std::promise<int> done;
+    auto result = done.get_future();
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (!running) return -1;
+        tasks.push_back([this, id, action, filename, &done]() {
+            sequence_t& sequence = sequences[id % sequences.size()];
+            int seq = id % sequences.size();
+            auto path = std::filesystem::path(slot_save_path) / filename;
+            if (sequence.request) {
+                done.set_value(-1);
+                return;
+            }
+            if (action == "save") {
+                std::filesystem::create_directories(slot_save_path);
+                size_t n = llama_state_seq_save_file(ctx, path.c_str(), seq, 
+                    sequence.tokens.data(), sequence.tokens.size());
+                done.set_value(n > 0 ? 0 : -1);
+                return;
+            }
+            std::vector<llama_token> tokens(n_ctx);
+            size_t n_tokens = 0;
+            llama_memory_seq_rm(llama_get_memory(ctx), seq, -1, -1);
+            sequence.tokens.clear();
+            size_t n = llama_state_seq_load_file(ctx, path.c_str(), seq, 
+                tokens.data(), tokens.size(), &n_tokens);
+            if (n == 0) {
+                done.set_value(-1);
+                return;
+            }
+            tokens.resize(n_tokens);
+            sequence.tokens = tokens;
+            done.set_value(0);
+        });
+    }
+    cv.notify_all();
+    return result.get();
+}
+
+// hand pending requests to idle sequences: a request keeps to the sequence
+// of its slot, one without a slot takes the least recently used idle one
+bool LlamaEngine::assign() {
+    bool assigned = false;
+    for (auto it = pending.begin(); it != pending.end(); ) {
+        int seq = -1;
+        if ((*it)->slot >= 0) {
+            seq = (*it)->slot % sequences.size();
+            if (sequences[seq].request) seq = -1;
+        } else {
+            for (size_t i = 0; i < sequences.size(); ++i) {
+                if (sequences[i].request) continue;
+                if (seq < 0 || sequences[i].last_used < sequences[seq].last_used) {
+                    seq = i;
+                }
+            }
+        }
+        if (seq < 0) {
+            ++it;
+            continue;
+        }
+
+        sequence_t& sequence = sequences[seq];
+        sequence.request = *it;
+        sequence.last_used = ++tick;
+        sequence.content.clear();
+        sequence.n_predicted = 0;
+        sequence.n_drafted = 0;
+        sequence.n_accepted = 0;
+        sequence.start = std::chrono::steady_clock::now();
+        // reuse the common prefix, at least one token is decoded again to
+        // get logits for the first sampled token
+        const auto& prompt = sequence.request->prompt;
+        size_t n = 0;
+        while (n < sequence.tokens.size() && n + 1 < prompt.size()
+            && sequence.tokens[n] == prompt[n]) {
+            ++n;
+        }
+        llama_memory_seq_rm(llama_get_memory(ctx), seq, n, -1);
+        sequence.tokens.resize(n);
+        sequence.feed.assign(prompt.begin() + n, prompt.end());
+        sequence.n_cached = n;
+        it = pending.erase(it);
+        assigned = true;
+    }
+    return assigned;
+}
+
+void LlamaEngine::run() {
+    while (running) {
+        std::deque<std::function<void()>> todo;
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            auto active = [this]() {
+                for (const auto& sequence: sequences) {
+                    if (sequence.request) return true;
+                }
+                return false;
+            };
+            cv.wait(lk, [&]() {
+                return !running || !tasks.empty() || active() ||
+                    (!pending.empty() && assign());
+            });
+            assign();
+            todo.swap(tasks);
+        }
+        for (auto& task: todo) task();
+        step();
+    }
+}
+
+// prompt lookup: the latest place in the prompt where the last tokens of
+// the history occur, and the tokens that follow it there as the draft. The
+// draft is decoded with last, so it stops short of the sequence's context.
+std::vector<llama_token> LlamaEngine::lookup(const sequence_t& sequence, 
+    llama_token last) {
+    const auto& tokens = sequence.tokens;
+    const auto& request = *sequence.request;
+    size_t limit = std::min(tokens.size(), request.prompt.size());
+    size_t size = tokens.size() + 1; // with last appended
+    size_t room = size_t(n_ctx) > size + 1 ? n_ctx - size - 1 : 0;
+    size_t max_draft = std::min(size_t(std::max(request.n_draft, 0)), room);
+    auto at = [&](size_t i) { return i < tokens.size() ? tokens[i] : last; };
+    std::vector<llama_token> draft;
+    for (int n = ngram_max; n >= ngram_min && draft.empty(); --n) {
+        if (size < size_t(n) || limit < size_t(n) + 1) continue;
+        for (size_t start = limit - n; start-- > 0 && draft.empty(); ) {
+            bool match = true;
+            for (int k = 0; k < n && match; ++k) {
+                match = at(start + k) == at(size - n + k);
+            }
+            if (!match) continue;
+            for (size_t j = start + n; j < limit && draft.size() < max_draft; ++j) {
+                draft.push_back(tokens[j]);
+            }
+        }
+    }
+    if (int(draft.size()) < request.n_draft_min) draft.clear();
+    return draft;
+}
+
+// a sampled token goes into the content; true when the request is done
+bool LlamaEngine::emit(sequence_t& sequence, llama_token token) {
+    auto& request = *sequence.request;
+    if (sequence.n_predicted++ == 0) {
+        sequence.first_token = std::chrono::steady_clock::now();
+    }
+    if (llama_vocab_is_eog(vocab, token)) {
+        finish(sequence, "stop");
+        return true;
+    }
+    char piece[256];
+    int n = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, false);
+    if (n > 0) sequence.content.append(piece, n);
+
+    for (const auto& stop: request.stop) {
+        auto pos = sequence.content.find(stop);
+        if (!stop.empty() && pos != std::string::npos) {
+            sequence.content.resize(pos);
+            finish(sequence, "stop");
+            return true;
+        }
+    }
+    if ((request.max_tokens >= 0 && sequence.n_predicted >= request.max_tokens)
+        || int(sequence.tokens.size()) + 1 >= n_ctx) {
+        finish(sequence, "length");
+        return true;
+    }
+    return false;
+}
+
+// one llama_decode over all active sequences: generating sequences first,
+// with their last sampled token and the draft to verify, then prompt
+// tokens up to n_batch
+void LlamaEngine::step() {
+    // what each sequence had before the batch, to put back when it fails
+    std::vector<size_t> positions(sequences.size());
+    std::vector<std::vector<llama_token>> feeds(sequences.size());
+    std::vector<bool> in_batch(sequences.size(), false);
+
+    // every active sequence, or only the one at index only
+    auto fill = [&](int only) {
+        batch.n_tokens = 0;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t i = 0; i < sequences.size(); ++i) {
+                sequence_t& sequence = sequences[i];
+                if (pass == 0) sequence.batch_index = -1;
+                if (only >= 0 && int(i) != only) continue;
+                if (!sequence.request || sequence.feed.empty()) continue;
+                if (sequence.generating != (pass == 0)) continue;
+                size_t room = n_batch - batch.n_tokens;
+                if (room == 0) continue;
+                // a draft that does not fit is cut, it is only a guess
+                if (sequence.generating && sequence.feed.size() > room) {
+                    sequence.feed.resize(room);
+                }
+                positions[i] = sequence.tokens.size();
+                feeds[i] = sequence.feed;
+                in_batch[i] = true;
+                size_t n = std::min(sequence.feed.size(), room);
+                int first = batch.n_tokens;
+                for (size_t j = 0; j < n; ++j) {
+                    int k = batch.n_tokens++;
+                    batch.token[k] = sequence.feed[j];
+                    batch.pos[k] = sequence.tokens.size();
+                    batch.n_seq_id[k] = 1;
+                    batch.seq_id[k][0] = i;
+                    batch.logits[k] = sequence.generating || j + 1 == sequence.feed.size();
+                    sequence.tokens.push_back(sequence.feed[j]);
+                }
+                if (n == sequence.feed.size()) {
+                    sequence.batch_index = sequence.generating ? first : batch.n_tokens - 1;
+                }
+                if (sequence.generating) {
+                    sequence.draft.assign(sequence.feed.begin() + 1, sequence.feed.end());
+                }
+                sequence.feed.erase(sequence.feed.begin(), sequence.feed.begin() + n);
+            }
+        }
+    };
+    auto undo = [&]() {
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            if (!in_batch[i]) continue;
+            llama_memory_seq_rm(llama_get_memory(ctx), i, positions[i], -1);
+            sequences[i].tokens.resize(positions[i]);
+            sequences[i].feed = feeds[i];
+            sequences[i].draft.clear();
+            sequences[i].batch_index = -1;
+            in_batch[i] = false;
+        }
+    };
+    auto drop = [&](size_t i, const std::string& error) {
+        llama_memory_seq_rm(llama_get_memory(ctx), i, -1, -1);
+        sequences[i].tokens.clear();
+        fail(sequences[i], error);
+    };
+
+    fill(-1);
+    if (batch.n_tokens == 0) return;
+
+    if (llama_decode(ctx, batch) != 0) {
+        // only the request the batch fails on is failed: every sequence is
+        // tried alone and rolled back, the others go again next step
+        undo();
+        int longest = -1;
+        bool failed = false;
+        for (size_t i = 0; i < sequences.size(); ++i) {
+            if (!sequences[i].request || sequences[i].feed.empty()) continue;
+            if (longest < 0 || sequences[i].tokens.size() + sequences[i].feed.size() >
+                sequences[longest].tokens.size() + sequences[longest].feed.size()) {
+                longest = i;
+            }
+            fill(i);
+            int ret = llama_decode(ctx, batch);
+            undo();
+            if (ret != 0) {
+                drop(i, "llama_decode failed");
+                failed = true;
+            }
+        }
+        // each one fits alone but not together: the cache is full, the
+        // longest request makes room
+        if (!failed && longest >= 0) drop(longest, "llama_decode failed, the KV cache is full");
+        return;
+    }
+
+    for (size_t seq = 0; seq < sequences.size(); ++seq) {
+        sequence_t& sequence = sequences[seq];
+        if (!sequence.request || sequence.batch_index < 0) continue;
+        // sample along the draft while the model agrees with it; every
+        // accepted draft token saves a decode step
+        size_t n_draft = sequence.generating ? sequence.draft.size() : 0;
+        size_t base = sequence.tokens.size() - 1 - n_draft;
+        size_t accepted = 0;
+        bool done = false;
+        llama_token token = 0;
+        while (!done) {
+            token = llama_sampler_sample(sequence.request->sampler, ctx, 
+                sequence.batch_index + accepted);
+            done = emit(sequence, token);
+            if (done || accepted >= n_draft || token != sequence.draft[accepted]) break;
+            ++accepted;
+        }
+        sequence.n_drafted += n_draft;
+        sequence.n_accepted += accepted;
+        // the KV of the rejected part of the draft is dropped
+        size_t keep = base + 1 + accepted;
+        if (sequence.tokens.size() > keep) {
+            llama_memory_seq_rm(llama_get_memory(ctx), seq, keep, -1);
+            sequence.tokens.resize(keep);
+        }
+        sequence.draft.clear();
+        if (done) continue;
+
+        sequence.generating = true;
+        sequence.feed.assign(1, token);
+        if (sequence.request->n_draft > 0) {
+            auto draft = lookup(sequence, token);
+            sequence.feed.insert(sequence.feed.end(), draft.begin(), draft.end());
+        }
+    }
+}
+
+// the same response shape as llama-server, timings included
+void LlamaEngine::finish(sequence_t& sequence, const std::string& reason) {
+    auto now = std::chrono::steady_clock::now();
+    int n_prompt = sequence.request->prompt.size();
+    nlohmann::json response = {
+        {"object", "chat.completion"},
+        {"choices", {{
+            {"index", 0},
+            {"message", {{"role", "assistant"}, {"content", sequence.content}}},
+            {"finish_reason", reason}
+        }}},
+        {"usage", {
+            {"prompt_tokens", n_prompt},
+            {"completion_tokens", sequence.n_predicted},
+            {"total_tokens", n_prompt + sequence.n_predicted}
+        }},
+        {"timings", {
+            {"cache_n", sequence.n_cached},
+            {"prompt_n", n_prompt - sequence.n_cached},
+            {"prompt_ms", elapsed_ms(sequence.start, sequence.first_token)},
+            {"predicted_n", sequence.n_predicted},
+            {"predicted_ms", elapsed_ms(sequence.first_token, now)},
+            {"draft_n", sequence.n_drafted},
+            {"draft_n_accepted", sequence.n_accepted}
+        }}
+    };
+    llama_sampler_free(sequence.request->sampler);
+    sequence.request->result.set_value(response);
+    sequence.request.reset();
+    sequence.feed.clear();
+    sequence.generating = false;
+}
+
+void LlamaEngine::fail(sequence_t& sequence, const std::string& error) {
+    llama_sampler_free(sequence.request->sampler);
+    sequence.request->result.set_exception(std::make_exception_ptr(
+        std::runtime_error(error)));
+    sequence.request.reset();
+    sequence.feed.clear();
+    sequence.generating = false;
+}
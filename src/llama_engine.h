@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <llama.h>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+
+// llama.cpp linked into the process. Every slot is a sequence of a single
+// llama_context whose KV cache persists between requests, so a request only
+// decodes the part of its prompt past the prefix it shares with the previous
+// request on that slot. Requests on different slots are decoded together,
+// one llama_decode per step for all of them. Requests that ask for
+// speculation draft from their own prompt (prompt lookup) and verify the
+// draft in the same decode.
+class LlamaEngine : public ChatEngine {
+public:
+    LlamaEngine() = default;
+    ~LlamaEngine() override;
+    LlamaEngine(const LlamaEngine&) = delete;
+    LlamaEngine operator=(const LlamaEngine&) = delete;
+
+    // config: {"model": "models/Qwen3-8B-Q4_K_M.gguf", "n_ctx": 8192 (per
+    //   sequence), "n_seq": 4, "n_batch": 512, "n_gpu_layers": 99,
+    //   "n_threads": 0 (auto), "slot_save_path": "cache/slots"}
+    int init(const nlohmann::json& config);
+    int shutdown() override;
+
+    nlohmann::json chat(const nlohmann::json& request) override;
+    int slot(int id, const std::string& action, 
+        const std::string& filename) override;
+
+private:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    typedef struct _request_t {
+        int slot = -1; // id_slot of the request, -1 for any
+        std::vector<llama_token> prompt;
+        int max_tokens = -1;
+        int n_draft = 0; // max draft tokens, 0 for no speculation
+        int n_draft_min = 0;
+        std::vector<std::string> stop;
+        llama_sampler * sampler = nullptr;
+        std::promise<nlohmann::json> result;
+    } request_t;
+
+    typedef struct _sequence_t {
+        std::vector<llama_token> tokens; // in the KV cache
+        std::vector<llama_token> feed; // to decode in the next steps
+        std::vector<llama_token> draft; // being verified
+        bool generating = false; // prompt done, feed is the last token + draft
+        std::shared_ptr<request_t> request; // being served
+        std::string content;
+        int n_cached = 0; // prompt tokens reused from the KV cache
+        int n_predicted = 0;
+        int n_drafted = 0;
+        int n_accepted = 0;
+        int batch_index = -1; // of the token whose logits are sampled
+        time_point start;
+        time_point first_token;
+        uint64_t last_used = 0;
+    } sequence_t;
+
+    llama_model * model = nullptr;
+    llama_context * ctx = nullptr;
+    const llama_vocab * vocab = nullptr;
+    std::string chat_template;
+    int n_ctx = 8192; // per sequence
+    int n_batch = 512;
+    std::string slot_save_path = "cache/slots";
+    const int ngram_max = 3; // prompt lookup tries the longest match first
+    const int ngram_min = 2;
+
+    llama_batch batch = {};
+    std::vector<sequence_t> sequences;
+    uint64_t tick = 0;
+
+    std::atomic<bool> running = false;
+    std::thread worker;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<request_t>> pending;
+    std::deque<std::function<void()>> tasks; // run on the worker thread
+
+    void run();
+    bool assign();
+    void step();
+    bool emit(sequence_t& sequence, llama_token token);
+    std::vector<llama_token> lookup(const sequence_t& sequence, llama_token last);
+    void finish(sequence_t& sequence, const std::string& reason);
+    void fail(sequence_t& sequence, const std::string& error);
+    std::string apply_template(const nlohmann::json& messages);
+    std::vector<llama_token> tokenize(const std::string& text);
+    llama_sampler * make_sampler(const nlohmann::json& request);
+};
@@ -1,23 +1,82 @@
 #include "llm.h"
-#include "openai.h"
+#include "edits.h"
+#ifdef VOICELINT_LLAMA
+#include "llama_engine.h"
+#endif
+#include <algorithm>
+#include <future>
 #include <iostream>
 #include <iterator>
 #include <string>
 #include <fstream>
 #include <thread>
 
-#include "ui.h"
+typedef std::chrono::steady_clock::time_point time_point;
 
-int LLM::init(const nlohmann::json& config, llm_callback func) {
-    std::string schema_host_port = config.value("schema_host_port", 
+static double elapsed_ms(time_point start, 
+    time_point end = std::chrono::steady_clock::now()) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// split text into pieces of about chunk_size bytes, preferring line breaks
+// and never cutting inside a UTF-8 sequence
+static std::vector<std::string> split_text(const std::string& text, 
+    size_t chunk_size) {
+    std::vector<std::string> chunks;
+    size_t start = 0;
+    while (start < text.size()) {
+        if (text.size() - start <= chunk_size) {
+            chunks.push_back(text.substr(start));
+            break;
+        }
+        size_t end = text.rfind('\n', start + chunk_size);
+        if (end == std::string::npos || end <= start) {
+            end = start + chunk_size;
+            while (end > start && (text[end] & 0xC0) == 0x80) --end;
+            if (end == start) end = start + chunk_size;
+        } else {
+            end += 1;
+        }
+        chunks.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+int LLM::init(const nlohmann::json& config, llm_callback func, 
+    std::shared_ptr<ChatEngine> shared /* = nullptr */) {
+    setCallback(func);
+    engine = shared;
+    own_engine = !shared;
+    schema_host_port = config.value("schema_host_port",
         "http://localhost:8080");
-    openai::start(schema_host_port);
+    nlohmann::json backends_config = config.value("backends", 
+        nlohmann::json::object());
+
+    if (!engine && config.value("engine", "server") == "llama") {
+#ifdef VOICELINT_LLAMA
+        auto llama = std::make_unique<LlamaEngine>();
+        if (llama->init(config.value("llama", nlohmann::json::object())) == 0) {
+            engine = std::move(llama);
+        } else {
+            std::cerr << "Failed to load the llama.cpp model, using the server." << std::endl;
+        }
+#else
+        std::cerr << "Built without VOICELINT_LLAMA, using the server." << std::endl;
+#endif
+    }
+    if (!engine) {
+        auto backends = std::make_unique<BackendPool>();
+        backends->init(backends_config, schema_host_port);
+        engine = std::move(backends);
+    }
 
     model = config.value("model", "Qwen3-8b");
     temperature = config.value("temperature", 0.6f);
     top_p = config.value("top_p", 0.95f);
     top_k = config.value("top_k", 20);
     presence_penalty = config.value("presence_penalty", 1.5f);
+    log_requests = config.value("log_requests", false);
 
     auto load_system_prompt = [](const std::string& path) {
         std::string prompt = "";
@@ -30,114 +89,302 @@ int LLM::init(const nlohmann::json& config, llm_callback func) {
         return prompt;
     };
 
+    // the server tokenizer asks the first backend
+    std::vector<std::string> servers = backends_config.value("servers", 
+        std::vector<std::string>());
+    tokenizer.init(config.value("tokenizer", nlohmann::json::object()), 
+        servers.empty() ? schema_host_port : servers[0]);
+    if (cache.init(config.value("cache", nlohmann::json::object())) != 0) {
+        std::cerr << "LLM cache disabled." << std::endl;
+    }
+
     nlohmann::json refine_config = config["refine"];
     refine_system_prompt = load_system_prompt(
         refine_config.value("system_prompt", "res/prompt/refine.txt")
     );
-    refine_chunk_size = refine_config.value("chunk_size", 1024);
+    refine_chunk_tokens = refine_config.value("chunk_tokens", 512);
+    refine_overlap_tokens = refine_config.value("overlap_tokens", 64);
     refine_save = refine_config.value("save", false);
-    refine_span = refine_config.value("refine_span", 120);
+    refine_silence_gap = refine_config.value("silence_gap", 1500);
+    refine_max_latency = refine_config.value("max_latency", 30);
+    refine_slot = refine_config.value("slot", 0);
+    refine_parallel = std::max(1, refine_config.value("parallel", 2));
+    // refined text is about as long as its input
+    budget_t refine_defaults;
+    refine_defaults.ratio = 1.5;
+    refine_budget = load_budget(refine_config.value("budget", 
+        nlohmann::json::object()), refine_defaults);
+    nlohmann::json speculative = refine_config.value("speculative", 
+        nlohmann::json::object());
+    if (speculative.value("enabled", false)) {
+        refine_budget.draft_max = speculative.value("n_max", 16);
+        refine_budget.draft_min = speculative.value("n_min", 2);
+        refine_budget.draft_p_min = speculative.value("p_min", 0.75f);
+    }
+    refine_edits = refine_config.value("mode", "full") == "edits";
+    refine_edit_prompt = load_system_prompt(
+        refine_config.value("edit_prompt", "res/prompt/refine_edits.txt")
+    );
+    // a few short lines against an input that is mostly unit numbers
+    budget_t edit_defaults;
+    edit_defaults.ratio = 0.25;
+    edit_defaults.min_tokens = 64;
+    edit_defaults.max_tokens = 1024;
+    refine_edit_budget = load_budget(refine_config.value("edit_budget", 
+        nlohmann::json::object()), edit_defaults);
+    if (refine_edits && refine_edit_prompt.empty()) {
+        std::cerr << "No refine edit prompt, refining in full." << std::endl;
+        refine_edits = false;
+    }
     refine_output_path = refine_config.value("output", "output/refine.txt");
+    // all refined text of the session, read back by the summarizer
+    if (refined_text.open(refine_config.value("spool", "output/refine.spool")) != 0) {
+        return -1;
+    }
     if (refine_save) refine_output_file.open(refine_output_path, std::ios::out | std::ios::trunc);
 
     nlohmann::json summarize_config = config["summarize"];
     summarize_system_prompt = load_system_prompt(
         summarize_config.value("system_prompt", "res/prompt/summarize.txt")
     );
+    merge_system_prompt = load_system_prompt(
+        summarize_config.value("merge_prompt", "res/prompt/merge.txt")
+    );
+    summarize_chunk_size = summarize_config.value("chunk_size", 4096);
+    summarize_parallel = std::max(1, summarize_config.value("parallel", 2));
+    summarize_rolling = summarize_config.value("rolling", true);
+    summarize_slot = summarize_config.value("slot", 2);
+    budget_t summarize_defaults;
+    summarize_defaults.ratio = 0.5;
+    summarize_defaults.min_tokens = 256;
+    summarize_defaults.max_tokens = 1024;
+    summarize_budget = load_budget(summarize_config.value("budget", 
+        nlohmann::json::object()), summarize_defaults);
     summarize_save = summarize_config.value("save", false);
     summarize_output_path = summarize_config.value("output", "output/summarize.txt");
     if (summarize_save) summarize_output_file.open(summarize_output_path, std::ios::out | std::ios::trunc);
 
-    auto make_request = [this](const std::string& text, 
-        const std::string& system_prompt) {
-        nlohmann::json request;
-        request["model"] = model;
-        request["temperature"] = temperature;
-        request["top_p"] = top_p;
-        request["top_k"] = top_k;
-        request["presence_penalty"] = presence_penalty;
-        request["messages"] = {
-            {{"role", "system"},
-             {"content", system_prompt}},
-            {{"role", "user"},
-             {"content", text}}
-        };
-        EchoNote::UI::log(request.dump());
-        return request;
-    };
+    resolve_metrics("refine", refine_metrics);
+    resolve_metrics("summarize", summarize_metrics);
 
-    auto llm_predict = [this, make_request](const std::string& text,
-        const std::string& system_prompt) {
-        nlohmann::json request = make_request(text, system_prompt);
-        std::string content = "";
-        try {
-            auto response = openai::chat().create(request);
-            //std::cout << "LLM response: " << response.dump() << std::endl;
-            EchoNote::UI::log(response.dump());
-            if (response.is_null() || !response.contains("choices")) {
-                return std::string();
+    thread_running = true;
+    refine_thread = std::thread(&LLM::refine_worker, this);
+    summarize_thread = std::thread(&LLM::summarize_worker, this);
+    return 0;
+}
+
+// dispatches up to refine_parallel chunks at once and hands the results on
+// in sequence order, whatever order the requests complete in. A round
+// starts when a chunk worth of tokens is queued, when the speaker pauses
+// after a sentence end, when the oldest text reaches max_latency or on
+// user request; otherwise the thread sleeps until the next deadline.
+void LLM::refine_worker() {
+    typedef struct _job_t {
+        std::string text;
+        time_point queued;
+        std::shared_ptr<request_stats_t> stats;
+        std::future<std::string> result;
+        std::future<void> task;
+    } job_t;
+    std::deque<job_t> in_flight;
+    int drain_size = 0;
+    bool drain_flush = false;
+    uint64_t seq = 0;
+    auto silence_gap = std::chrono::milliseconds(refine_silence_gap);
+    auto max_latency = std::chrono::seconds(refine_max_latency);
+
+    while (thread_running || !in_flight.empty()) {
+        uint64_t seen = 0;
+        bool flush_all = false;
+        {
+            std::lock_guard<std::mutex> lk(sched_mtx);
+            seen = sched_events;
+            flush_all = draining;
+        }
+        bool was_busy = !in_flight.empty();
+        while (!in_flight.empty() && in_flight.front().result.wait_for(
+            std::chrono::seconds(0)) == std::future_status::ready) {
+            std::string refined = in_flight.front().result.get();
+            auto job_stats = *in_flight.front().stats;
+            job_stats.lag_ms = elapsed_ms(in_flight.front().queued);
+            in_flight.pop_front();
+            record(job_stats);
+            if (refined.empty()) continue;
+            if (refine_output_file.is_open()) {
+                refine_output_file << refined;
             }
-            auto choices = response["choices"];
-            if (choices.empty()) {
-                return std::string();
+            notify("refine", refined);
+            refined_text.append(refined);
+        }
+        refine_busy = in_flight.size();
+
+        auto now = std::chrono::steady_clock::now();
+        auto state = wait_refine_messages.state();
+        if (force_refine.exchange(false) || (flush_all && state.size > 0)
+            || (state.size > 0 && now - state.oldest >= max_latency)) {
+            // drain what is queued now, new text waits for the next round
+            drain_size = state.size;
+            drain_flush = true;
+        } else if (state.complete && now - state.last_push >= silence_gap) {
+            drain_size = state.size;
+            drain_flush = false;
+        }
+
+        while (thread_running && !user_summary
+            && in_flight.size() < refine_parallel
+            && (drain_size > 0 ||
+                wait_refine_messages.state().ready_tokens >= refine_chunk_tokens)) {
+            time_point queued = now;
+            std::string text = wait_refine_messages.fetch(tokenizer, 
+                refine_chunk_tokens, drain_flush && drain_size > 0, &queued);
+            drain_size -= text.size();
+            if (text.empty()) {
+                drain_size = 0;
+                break;
             }
-            content = choices[0]["message"]["content"].get<std::string>();
-            const std::string postfix_think = "</think>\n\n";
-            int pos = content.find(postfix_think);
-            if (pos != std::string::npos) {
-                content = content.substr(pos + postfix_think.size());
+            // chunks ahead of this one are not refined yet, so fall back
+            // to the raw tail of the previous chunk as context
+            std::string context;
+            if (in_flight.empty()) {
+                context = refined_text.tail(4096);
+            } else {
+                context = in_flight.back().text;
             }
-        } catch (const std::exception& e) {
-            std::cout << "Error chat stream: " << e.what() << std::endl;
+            context = tokenizer.tail(context, refine_overlap_tokens);
+            int slot = refine_slot < 0 ? -1 :
+                refine_slot + int(seq++ % refine_parallel);
+            job_t job;
+            job.text = text;
+            job.queued = queued;
+            job.stats = std::make_shared<request_stats_t>();
+            job.stats->stage = "refine";
+            job.stats->queue_ms = elapsed_ms(queued);
+            // the result is set before the wake-up, so the worker never
+            // wakes to a future that is not ready yet
+            auto promise = std::make_shared<std::promise<std::string>>();
+            job.result = promise->get_future();
+            job.task = std::async(std::launch::async, 
+                [this, text, context, slot, stats = job.stats, promise]() {
+                    promise->set_value(refine_chunk(text, context, slot, 
+                        stats.get()));
+                    wake();
+                });
+            in_flight.push_back(std::move(job));
         }
-        return content;
-    };
-    
-    llm_thread = std::thread([this, make_request, llm_predict, func]() {
-        thread_running = true;
-        auto start = std::chrono::steady_clock::now();
-        while (thread_running) {
-            status = LLM_IDLE;
-            if (force_summarize && refined_text.size() > 0) {
-                status = LLM_SUMMARIZE;
-                summarized_text = llm_predict(refined_text, 
-                    summarize_system_prompt);
-                if (summarized_text.empty()) continue;
-                if (func) func("summarize", summarized_text);
-                force_summarize = false;
-                continue;
+        refine_busy = in_flight.size();
+        if (was_busy && in_flight.empty()) {
+            // the summarize lane folds only while refine is idle
+            wake();
+        }
+        if (flush_all && in_flight.empty() && wait_refine_messages.size() == 0) {
+            {
+                std::lock_guard<std::mutex> lk(sched_mtx);
+                drained = true;
             }
-            auto now = std::chrono::steady_clock::now();
-            auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                now - start);
-            if ((elapsed.count() < refine_span) && !force_refine) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                continue;
+            sched_cv.notify_all();
+        }
+
+        // sleep until something changes or the next trigger is due. With
+        // every lane busy or a user summary running, a due trigger cannot
+        // dispatch anyway; a finished request or the summary wakes us.
+        auto deadline = time_point::max();
+        state = wait_refine_messages.state();
+        bool can_dispatch = thread_running && !user_summary
+            && in_flight.size() < refine_parallel;
+        if (can_dispatch && state.size > 0) {
+            deadline = std::min(deadline, state.oldest + max_latency);
+            if (state.complete && drain_size <= 0) {
+                deadline = std::min(deadline, state.last_push + silence_gap);
             }
-            start = now;
-            std::string text = wait_refine_messages.fetch(refine_chunk_size);
-            if (force_refine) force_refine = false;
-            if (text.empty()) continue;
-            status = LLM_REFINE;
-            std::string refined = llm_predict(text, refine_system_prompt);
-            if (refined.empty()) continue;
-            if (refine_output_file.is_open()) {
-                refine_output_file << refined;
+        }
+        std::unique_lock<std::mutex> lk(sched_mtx);
+        auto changed = [&]() { return sched_events != seen; };
+        if (deadline == time_point::max()) {
+            sched_cv.wait(lk, changed);
+        } else {
+            sched_cv.wait_until(lk, deadline, changed);
+        }
+    }
+    refine_busy = 0;
+}
+
+// a user summary runs as soon as it is asked for; rolling folds are
+// background work and wait until the refine lane is idle
+void LLM::summarize_worker() {
+    while (thread_running) {
+        uint64_t seen = events();
+        size_t size = refined_text.bytes();
+        auto retry = time_point::max();
+        if (force_summarize && size > 0) {
+            summarize_busy = true;
+            user_summary = true;
+            int ret = update_summary();
+            user_summary = false;
+            summarize_busy = false;
+            wake();
+            if (ret == 0) {
+                summarized_text = rolling_summary;
+                notify("summarize", summarized_text);
+                force_summarize = false;
+                continue;
             }
-            if (func) func("refine", refined);
-            refined_text += refined;
+            retry = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        } else if (summarize_rolling && size > rolled_size && refine_busy == 0
+            && wait_refine_messages.state().ready_tokens < refine_chunk_tokens) {
+            summarize_busy = true;
+            int ret = update_summary();
+            summarize_busy = false;
+            if (ret == 0) continue;
+            retry = std::chrono::steady_clock::now() + std::chrono::seconds(1);
         }
-    });
-    return 0;
+
+        std::unique_lock<std::mutex> lk(sched_mtx);
+        auto changed = [&]() { return sched_events != seen; };
+        if (retry == time_point::max()) {
+            sched_cv.wait(lk, changed);
+        } else {
+            sched_cv.wait_until(lk, retry, changed);
+        }
+    }
+}
+
+void LLM::wake() {
+    {
+        std::lock_guard<std::mutex> lk(sched_mtx);
+        ++sched_events;
+    }
+    sched_cv.notify_all();
+}
+
+uint64_t LLM::events() {
+    std::lock_guard<std::mutex> lk(sched_mtx);
+    return sched_events;
+}
+
+void LLM::drain() {
+    std::unique_lock<std::mutex> lk(sched_mtx);
+    if (!thread_running) return;
+    draining = true;
+    drained = false;
+    ++sched_events;
+    sched_cv.notify_all();
+    sched_cv.wait(lk, [this] { return drained || !thread_running; });
+    draining = false;
 }
 
 int LLM::shutdown() {
-    openai::stop();
+    if (stopped.exchange(true)) return 0;
 
+    // the workers finish the requests they started, the engine goes last
     thread_running = false;
-    if (llm_thread.joinable()) {
-        llm_thread.join();
+    wake();
+    if (refine_thread.joinable()) {
+        refine_thread.join();
     }
+    if (summarize_thread.joinable()) {
+        summarize_thread.join();
+    }
+    if (engine && own_engine) engine->shutdown();
 
     if (refine_output_file.is_open()) {
         refine_output_file.close();
@@ -146,6 +393,7 @@ int LLM::shutdown() {
         summarize_output_file << summarized_text;
         summarize_output_file.close();
     }
+    cache.shutdown();
     return 0;
 }
 
@@ -155,10 +403,336 @@ int LLM::refine(const std::string& text) {
     } else {
         force_refine = true;
     }
+    wake();
     return 0;
 }
 
 int LLM::summarize() {
     force_summarize = true;
+    wake();
     return 0;
 }
+
+LLM::budget_t LLM::load_budget(const nlohmann::json& config, 
+    const budget_t& defaults) {
+    budget_t budget;
+    budget.ratio = config.value("ratio", defaults.ratio);
+    budget.min_tokens = config.value("min_tokens", defaults.min_tokens);
+    budget.max_tokens = config.value("max_tokens", defaults.max_tokens);
+    budget.thinking = config.value("thinking", defaults.thinking);
+    budget.stop = config.value("stop", defaults.stop);
+    return budget;
+}
+
+// the system prompt is kept byte-identical and comes first, followed by the
+// context tail and the new text, so the server can reuse the cached prefix
+nlohmann::json LLM::make_request(const std::string& text, 
+    const std::string& system_prompt, const budget_t& budget, 
+    const std::string& context, int slot) {
+    nlohmann::json request;
+    request["model"] = model;
+    request["temperature"] = temperature;
+    request["top_p"] = top_p;
+    request["top_k"] = top_k;
+    request["presence_penalty"] = presence_penalty;
+    request["messages"] = {
+        {{"role", "system"},
+         {"content", system_prompt}},
+        {{"role", "user"},
+         {"content", context.empty() ? text :
+            "<context>\n" + context + "\n</context>\n" + text}}
+    };
+    if (budget.ratio > 0) {
+        int max_tokens = int(budget.ratio * tokenizer.count(text));
+        request["max_tokens"] = std::clamp(max_tokens, budget.min_tokens, 
+            std::max(budget.min_tokens, budget.max_tokens));
+    }
+    // Qwen3 thinks unless told otherwise; the reasoning is thrown away
+    if (!budget.thinking) {
+        request["chat_template_kwargs"] = {{"enable_thinking", false}};
+    }
+    if (!budget.stop.empty()) request["stop"] = budget.stop;
+    // llama-server drafts with its draft model or n-gram lookup, the
+    // in-process engine drafts from the prompt
+    if (budget.draft_max > 0) {
+        request["speculative.n_max"] = budget.draft_max;
+        request["speculative.n_min"] = budget.draft_min;
+        request["speculative.p_min"] = budget.draft_p_min;
+    }
+    request["cache_prompt"] = true;
+    if (slot >= 0) request["id_slot"] = slot;
+    if (log_requests) log(request.dump());
+    return request;
+}
+
+std::string LLM::predict(const std::string& text, 
+    const std::string& system_prompt, const budget_t& budget, 
+    const std::string& context /* = "" */, int slot /* = -1 */, 
+    request_stats_t * stats /* = nullptr */) {
+    nlohmann::json request = make_request(text, system_prompt, budget, 
+        context, slot);
+    std::string content = "";
+    std::string key;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        if (cache.isEnabled()) {
+            key = ResponseCache::key(request);
+            if (cache.get(key, content)) {
+                log("cache hit (" + std::to_string(cache.getHits()) +
+                    " hits, " + std::to_string(cache.getMisses()) + " misses)");
+                if (stats) {
+                    stats->cached = true;
+                    stats->ok = true;
+                    stats->latency_ms = elapsed_ms(start);
+                }
+                return content;
+            }
+        }
+        // a truncated answer, half a sentence or an open <think> block, is
+        // asked again once with twice the budget and is a failure after that
+        for (int attempt = 0; ; ++attempt) {
+            auto response = engine->chat(request);
+            //std::cout << "LLM response: " << response.dump() << std::endl;
+            if (log_requests) log(response.dump());
+            if (response.is_null() || !response.contains("choices")
+                || response["choices"].empty()) {
+                throw std::runtime_error("no choices in response");
+            }
+            content = response["choices"][0]["message"]["content"].get<std::string>();
+            const std::string postfix_think = "</think>\n\n";
+            int pos = content.find(postfix_think);
+            if (pos != std::string::npos) {
+                content = content.substr(pos + postfix_think.size());
+            }
+            bool truncated = response["choices"][0].value("finish_reason", "") == "length";
+            if (stats) {
+                auto usage = response.value("usage", nlohmann::json::object());
+                auto timings = response.value("timings", nlohmann::json::object());
+                stats->prompt_tokens += usage.value("prompt_tokens", 0);
+                stats->completion_tokens += usage.value("completion_tokens", 0);
+                double predicted_ms = timings.value("predicted_ms", 0.0);
+                stats->ttft_ms = timings.value("prompt_ms", 0.0);
+                stats->tokens_per_second = predicted_ms > 0 ? 
+                    timings.value("predicted_n", 0) * 1000.0 / predicted_ms :
+                    stats->completion_tokens * 1000.0 / std::max(1.0, elapsed_ms(start));
+                stats->truncated = truncated;
+                stats->draft_tokens += timings.value("draft_n", 0);
+                stats->accepted_tokens += timings.value("draft_n_accepted", 0);
+            }
+            if (!truncated) break;
+            if (attempt > 0 || !request.contains("max_tokens")) {
+                log("answer truncated at " + std::to_string(
+                    request.value("max_tokens", 0)) + " tokens, dropped");
+                content.clear();
+                break;
+            }
+            request["max_tokens"] = request["max_tokens"].get<int>() * 2;
+        }
+        if (!key.empty() && !content.empty()) {
+            cache.put(key, content);
+        }
+    } catch (const std::exception& e) {
+        std::cout << "Error chat stream: " << e.what() << std::endl;
+    }
+    if (stats) {
+        stats->ok = !content.empty();
+        stats->latency_ms = elapsed_ms(start);
+    }
+    return content;
+}
+
+// in edits mode the model only lists what to change; when the list does not
+// apply cleanly the chunk is rewritten in full, and the stats add up both
+std::string LLM::refine_chunk(const std::string& text, 
+    const std::string& context, int slot, request_stats_t * stats) {
+    if (!refine_edits) {
+        return predict(text, refine_system_prompt, refine_budget, context, 
+            slot, stats);
+    }
+    auto units = Edits::split(text);
+    if (units.empty()) {
+        if (stats) stats->ok = true;
+        return std::string();
+    }
+    std::string ops = predict(Edits::render(units), refine_edit_prompt, 
+        refine_edit_budget, context, slot, stats);
+    // a failed request would fail again in full
+    if (ops.empty()) return std::string();
+    std::string result;
+    std::string error;
+    if (Edits::apply(units, ops, result, &error) == 0) return result;
+
+    log("refine edits rejected, " + error);
+    request_stats_t edit_stats = stats ? *stats : request_stats_t();
+    result = predict(text, refine_system_prompt, refine_budget, context, 
+        slot, stats);
+    if (stats) {
+        stats->fallback = true;
+        stats->latency_ms += edit_stats.latency_ms;
+        stats->prompt_tokens += edit_stats.prompt_tokens;
+        stats->completion_tokens += edit_stats.completion_tokens;
+        stats->cached = stats->cached && edit_stats.cached;
+    }
+    return result;
+}
+
+std::string LLM::fold_summary(const std::string& summary, 
+    const std::string& text) {
+    request_stats_t request_stats;
+    request_stats.stage = "summarize";
+    std::string result;
+    if (summary.empty()) {
+        result = predict(text, summarize_system_prompt, summarize_budget, "", 
+            summarize_slot, &request_stats);
+    } else {
+        std::string input = "<summary>\n" + summary + "\n</summary>\n"
+            "<text>\n" + text + "\n</text>";
+        result = predict(input, merge_system_prompt, summarize_budget, "", 
+            summarize_slot, &request_stats);
+    }
+    request_stats.lag_ms = request_stats.latency_ms;
+    record(request_stats);
+    return result;
+}
+
+// map-reduce: summarize chunks of a long backlog in parallel, then fold the
+// partial summaries into the existing summary
+std::string LLM::reduce_summary(const std::string& summary, 
+    const std::string& text, int depth /* = 0 */) {
+    auto chunks = split_text(text, summarize_chunk_size);
+    if (chunks.size() <= 1 || depth >= 3) return fold_summary(summary, text);
+
+    std::vector<std::string> partials(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i += summarize_parallel) {
+        std::vector<std::future<std::string>> futures;
+        size_t n = std::min(chunks.size() - i, size_t(summarize_parallel));
+        for (size_t j = 0; j < n; ++j) {
+            futures.push_back(std::async(std::launch::async, 
+                [this, &chunks, i, j]() {
+                    request_stats_t request_stats;
+                    request_stats.stage = "summarize";
+                    auto result = predict(chunks[i + j], summarize_system_prompt, 
+                        summarize_budget, "", -1, &request_stats);
+                    request_stats.lag_ms = request_stats.latency_ms;
+                    record(request_stats);
+                    return result;
+                }));
+        }
+        for (size_t j = 0; j < n; ++j) {
+            partials[i + j] = futures[j].get();
+        }
+    }
+
+    std::string merged = "";
+    for (const auto& partial: partials) {
+        if (partial.empty()) return std::string();
+        merged += partial + "\n";
+    }
+    return reduce_summary(summary, merged, depth + 1);
+}
+
+// fold refined_text[rolled_size, end) into rolling_summary a window at a
+// time, streamed from the spool; a rolling fold does one window and lets
+// refine go first, a user summary catches up
+int LLM::update_summary() {
+    const size_t window = size_t(summarize_chunk_size) * summarize_parallel;
+    while (rolled_size < refined_text.bytes()) {
+        std::string backlog = refined_text.read(rolled_size, window);
+        if (rolled_size + backlog.size() < refined_text.bytes()) {
+            // end on a line break, or at least on a character boundary
+            size_t end = backlog.rfind('\n');
+            if (end != std::string::npos) {
+                backlog.resize(end + 1);
+            } else {
+                // back to the lead byte of the last character, which is
+                // cut off when its continuation bytes are not all here
+                end = backlog.size();
+                while (end > 0 && (backlog[end - 1] & 0xC0) == 0x80) --end;
+                if (end > 0) {
+                    unsigned char lead = backlog[end - 1];
+                    size_t length = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+                    if (backlog.size() - (end - 1) < length) backlog.resize(end - 1);
+                }
+            }
+        }
+        if (backlog.empty()) break;
+
+        std::string summary = reduce_summary(rolling_summary, backlog);
+        if (summary.empty()) return -1;
+        rolling_summary = summary;
+        rolled_size += backlog.size();
+        if (!user_summary) break;
+    }
+    return 0;
+}
+
+void LLM::setCallback(llm_callback func) {
+    std::lock_guard<std::mutex> lk(callback_mtx);
+    callback = std::move(func);
+}
+
+// the callback may block on a full downstream queue, the lanes must not
+// wait for each other behind it. It is called on a copy, shutdown() joins
+// the workers before the owner clears it
+void LLM::notify(const std::string& name, const std::string& text) {
+    llm_callback func;
+    {
+        std::lock_guard<std::mutex> lk(callback_mtx);
+        func = callback;
+    }
+    if (func) func(name, text);
+}
+
+void LLM::log(const std::string& text) {
+    notify("log", text);
+}
+
+void LLM::resolve_metrics(const std::string& stage, llm_metrics_t& metrics) {
+    auto& registry = Metrics::instance();
+    Metrics::labels_t labels = {{"stage", stage}};
+    auto requests = [&](const std::string& result) {
+        return &registry.counter("voicelint_llm_requests_total", "LLM requests by outcome", 
+            {{"stage", stage}, {"result", result}});
+    };
+    metrics.ok = requests("ok");
+    metrics.cached = requests("cached");
+    metrics.error = requests("error");
+    metrics.queue = &registry.histogram("voicelint_llm_queue_seconds", 
+        "Time from queueing the text to sending the request", labels);
+    metrics.request = &registry.histogram("voicelint_llm_request_seconds", 
+        "Request round trip", labels);
+    metrics.lag = &registry.histogram("voicelint_llm_lag_seconds", 
+        "Time from the ASR text to the result that covers it", labels);
+    metrics.ttft = &registry.histogram("voicelint_llm_ttft_seconds", 
+        "Time to the first token, from the server's prompt timings", labels);
+    metrics.prompt_tokens = &registry.counter("voicelint_llm_tokens_total", "Tokens processed", 
+        {{"stage", stage}, {"kind", "prompt"}});
+    metrics.completion_tokens = &registry.counter("voicelint_llm_tokens_total", "Tokens processed", 
+        {{"stage", stage}, {"kind", "completion"}});
+}
+
+void LLM::record(const request_stats_t& request_stats) {
+    auto& metrics = request_stats.stage == "refine" ? refine_metrics : summarize_metrics;
+    (!request_stats.ok ? metrics.error : request_stats.cached ? metrics.cached : metrics.ok)->add();
+    if (request_stats.ok) {
+        metrics.queue->observe(request_stats.queue_ms / 1000);
+        metrics.request->observe(request_stats.latency_ms / 1000);
+        metrics.lag->observe(request_stats.lag_ms / 1000);
+    }
+    if (request_stats.ttft_ms > 0) {
+        metrics.ttft->observe(request_stats.ttft_ms / 1000);
+    }
+    metrics.prompt_tokens->add(request_stats.prompt_tokens);
+    metrics.completion_tokens->add(request_stats.completion_tokens);
+
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    if (stats.size() >= 4096) stats.pop_front();
+    stats.push_back(request_stats);
+}
+
+std::vector<LLM::request_stats_t> LLM::getStats() {
+    std::lock_guard<std::mutex> lk(stats_mtx);
+    std::vector<request_stats_t> result(stats.begin(), stats.end());
+    stats.clear();
+    return result;
+}
\ No newline at end of file
@@ -1,11 +1,27 @@
 #pragma once
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "backend.h"
+#include "cache.h"
+#include "metrics.h"
+#include "tokenizer.h"
+#include "transcript.h"
 
-typedef void (* llm_callback)(const std::string& name, 
-    const std::string& text);
+// name: "refine", "summarize", "log"
+typedef std::function<void(const std::string& name, 
+    const std::string& text)> llm_callback;
 
 class LLM {
 public:
@@ -13,94 +29,306 @@ public:
         static LLM _inst;
         return _inst;
     }
+    // the app has one, the server one per session
+    LLM() = default;
+    ~LLM() = default;
     LLM(const LLM&) = delete;
     LLM operator=(const LLM&) = delete;
 
-    int init(const nlohmann::json& config, llm_callback func);
+    // shared: an engine opened by another LLM, used instead of opening one
+    // and left running by shutdown()
+    int init(const nlohmann::json& config, llm_callback func, 
+        std::shared_ptr<ChatEngine> shared = nullptr);
+    // refines everything queued, the unfinished sentence included, and
+    // waits for the requests in flight; the end of a session, before
+    // shutdown()
+    void drain();
+    // once, the later calls return at once
     int shutdown();
+    // where the results go; the workers call it under a lock, so once this
+    // returns the old one is not called any more
+    void setCallback(llm_callback func);
 
     int refine(const std::string& text);
     int summarize();
 
+    typedef struct _request_stats_t {
+        std::string stage; // "refine" or "summarize"
+        double queue_ms = 0; // from queueing the text to sending the request
+        double latency_ms = 0; // request round trip
+        double lag_ms = 0; // from queueing the text to delivering the result
+        double ttft_ms = 0; // to the first token, the prompt processing time
+        int prompt_tokens = 0;
+        int completion_tokens = 0; // thinking included
+        double tokens_per_second = 0; // generation speed
+        int draft_tokens = 0; // speculative tokens proposed
+        int accepted_tokens = 0; // and accepted
+        bool truncated = false; // stopped by max_tokens
+        bool fallback = false; // edits rejected, the chunk was rewritten
+        bool cached = false;
+        bool ok = false;
+    } request_stats_t;
+
+    // stats of the requests finished since the last call
+    std::vector<request_stats_t> getStats();
+    int getPendingSize() {
+        return wait_refine_messages.size();
+    }
+
     bool isRefine() const {
-        return status == LLM_REFINE;
+        return refine_busy > 0;
     };
     bool isSummarize() const {
-        return status == LLM_SUMMARIZE;
+        return summarize_busy;
     };
 
+    std::shared_ptr<ChatEngine> getEngine() const {
+        return engine;
+    }
+
     std::string getRefineOutFile() const {
-        return refine_output_path; // Return the path to the refine output file
+        return refine_save ? refine_output_path : ""; // Return the path to the refine output file
     }
     std::string getSummarizeOutFile() const {
-        return summarize_output_path; // Return the path to the summarize output file
+        return summarize_save ? summarize_output_path : ""; // Return the path to the summarize output file
     }
 
 private:
-    LLM() = default;
-    ~LLM() = default;
-
+    std::string schema_host_port = "http://localhost:8080";
     std::string model = "Qwen3-8b";
     float temperature = 0.6f;
     float top_p = 0.95f;
     int top_k = 20;
     float presence_penalty = 1.5f;
+    bool log_requests = false; // every request and response as a "log" result
+
+    // generation limits of a stage: max_tokens is ratio times the input
+    // tokens, clamped to [min_tokens, max_tokens]
+    typedef struct _budget_t {
+        double ratio = 0; // 0 for no limit
+        int min_tokens = 128;
+        int max_tokens = 4096;
+        bool thinking = false;
+        std::vector<std::string> stop;
+        // speculative decoding, refine output mostly copies its input
+        int draft_max = 0; // 0 for off
+        int draft_min = 0;
+        float draft_p_min = 0.75f;
+    } budget_t;
 
     std::string refine_system_prompt = "";
-    int refine_chunk_size = 1024;
-    int refine_span = 120; // seconds
+    int refine_chunk_tokens = 512;
+    int refine_overlap_tokens = 64; // context carried from the previous chunk
+    int refine_silence_gap = 1500; // ms after a sentence end before refining
+    int refine_max_latency = 30; // seconds text may wait in the queue
+    int refine_slot = 0; // llama-server slot id, -1 for any
+    int refine_parallel = 2; // concurrent refine requests
+    budget_t refine_budget;
+    // "edits": the model lists edits against numbered units and the text is
+    // patched locally, "full": the model writes the refined text
+    bool refine_edits = false;
+    std::string refine_edit_prompt = "";
+    budget_t refine_edit_budget;
     bool refine_save = false;
 
     std::string summarize_system_prompt = "";
+    std::string merge_system_prompt = "";
+    int summarize_chunk_size = 4096;
+    int summarize_parallel = 2;
+    bool summarize_rolling = true;
+    int summarize_slot = 2;
+    budget_t summarize_budget;
     bool summarize_save = false;
 
-    bool thread_running = false;
-    std::thread llm_thread;
+    std::atomic<bool> thread_running = false;
+    std::atomic<bool> stopped = false;
+    std::mutex callback_mtx;
+    llm_callback callback = nullptr;
+    void notify(const std::string& name, const std::string& text);
+    // refine and summarize run on their own lanes so a summary never
+    // waits behind the refine backlog
+    std::thread refine_thread;
+    std::thread summarize_thread;
+    std::atomic<int> refine_busy = 0;
+    std::atomic<bool> summarize_busy = false;
+
+    void refine_worker();
+    void summarize_worker();
+
+    // both lanes sleep on sched_cv until something changes: new text, a
+    // user request, a finished refine request or shutdown. sched_events
+    // counts the changes so a wake-up between two checks is not lost.
+    std::mutex sched_mtx;
+    std::condition_variable sched_cv;
+    uint64_t sched_events = 0;
+    bool draining = false; // drain() waits for the refine lane to empty
+    bool drained = false;
+    void wake();
+    uint64_t events();
+
+    std::shared_ptr<ChatEngine> engine;
+    bool own_engine = true;
+    Tokenizer tokenizer;
+    ResponseCache cache;
 
     typedef struct _queue_t {
-        std::deque<std::string> q;
+        typedef std::chrono::steady_clock::time_point time_point;
+        typedef struct _sentence_t {
+            std::string text;
+            time_point time; // when its first part was queued
+        } sentence_t;
+        std::deque<sentence_t> q; // complete sentences
+        sentence_t partial; // text after the last sentence end
         std::mutex mtx;
         int cur_size = 0;
+        int ready_tokens = 0; // estimated tokens in q
+        time_point last_push;
+        const int max_partial = 2048; // bytes before cutting mid-sentence
+
+        typedef struct _state_t {
+            int size = 0;
+            int ready_tokens = 0;
+            bool complete = false; // queued text ends on a sentence end
+            time_point oldest;
+            time_point last_push;
+        } state_t;
 
         void push(const std::string& text) {
             std::lock_guard<std::mutex> lk(mtx);
-            q.push_back(text);
+            auto now = std::chrono::steady_clock::now();
+            auto time = partial.text.empty() ? now : partial.time;
+            auto sentences = Tokenizer::split_sentences(partial.text + text);
+            partial.text.clear();
+            if (!sentences.empty()
+                && !Tokenizer::is_sentence_end(sentences.back())
+                && sentences.back().size() < max_partial) {
+                partial.text = sentences.back();
+                partial.time = sentences.size() > 1 ? now : time;
+                sentences.pop_back();
+            }
+            for (auto& sentence: sentences) {
+                ready_tokens += Tokenizer::estimate(sentence);
+                q.push_back({sentence, time});
+                time = now;
+            }
             cur_size += text.size();
+            last_push = now;
         }
 
-        std::string fetch(int chunk_size) {
-            std::unique_lock<std::mutex> lk(mtx);
-            std::string result = "";
-
-            while (!q.empty()) {
-                result += q.front();
-                cur_size -= q.front().size();
-                q.pop_front();
-                if (result.size() >= chunk_size) {
-                    break;
+        // whole sentences up to max_tokens; the unfinished tail only goes
+        // out on flush. The sentences that may fit by the estimate are
+        // counted in one call outside the lock, which is safe as there is a
+        // single consumer: they stay at the front meanwhile.
+        std::string fetch(Tokenizer& tokenizer, int max_tokens, bool flush, 
+            time_point * oldest = nullptr) {
+            std::vector<sentence_t> candidates;
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                if (flush && !partial.text.empty()) {
+                    ready_tokens += Tokenizer::estimate(partial.text);
+                    q.push_back(partial);
+                    partial.text.clear();
+                }
+                int estimated = 0;
+                for (const auto& sentence: q) {
+                    if (!candidates.empty() && estimated > max_tokens * 2) break;
+                    candidates.push_back(sentence);
+                    estimated += Tokenizer::estimate(sentence.text);
                 }
             }
+            std::vector<std::string> texts;
+            for (const auto& sentence: candidates) texts.push_back(sentence.text);
+            auto counts = tokenizer.count(texts);
 
+            std::string result = "";
+            int tokens = 0;
+            size_t taken = 0;
+            for (; taken < candidates.size() && tokens < max_tokens; ++taken) {
+                if (!result.empty() && tokens + counts[taken] > max_tokens) break;
+                if (result.empty() && oldest) *oldest = candidates[taken].time;
+                result += candidates[taken].text;
+                tokens += counts[taken];
+            }
+            std::lock_guard<std::mutex> lk(mtx);
+            for (size_t i = 0; i < taken; ++i) {
+                q.pop_front();
+                cur_size -= candidates[i].text.size();
+                ready_tokens = q.empty() ? 0 :
+                    std::max(0, ready_tokens - Tokenizer::estimate(candidates[i].text));
+            }
             return result;
         }
+
+        int size() {
+            std::lock_guard<std::mutex> lk(mtx);
+            return cur_size;
+        }
+
+        state_t state() {
+            std::lock_guard<std::mutex> lk(mtx);
+            state_t s;
+            s.size = cur_size;
+            s.ready_tokens = ready_tokens;
+            s.complete = !q.empty() && partial.text.empty();
+            s.oldest = q.empty() ? partial.time : q.front().time;
+            s.last_push = last_push;
+            return s;
+        }
     } queue_t;
 
-    bool force_refine = false;
-    bool force_summarize = false;
+    std::atomic<bool> force_refine = false;
+    std::atomic<bool> force_summarize = false;
+    // a user summary holds back new refine requests while it runs
+    std::atomic<bool> user_summary = false;
 
     queue_t wait_refine_messages;
-    std::string refined_text;
+    Transcript refined_text{64, 4}; // on disk, shared by the two lanes
     std::string summarized_text;
 
+    // summary of refined_text[0, rolled_size), folded in block by block
+    std::string rolling_summary;
+    size_t rolled_size = 0;
+
+    std::deque<request_stats_t> stats;
+    std::mutex stats_mtx;
+    // taken from the registry once in init, record() only adds to them
+    typedef struct _llm_metrics_t {
+        Counter * ok = nullptr;
+        Counter * cached = nullptr;
+        Counter * error = nullptr;
+        Histogram * queue = nullptr;
+        Histogram * request = nullptr;
+        Histogram * lag = nullptr;
+        Histogram * ttft = nullptr;
+        Counter * prompt_tokens = nullptr;
+        Counter * completion_tokens = nullptr;
+    } llm_metrics_t;
+    llm_metrics_t refine_metrics;
+    llm_metrics_t summarize_metrics;
+    static void resolve_metrics(const std::string& stage, llm_metrics_t& metrics);
+    void record(const request_stats_t& request_stats);
+    void log(const std::string& text);
+
+    static budget_t load_budget(const nlohmann::json& config, 
+        const budget_t& defaults);
+    nlohmann::json make_request(const std::string& text, 
+        const std::string& system_prompt, const budget_t& budget, 
+        const std::string& context, int slot);
+    std::string predict(const std::string& text, 
+        const std::string& system_prompt, const budget_t& budget, 
+        const std::string& context = "", int slot = -1, 
+        request_stats_t * stats = nullptr);
+    std::string refine_chunk(const std::string& text, 
+        const std::string& context, int slot, request_stats_t * stats);
+
+    std::string fold_summary(const std::string& summary, 
+        const std::string& text);
+    std::string reduce_summary(const std::string& summary, 
+        const std::string& text, int depth = 0);
+    int update_summary();
+
     std::string refine_output_path = "output/refine.txt";
     std::string summarize_output_path = "output/summarize.txt";
     std::ofstream refine_output_file;
     std::ofstream summarize_output_file;
-
-    typedef enum {
-        LLM_IDLE = 0,
-        LLM_REFINE,
-        LLM_SUMMARIZE
-    } LLMStatus;
-    LLMStatus status = LLM_IDLE;
 };
\ No newline at end of file
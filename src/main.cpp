@@ -7,28 +7,82 @@
 #include <sstream>
 #include <vector>
 
+#ifdef VOICELINT_UI
 #include "ui.h"
+#endif
+#include "headless.h"
 #include "audio.h"
 #include "asr.h"
 #include "llm.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "search.h"
+#include "server.h"
+#include "session_file.h"
+#include "stages.h"
 
-int save_data(const std::vector<std::string>& files) {
-    auto now = std::chrono::system_clock::now();
+static bool headless = false;
+
+// name: "asr", "refine", "summarize", "log"
+static void show(const std::string& name, const std::string& text) {
+    if (headless) {
+        EchoNote::Headless::instance().show(name, text);
+        return;
+    }
+#ifdef VOICELINT_UI
+    EchoNote::UI::instance().show(name, text);
+#endif
+}
+
+std::string session_name(std::chrono::system_clock::time_point now =
+    std::chrono::system_clock::now()) {
     auto now_c = std::chrono::system_clock::to_time_t(now);
     std::tm * now_tm = std::localtime(&now_c);
     std::ostringstream oss;
     oss << std::put_time(now_tm, "%Y%m%d%H%M");
-    std::string path = "data/" + oss.str();
-    if (!std::filesystem::exists(path)) {
-        std::filesystem::create_directories(path);
-    }
+    return oss.str();
+}
+
+// the files are gathered in a hidden directory that is then renamed into
+// place, so the history list and the search index never see a session
+// half archived. The text outputs that were not saved as loose files are
+// exported from the session container, the history and the search index
+// read those.
+int save_data(const std::string& session, 
+    const std::vector<std::string>& files, const std::string& container = "") {
+    std::string path = "data/" + session;
+    std::string staging = "data/." + session;
+    std::filesystem::create_directories(staging);
 
     for (const auto& file: files) {
         std::string filename = std::filesystem::path(file).filename().string();
-        std::string new_file = path + "/" + filename;
+        std::string new_file = staging + "/" + filename;
         std::filesystem::rename(file, new_file);
     }
 
+    SessionFile archived;
+    if (!container.empty() && archived.open(staging + "/" +
+        std::filesystem::path(container).filename().string()) == 0) {
+        const std::pair<std::string, uint16_t> texts[] = {
+            {"asr.txt", SessionFile::chunk_asr},
+            {"refine.txt", SessionFile::chunk_refine},
+            {"summarize.txt", SessionFile::chunk_summary}
+        };
+        for (const auto& [filename, type]: texts) {
+            if (!std::filesystem::exists(staging + "/" + filename)) {
+                archived.exportText(type, staging + "/" + filename);
+            }
+        }
+        archived.close();
+    }
+
+    // a second session in the same minute gets its own directory, the
+    // indexes would never see files merged into one they already read
+    std::string target = path;
+    for (int i = 1; std::filesystem::exists(target); ++i) {
+        target = path + "-" + std::to_string(i);
+    }
+    std::filesystem::rename(staging, target);
     return 0;
 }
 
@@ -39,7 +93,11 @@ int main(int argc, char* argv[]) {
         ("help,h", "produce help message")
         ("config,c", 
             po::value<std::string>()->default_value("config/config.json"), 
-            "set configuration file");
+            "set configuration file")
+        ("headless", "run without a window, commands on stdin and results "
+            "as JSON lines on stdout")
+        ("serve", "run as a caption server for many clients, see the "
+            "\"server\" config block");
     po::variables_map vm;
     try {
         po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -52,6 +110,16 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+#ifdef VOICELINT_UI
+    headless = vm.count("headless") > 0;
+#else
+    headless = true;
+#endif
+    // stdout carries only the JSON lines, everything else goes to stderr
+    std::streambuf * stdout_buf = std::cout.rdbuf();
+    std::ostream json_out(stdout_buf);
+    if (headless) std::cout.rdbuf(std::cerr.rdbuf());
+
     std::string configFile = vm["config"].as<std::string>();
     nlohmann::json config;
     try {
@@ -65,6 +133,50 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    Metrics::instance().init(config.value("metrics", nlohmann::json::object()));
+
+    if (vm.count("serve")) {
+        // no capture and no window: the clients bring the audio, the
+        // sessions share the ASR and the LLM engine
+        ASR& asr = ASR::instance();
+        if (asr.init(config["asr"]) != 0) {
+            std::cerr << "ASR initialization failed." << std::endl;
+            return 1;
+        }
+        LLM& llm = LLM::instance();
+        if (llm.init(config["llm"], nullptr) != 0) {
+            std::cerr << "LLM initialization failed." << std::endl;
+            llm.shutdown();
+            asr.shutdown();
+            return 1;
+        }
+        int ret = EchoNote::Server::instance().run(config.value("server", 
+            nlohmann::json::object()), config["llm"], &asr, &llm);
+        llm.shutdown();
+        asr.shutdown();
+        Metrics::instance().shutdown();
+        std::cout.rdbuf(stdout_buf);
+        return ret == 0 ? 0 : 1;
+    }
+
+    // a container a crash left behind is archived under its start time
+    nlohmann::json session_config = config.value("session", nlohmann::json::object());
+    std::string container = session_config.value("output", "output/session.vls");
+    if (session_config.value("enabled", true) && std::filesystem::exists(container)
+        && SessionFile::repair(container) == 0) {
+        SessionFile previous;
+        if (previous.open(container) == 0 && previous.duration() > 0) {
+            std::string name = session_name(previous.created());
+            previous.close();
+            save_data(name, {container}, container);
+            std::cout << "Recovered session " << name << "." << std::endl;
+        }
+    }
+    SessionFile session_file;
+    bool use_session_file = session_file.init(session_config) == 0;
+    Publisher publisher;
+    publisher.init(config.value("publish", nlohmann::json::object()));
+
     Audio& audio = Audio::instance();
     int ret = audio.init(config["audio"]);
     if (ret != 0) {
@@ -83,20 +195,68 @@ int main(int argc, char* argv[]) {
     std::cout << "ASR initialized successfully." << std::endl;
 
     LLM& llm = LLM::instance();
-    ret = llm.init(config["llm"], [](const std::string& name, 
-        const std::string& result) {
-        //std::cout << "LLM callback: " << name << " - " << result << std::endl;
-        EchoNote::UI::instance().show(name, result);
+    // the llm stage sets where the results go
+    ret = llm.init(config["llm"], nullptr);
+    if (ret != 0) {
+        std::cerr << "LLM initialization failed with error code: " << ret << std::endl;
+        llm.shutdown();
+        asr.shutdown();
+        audio.shutdown();
+        return ret;
+    }
+    std::cout << "LLM initialized successfully." << std::endl;
+
+    // the stage types bind this process's modules; the "graph" block says
+    // how they are connected
+    Graph graph;
+    graph.define("capture", [&audio]() { return std::make_unique<CaptureStage>(&audio); });
+    graph.define("asr", [&asr]() { return std::make_unique<AsrStage>(&asr); });
+    graph.define("llm", [&llm]() { return std::make_unique<LlmStage>(&llm); });
+    graph.define("display", []() { return std::make_unique<DisplayStage>(show); });
+    graph.define("session_file", [&session_file]() {
+        return std::make_unique<SessionFileStage>(&session_file);
     });
+    graph.define("publish", [&publisher]() { return std::make_unique<PublishStage>(&publisher); });
+    if (graph.build(config.value("graph", default_pipeline())) != 0 || graph.start() != 0) {
+        std::cerr << "Failed to build the pipeline." << std::endl;
+        llm.shutdown();
+        asr.shutdown();
+        audio.shutdown();
+        return 1;
+    }
+    std::cout << "Pipeline started successfully." << std::endl;
 
-    asr.setAudio(&audio, [](const std::string& result) {
-        EchoNote::UI::instance().show("asr", result);
-        LLM::instance().refine(result);        
+    // queue depths and backlogs, read when the metrics are exported
+    int collector = Metrics::instance().addCollector([&](Metrics& metrics) {
+        for (const auto& [queue, stats]: graph.stats().items()) {
+            metrics.gauge("voicelint_queue_depth", "Messages waiting in a stage input", 
+                {{"queue", queue}}).set(stats.value("size", 0));
+            metrics.gauge("voicelint_queue_capacity", "Capacity of a stage input", 
+                {{"queue", queue}}).set(stats.value("capacity", 0));
+            metrics.counter("voicelint_queue_blocked_total", "Pushes that waited on a full input", 
+                {{"queue", queue}}).set(stats.value("blocked", 0));
+        }
+        metrics.gauge("voicelint_llm_pending_bytes", "ASR text waiting to be refined")
+            .set(llm.getPendingSize());
+        metrics.counter("voicelint_publish_dropped_subscribers_total", 
+            "Event subscribers dropped for falling behind")
+            .set(publisher.stats().value("dropped", 0));
     });
-    std::cout << "ASR set audio successfully." << std::endl;
 
-    EchoNote::UI::instance().show(config["ui"], &audio, &llm);
+    if (headless) {
+        EchoNote::Headless::instance().run(config.value("headless", 
+            nlohmann::json::object()), &audio, &llm, json_out);
+    } else {
+#ifdef VOICELINT_UI
+        EchoNote::UI::instance().show(config["ui"], &audio, &llm);
+#endif
+    }
 
+    std::string session = session_name();
+    // drains front to back, the llm stage waits for the requests in flight
+    graph.stop();
+    Metrics::instance().removeCollector(collector);
+    publisher.shutdown();
     llm.shutdown();
     std::cout << "LLM shutdown successfully." << std::endl;
     asr.shutdown();
@@ -104,17 +264,29 @@ int main(int argc, char* argv[]) {
     audio.shutdown();
     std::cout << "Audio shutdown successfully." << std::endl;
 
-    std::vector<std::string> files = {
-        audio.getOutFile(),
-        asr.getOutFile(),
-        llm.getRefineOutFile(),
-        llm.getSummarizeOutFile()
-    };
-    if (std::filesystem::file_size(audio.getOutFile())) {
-        save_data(files);
+    bool recorded = session_file.position() > 0;
+    session_file.close();
+
+    std::vector<std::string> files;
+    for (const auto& file: {audio.getOutFile(), asr.getOutFile(), 
+        llm.getRefineOutFile(), llm.getSummarizeOutFile()}) {
+        if (!file.empty() && std::filesystem::exists(file)) files.push_back(file);
+    }
+    if (!audio.getOutFile().empty() && std::filesystem::exists(audio.getOutFile())) {
+        recorded = recorded || std::filesystem::file_size(audio.getOutFile()) > 0;
+    }
+    if (use_session_file) files.push_back(container);
+    if (recorded) {
+        save_data(session, files, use_session_file ? container : "");
         std::cout << "Data saved successfully." << std::endl;
+        SearchIndex index;
+        if (index.init("data") == 0 && index.update() > 0) {
+            std::cout << "Search index updated." << std::endl;
+        }
     }
 
+    Metrics::instance().shutdown();
     std::cout << "main exit!" << std::endl;
+    std::cout.rdbuf(stdout_buf);
     return 0;
 }
\ No newline at end of file
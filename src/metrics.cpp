@@ -0,0 +1,236 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include "httplib.h"
+
+size_t Histogram::index(uint64_t steps) {
+    if (steps < 2 * sub_count) return steps;
+    int exponent = 63 - __builtin_clzll(steps);
+    int shift = exponent - sub_bits;
+    return (shift + 1) * sub_count + ((steps >> shift) - sub_count);
+}
+
+double Histogram::middle(size_t index) {
+    if (index < 2 * sub_count) return double(index);
+    size_t shift = index / sub_count - 1;
+    double lower = double((sub_count + index % sub_count) << shift);
+    return lower + double(uint64_t(1) << shift) / 2;
+}
+
+void Histogram::observe(double value) {
+    double scaled = value / unit;
+    uint64_t steps = scaled <= 0 ? 0 :
+        scaled >= 1.8e19 ? UINT64_MAX : uint64_t(std::llround(scaled));
+    buckets[index(steps)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(steps, std::memory_order_relaxed);
+    uint64_t seen = max.load(std::memory_order_relaxed);
+    while (steps > seen && !max.compare_exchange_weak(seen, steps, std::memory_order_relaxed)) {}
+}
+
+void Histogram::reset() {
+    for (auto& bucket: buckets) bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+// the buckets are read one by one while others record, so the counts may
+// be a few observations apart; fine for a percentile
+Histogram::snapshot_t Histogram::snapshot() const {
+    std::vector<uint64_t> counts(bucket_count);
+    uint64_t total = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    snapshot_t result;
+    result.count = total;
+    result.sum = sum.load(std::memory_order_relaxed) * unit;
+    double top = double(max.load(std::memory_order_relaxed));
+    result.max = top * unit;
+    auto percentile = [&](double p) {
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p * total)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(middle(i), top) * unit;
+        }
+        return top * unit;
+    };
+    if (total > 0) {
+        result.p50 = percentile(0.5);
+        result.p90 = percentile(0.9);
+        result.p99 = percentile(0.99);
+    }
+    return result;
+}
+
+Metrics::Metrics() = default;
+
+Metrics::~Metrics() {
+    shutdown();
+}
+
+int Metrics::init(const nlohmann::json& config) {
+    if (!config.value("enabled", true)) return -1;
+    nlohmann::json http_config = config.value("http", nlohmann::json::object());
+    int port = http_config.value("port", 0);
+    if (port <= 0 || server) return 0;
+    std::string host = http_config.value("host", "127.0.0.1");
+    server = std::make_unique<httplib::Server>();
+    mount(*server);
+    if (!server->bind_to_port(host, port)) {
+        std::cerr << "Failed to listen on " << host << ":" << port << std::endl;
+        server.reset();
+        return -1;
+    }
+    server_thread = std::thread([this]() { server->listen_after_bind(); });
+    std::cout << "Metrics on http://" << host << ":" << port << "/metrics" << std::endl;
+    return 0;
+}
+
+void Metrics::shutdown() {
+    if (server) server->stop();
+    if (server_thread.joinable()) server_thread.join();
+    server.reset();
+}
+
+void Metrics::mount(httplib::Server& server) {
+    server.Get("/metrics", [this](const httplib::Request&, httplib::Response& res) {
+        res.set_content(exposition(), "text/plain; version=0.0.4");
+    });
+}
+
+Metrics::family_t& Metrics::family(const std::string& name, type_t type, 
+    const std::string& help) {
+    auto it = families.find(name);
+    if (it == families.end()) {
+        it = families.emplace(name, family_t()).first;
+        it->second.type = type;
+        it->second.help = help;
+    }
+    return it->second;
+}
+
+std::string Metrics::render(const labels_t& labels) {
+    std::string result;
+    for (const auto& [key, value]: labels) {
+        if (!result.empty()) result += ",";
+        result += key + "=\"";
+        for (char c: value) {
+            if (c == '\\' || c == '"') result += '\\';
+            if (c == '\n') {
+                result += "\\n";
+                continue;
+            }
+            result += c;
+        }
+        result += "\"";
+    }
+    return result;
+}
+
+Counter& Metrics::counter(const std::string& name, const std::string& help, 
+    const labels_t& labels /* = {} */) {
+    std::lock_guard<std::mutex> lk(mtx);
+    auto& slot = family(name, type_counter, help).counters[render(labels)];
+    if (!slot) slot = std::make_unique<Counter>();
+    return *slot;
+}
+
+Gauge& Metrics::gauge(const std::string& name, const std::string& help, 
+    const labels_t& labels /* = {} */) {
+    std::lock_guard<std::mutex> lk(mtx);
+    auto& slot = family(name, type_gauge, help).gauges[render(labels)];
+    if (!slot) slot = std::make_unique<Gauge>();
+    return *slot;
+}
+
+Histogram& Metrics::histogram(const std::string& name, const std::string& help, 
+    const labels_t& labels /* = {} */, double unit /* = 1e-6 */) {
+    std::lock_guard<std::mutex> lk(mtx);
+    auto& slot = family(name, type_histogram, help).histograms[render(labels)];
+    if (!slot) slot = std::make_unique<Histogram>(unit);
+    return *slot;
+}
+
+int Metrics::addCollector(std::function<void(Metrics&)> collector) {
+    std::lock_guard<std::mutex> lk(collectors_mtx);
+    collectors[next_collector] = std::move(collector);
+    return next_collector++;
+}
+
+void Metrics::removeCollector(int id) {
+    std::lock_guard<std::mutex> lk(collectors_mtx);
+    collectors.erase(id);
+}
+
+void Metrics::collect() {
+    std::lock_guard<std::mutex> lk(collectors_mtx);
+    for (auto& [id, collector]: collectors) collector(*this);
+}
+
+void Metrics::reset() {
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto& [name, family]: families) {
+        for (auto& [labels, counter]: family.counters) counter->set(0);
+        for (auto& [labels, histogram]: family.histograms) histogram->reset();
+    }
+}
+
+std::string Metrics::exposition() {
+    collect();
+    std::ostringstream out;
+    out.precision(9);
+    auto series = [](const std::string& name, const std::string& labels, 
+        const std::string& extra = "") {
+        std::string all = labels.empty() ? extra : extra.empty() ? labels : labels + "," + extra;
+        return all.empty() ? name : name + "{" + all + "}";
+    };
+    std::lock_guard<std::mutex> lk(mtx);
+    for (const auto& [name, family]: families) {
+        static const char * types[] = {"counter", "gauge", "summary"};
+        out << "# HELP " << name << " " << family.help << "\n";
+        out << "# TYPE " << name << " " << types[family.type] << "\n";
+        for (const auto& [labels, counter]: family.counters) {
+            out << series(name, labels) << " " << counter->get() << "\n";
+        }
+        for (const auto& [labels, gauge]: family.gauges) {
+            out << series(name, labels) << " " << gauge->get() << "\n";
+        }
+        for (const auto& [labels, histogram]: family.histograms) {
+            auto s = histogram->snapshot();
+            out << series(name, labels, "quantile=\"0.5\"") << " " << s.p50 << "\n";
+            out << series(name, labels, "quantile=\"0.9\"") << " " << s.p90 << "\n";
+            out << series(name, labels, "quantile=\"0.99\"") << " " << s.p99 << "\n";
+            out << series(name + "_sum", labels) << " " << s.sum << "\n";
+            out << series(name + "_count", labels) << " " << s.count << "\n";
+        }
+    }
+    return out.str();
+}
+
+nlohmann::json Metrics::snapshot() {
+    collect();
+    nlohmann::json result = nlohmann::json::object();
+    std::lock_guard<std::mutex> lk(mtx);
+    for (const auto& [name, family]: families) {
+        for (const auto& [labels, counter]: family.counters) {
+            result[labels.empty() ? name : name + "{" + labels + "}"] = counter->get();
+        }
+        for (const auto& [labels, gauge]: family.gauges) {
+            result[labels.empty() ? name : name + "{" + labels + "}"] = gauge->get();
+        }
+        for (const auto& [labels, histogram]: family.histograms) {
+            auto s = histogram->snapshot();
+            result[labels.empty() ? name : name + "{" + labels + "}"] = {
+                {"count", s.count}, {"sum", s.sum}, {"max", s.max},
+                {"p50", s.p50}, {"p90", s.p90}, {"p99", s.p99}
+            };
+        }
+    }
+    return result;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+namespace httplib {
+class Server;
+}
+
+// counters, gauges and latency histograms. Taking a metric from the
+// registry locks, so a hot path keeps the reference it got once;
+// recording is a few relaxed atomic operations and never waits.
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+    // for counts kept elsewhere, copied in by a collector
+    void set(uint64_t n) {
+        value.store(n, std::memory_order_relaxed);
+    }
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value = 0;
+};
+
+class Gauge {
+public:
+    void set(double v) {
+        value.store(v, std::memory_order_relaxed);
+    }
+    void add(double v) {
+        value.fetch_add(v, std::memory_order_relaxed);
+    }
+    double get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<double> value = 0;
+};
+
+// HDR-style buckets: values are counted in steps of unit, exactly up to
+// 64 steps and then in 32 buckets per power of two, so a percentile is
+// off by at most 3% over the whole range of uint64_t
+class Histogram {
+public:
+    // unit: the smallest step in the metric's own unit, e.g. 1e-6 for a
+    // histogram of seconds kept to the microsecond
+    explicit Histogram(double unit = 1e-6) : unit(unit) {}
+
+    void observe(double value);
+    void observe(std::chrono::steady_clock::duration elapsed) {
+        observe(std::chrono::duration<double>(elapsed).count());
+    }
+    void reset();
+
+    typedef struct _snapshot_t {
+        uint64_t count = 0;
+        double sum = 0;
+        double max = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+    } snapshot_t;
+    snapshot_t snapshot() const;
+
+private:
+    static constexpr int sub_bits = 5;
+    static constexpr size_t sub_count = size_t(1) << sub_bits;
+    static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+    const double unit;
+    std::array<std::atomic<uint64_t>, bucket_count> buckets = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0; // in steps
+    std::atomic<uint64_t> max = 0;
+
+    static size_t index(uint64_t steps);
+    // the middle of a bucket, in steps
+    static double middle(size_t index);
+};
+
+class Metrics {
+public:
+    static Metrics& instance() {
+        static Metrics _inst;
+        return _inst;
+    }
+    Metrics(const Metrics&) = delete;
+    Metrics operator=(const Metrics&) = delete;
+
+    typedef std::vector<std::pair<std::string, std::string>> labels_t;
+
+    // config is the "metrics" block: serves /metrics on http.port when set
+    int init(const nlohmann::json& config);
+    void shutdown();
+    // GET /metrics on a server someone else runs
+    void mount(httplib::Server& server);
+
+    // the same name and labels give back the same metric
+    Counter& counter(const std::string& name, const std::string& help, 
+        const labels_t& labels = {});
+    Gauge& gauge(const std::string& name, const std::string& help, 
+        const labels_t& labels = {});
+    Histogram& histogram(const std::string& name, const std::string& help, 
+        const labels_t& labels = {}, double unit = 1e-6);
+
+    // run before every export, to copy in state that lives elsewhere such
+    // as queue depths; remove it before what it reads goes away
+    int addCollector(std::function<void(Metrics&)> collector);
+    void removeCollector(int id);
+
+    // zero the counters and histograms, to compare before and after a change
+    void reset();
+
+    // the Prometheus text format
+    std::string exposition();
+    // name{labels} -> value, or the snapshot of a histogram
+    nlohmann::json snapshot();
+
+private:
+    Metrics();
+    ~Metrics();
+
+    enum type_t { type_counter, type_gauge, type_histogram };
+    typedef struct _family_t {
+        type_t type;
+        std::string help;
+        // rendered labels, e.g. stage="refine"
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    } family_t;
+
+    std::mutex mtx;
+    std::map<std::string, family_t> families;
+    family_t& family(const std::string& name, type_t type, const std::string& help);
+    static std::string render(const labels_t& labels);
+
+    std::mutex collectors_mtx;
+    std::map<int, std::function<void(Metrics&)>> collectors;
+    int next_collector = 0;
+    void collect();
+
+    std::unique_ptr<httplib::Server> server;
+    std::thread server_thread;
+};
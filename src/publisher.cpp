@@ -0,0 +1,329 @@
+#include "publisher.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "httplib.h"
+#include "session_file.h"
+
+static const std::map<std::string, uint16_t> types = {
+    {"asr", SessionFile::chunk_asr},
+    {"refine", SessionFile::chunk_refine},
+    {"summarize", SessionFile::chunk_summary}
+};
+
+static size_t padded(size_t size) {
+    return (size + 7) & ~size_t(7);
+}
+
+ring::Reader::~Reader() {
+    close();
+}
+
+int ring::Reader::open(const std::string& name, bool from_oldest /* = false */) {
+    close();
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << name << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ring_header_t)) {
+        ::close(fd);
+        return -1;
+    }
+    void * addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) return -1;
+    data = static_cast<const char *>(addr);
+    size = st.st_size;
+    header = reinterpret_cast<const ring_header_t *>(data);
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0
+        || sizeof(ring_header_t) + header->capacity > size) {
+        std::cerr << name << " is not a voicelint ring" << std::endl;
+        close();
+        return -1;
+    }
+    pos = from_oldest ? header->tail.load(std::memory_order_acquire)
+        : header->head.load(std::memory_order_acquire);
+    last_seq = from_oldest ? 0 : header->seq.load(std::memory_order_acquire);
+    lost = 0;
+    return 0;
+}
+
+void ring::Reader::close() {
+    if (data) ::munmap(const_cast<char *>(data), size);
+    data = nullptr;
+    header = nullptr;
+    size = 0;
+}
+
+bool ring::Reader::next(record_t& record, std::string& text) {
+    if (!header) return false;
+    const uint64_t capacity = header->capacity;
+    const char * records = data + sizeof(ring_header_t);
+    while (true) {
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (pos >= head) return false;
+        if (header->reserve.load(std::memory_order_acquire) > pos + capacity) {
+            pos = header->tail.load(std::memory_order_acquire); // lapped
+            continue;
+        }
+        uint64_t offset = pos % capacity;
+        if (capacity - offset < sizeof(record)) {
+            pos += capacity - offset; // too short for a padding record
+            continue;
+        }
+        std::memcpy(&record, records + offset, sizeof(record));
+        size_t length = sizeof(record) + padded(record.size);
+        if (record.type != 0 && offset + length <= capacity) {
+            text.assign(records + offset + sizeof(record), record.size);
+        }
+        // the writer may have come round while we copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->reserve.load(std::memory_order_relaxed) > pos + capacity) continue;
+        if (record.type == 0) {
+            pos += capacity - offset;
+            continue;
+        }
+        pos += length;
+        if (last_seq && record.seq > last_seq + 1) lost += record.seq - last_seq - 1;
+        last_seq = record.seq;
+        return true;
+    }
+}
+
+Publisher::~Publisher() {
+    shutdown();
+}
+
+int Publisher::init(const nlohmann::json& config) {
+    if (!config.value("enabled", false)) return -1;
+    history_size = config.value("history", 1024);
+
+    nlohmann::json ring_config = config.value("ring", nlohmann::json::object());
+    ring_name = ring_config.value("name", "/voicelint-events");
+    if (!ring_name.empty()) {
+        size_t capacity = padded(size_t(std::max(ring_config.value("size", 4), 1)) * 1024 * 1024);
+        ring_size = sizeof(ring::ring_header_t) + capacity;
+        // a fresh ring every run, readers still mapping the old one keep it
+        ::shm_unlink(ring_name.c_str());
+        int fd = ::shm_open(ring_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        void * addr = MAP_FAILED;
+        if (fd >= 0 && ::ftruncate(fd, ring_size) == 0) {
+            addr = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (fd >= 0) ::close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "Failed to create " << ring_name << ": " << std::strerror(errno) << std::endl;
+            ring_name.clear();
+        } else {
+            ring_data = static_cast<char *>(addr);
+            header = new (ring_data) ring::ring_header_t();
+            header->version = 1;
+            header->record_align = 8;
+            header->capacity = capacity;
+            header->created = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            // readers check the magic last
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(header->magic, ring::magic, sizeof(ring::magic));
+        }
+    }
+
+    nlohmann::json http_config = config.value("http", nlohmann::json::object());
+    max_pending = std::max(http_config.value("max_pending", 256), 1);
+    int port = http_config.value("port", 0);
+    running = true;
+    if (port > 0) {
+        std::string host = http_config.value("host", "127.0.0.1");
+        server = std::make_unique<httplib::Server>();
+        mount(*server);
+        if (!server->bind_to_port(host, port)) {
+            std::cerr << "Failed to listen on " << host << ":" << port << std::endl;
+            server.reset();
+        } else {
+            server_thread = std::thread([this]() { server->listen_after_bind(); });
+            std::cout << "Publishing events on " << host << ":" << port << std::endl;
+        }
+    }
+    return 0;
+}
+
+void Publisher::shutdown() {
+    if (!running.exchange(false)) return;
+    {
+        // the streams see it on their next wake-up and end
+        std::lock_guard<std::mutex> lk(subscribers_mtx);
+        for (auto& subscriber: subscribers) subscriber->cv.notify_all();
+    }
+    if (server) server->stop();
+    if (server_thread.joinable()) server_thread.join();
+    server.reset();
+    if (ring_data) {
+        ::munmap(ring_data, ring_size);
+        ::shm_unlink(ring_name.c_str());
+    }
+    ring_data = nullptr;
+    header = nullptr;
+}
+
+void Publisher::publish(const std::string& name, const std::string& text, 
+    uint64_t t0, uint64_t t1) {
+    auto type = types.find(name);
+    if (!running || type == types.end()) return;
+    uint64_t n = ++seq;
+    if (header) write_ring(type->second, n, t0, t1, text);
+
+    nlohmann::json event = {{"seq", n}, {"event", name}, {"text", text}, {"t0", t0}, {"t1", t1}};
+    // ASR text is not always valid UTF-8, dump() would throw on it
+    std::string line = event.dump(-1, ' ', false, 
+        nlohmann::json::error_handler_t::replace);
+    event_t frames;
+    frames.seq = n;
+    frames.json = std::make_shared<const std::string>(line + "\n");
+    frames.sse = std::make_shared<const std::string>(
+        "id: " + std::to_string(n) + "\nevent: " + name + "\ndata: " + line + "\n\n");
+
+    std::lock_guard<std::mutex> lk(subscribers_mtx);
+    history.push_back(frames);
+    if (history.size() > history_size) history.pop_front();
+    for (auto it = subscribers.begin(); it != subscribers.end();) {
+        auto& subscriber = *it;
+        {
+            std::lock_guard<std::mutex> sub_lk(subscriber->mtx);
+            if (subscriber->pending.size() >= max_pending) {
+                subscriber->dropped = true;
+                subscriber->pending.clear();
+            } else {
+                subscriber->pending.push_back(subscriber->sse ? frames.sse : frames.json);
+            }
+        }
+        subscriber->cv.notify_one();
+        if (subscriber->dropped) {
+            ++dropped;
+            it = subscribers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// single writer, publish() is called from one stage worker
+void Publisher::write_ring(uint16_t type, uint64_t n, uint64_t t0, uint64_t t1, 
+    const std::string& text) {
+    const uint64_t capacity = header->capacity;
+    size_t size = std::min(text.size(), size_t(capacity / 2));
+    // a cut text ends on a whole UTF-8 character
+    while (size > 0 && size < text.size() && (text[size] & 0xC0) == 0x80) --size;
+    size_t length = sizeof(ring::record_t) + padded(size);
+    char * records = ring_data + sizeof(ring::ring_header_t);
+    uint64_t pos = header->head.load(std::memory_order_relaxed);
+
+    auto reserve = [&](uint64_t end) {
+        header->reserve.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        while (!ring_records.empty() && ring_records.front().first + capacity < end) {
+            ring_records.pop_front();
+        }
+        header->tail.store(ring_records.empty() ? end : ring_records.front().first, 
+            std::memory_order_release);
+    };
+
+    uint64_t offset = pos % capacity;
+    if (offset + length > capacity) {
+        // pad to the end of the ring, the record starts over at 0
+        reserve(pos + capacity - offset);
+        ring::record_t pad = {};
+        if (capacity - offset >= sizeof(pad)) std::memcpy(records + offset, &pad, sizeof(pad));
+        pos += capacity - offset;
+        header->head.store(pos, std::memory_order_release);
+        offset = 0;
+    }
+    reserve(pos + length);
+    ring::record_t record = {};
+    record.size = uint32_t(size);
+    record.type = type;
+    record.seq = n;
+    record.t0 = t0;
+    record.t1 = t1;
+    std::memcpy(records + offset, &record, sizeof(record));
+    std::memcpy(records + offset + sizeof(record), text.data(), size);
+    ring_records.emplace_back(pos, pos + length);
+    header->seq.store(n, std::memory_order_release);
+    header->head.store(pos + length, std::memory_order_release);
+    if (ring_records.size() == 1) header->tail.store(pos, std::memory_order_release);
+}
+
+void Publisher::mount(httplib::Server& server) {
+    // ?format=ndjson for JSON lines instead of server-sent events; resumes
+    // after Last-Event-ID or ?from= while the events are in the history
+    server.Get("/events", [this](const httplib::Request& req, httplib::Response& res) {
+        auto subscriber = std::make_shared<subscriber_t>();
+        subscriber->sse = req.get_param_value("format") != "ndjson";
+        uint64_t from = 0;
+        if (req.has_header("Last-Event-ID")) {
+            from = std::strtoull(req.get_header_value("Last-Event-ID").c_str(), nullptr, 10);
+        } else if (req.has_param("from")) {
+            from = std::strtoull(req.get_param_value("from").c_str(), nullptr, 10);
+        }
+        {
+            std::lock_guard<std::mutex> lk(subscribers_mtx);
+            for (const auto& event: history) {
+                if (from && event.seq > from) {
+                    subscriber->pending.push_back(subscriber->sse ? event.sse : event.json);
+                }
+            }
+            subscribers.push_back(subscriber);
+        }
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider(subscriber->sse ? "text/event-stream" : "application/x-ndjson", 
+            [this, subscriber](size_t, httplib::DataSink& sink) {
+            std::deque<frame_t> frames;
+            bool dropped = false;
+            {
+                std::unique_lock<std::mutex> lk(subscriber->mtx);
+                subscriber->cv.wait_for(lk, std::chrono::seconds(15), [&] {
+                    return !running || subscriber->dropped || !subscriber->pending.empty();
+                });
+                frames.swap(subscriber->pending);
+                dropped = subscriber->dropped;
+            }
+            if (dropped || !running) {
+                sink.done();
+                return true;
+            }
+            if (frames.empty()) {
+                // a comment, so a reader that went away is noticed
+                static const std::string keepalive = ": keepalive\n\n";
+                return subscriber->sse ? sink.write(keepalive.data(), keepalive.size())
+                    : sink.is_writable();
+            }
+            for (const auto& frame: frames) {
+                if (!sink.write(frame->data(), frame->size())) return false;
+            }
+            return true;
+        }, [this, subscriber](bool) {
+            std::lock_guard<std::mutex> lk(subscribers_mtx);
+            subscribers.remove(subscriber);
+        });
+    });
+}
+
+nlohmann::json Publisher::stats() {
+    std::lock_guard<std::mutex> lk(subscribers_mtx);
+    return {
+        {"seq", seq.load()},
+        {"subscribers", subscribers.size()},
+        {"dropped", dropped},
+        {"ring", ring_name},
+        {"ring_head", header ? header->head.load() : 0}
+    };
+}
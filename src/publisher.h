@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <nlohmann/json.hpp>
+
+namespace httplib {
+class Server;
+}
+
+// the ring a Publisher writes into shared memory, "/dev/shm/<name>". One
+// writer; readers map it read-only and never hold the writer up, a reader
+// that falls a whole ring behind skips to the oldest record left.
+//
+//   ring_header_t, then capacity bytes of records: record_t, the text,
+//   padding to 8 bytes. A record never wraps, the end of the ring is filled
+//   with a record of type 0 instead.
+//
+// Positions count bytes written since the ring was created. The writer
+// moves reserve before writing a record and head after it, so a reader
+// that copied a record at pos knows it is intact when reserve is still
+// at most pos + capacity afterwards.
+namespace ring {
+static const char magic[8] = {'V', 'L', 'R', 'I', 'N', 'G', '1', '\0'};
+
+typedef struct _ring_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_align; // 8
+    uint64_t capacity; // bytes of records after the header
+    uint64_t created; // unix ms, a new writer means a new ring
+    std::atomic<uint64_t> reserve;
+    std::atomic<uint64_t> head; // records before it are complete
+    std::atomic<uint64_t> tail; // the oldest complete record
+    std::atomic<uint64_t> seq; // of the last record
+} ring_header_t;
+
+// type: SessionFile chunk types, 2 asr, 3 refine, 4 summary; 0 padding
+typedef struct _record_t {
+    uint32_t size; // of the text
+    uint16_t type;
+    uint16_t flags;
+    uint64_t seq; // 1, 2, ...; a gap means records were lost
+    uint64_t t0; // ms of audio
+    uint64_t t1;
+} record_t;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, 
+    "the ring is shared between processes");
+
+// for consumers: follows a ring from the record after the last one
+// written, or from the oldest one still in it
+class Reader {
+public:
+    Reader() = default;
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader operator=(const Reader&) = delete;
+
+    int open(const std::string& name, bool from_oldest = false);
+    void close();
+    // the next record, false when there is none yet; lost counts the
+    // records that were overwritten before they were read
+    bool next(record_t& record, std::string& text);
+    uint64_t getLost() const {
+        return lost;
+    }
+
+private:
+    const char * data = nullptr;
+    size_t size = 0;
+    const ring_header_t * header = nullptr;
+    uint64_t pos = 0;
+    uint64_t last_seq = 0;
+    uint64_t lost = 0;
+};
+}
+
+// live results for other programs: a shared-memory ring for consumers on
+// the same host and, over HTTP, a server-sent event stream. Every event
+// gets the next sequence number. A subscriber that lets max_pending
+// events pile up is disconnected, publish() never waits for anyone.
+class Publisher {
+public:
+    Publisher() = default;
+    ~Publisher();
+    Publisher(const Publisher&) = delete;
+    Publisher operator=(const Publisher&) = delete;
+
+    // config is the "publish" block; -1 when disabled
+    int init(const nlohmann::json& config);
+    void shutdown();
+
+    // name: "asr", "refine", "summarize"; other names are not published.
+    // One thread at a time, the ring has a single writer.
+    void publish(const std::string& name, const std::string& text, 
+        uint64_t t0, uint64_t t1);
+
+    // GET /events on a server someone else runs; init() does it on its own
+    // server when http.port is set
+    void mount(httplib::Server& server);
+
+    uint64_t getSeq() const {
+        return seq;
+    }
+    nlohmann::json stats();
+
+private:
+    std::atomic<bool> running = false;
+    std::atomic<uint64_t> seq = 0;
+
+    // shared memory
+    std::string ring_name;
+    char * ring_data = nullptr;
+    size_t ring_size = 0;
+    ring::ring_header_t * header = nullptr;
+    std::deque<std::pair<uint64_t, uint64_t>> ring_records; // pos and end, to move tail
+    void write_ring(uint16_t type, uint64_t seq, uint64_t t0, uint64_t t1, 
+        const std::string& text);
+
+    // event streams; a frame is encoded once and shared by the subscribers
+    typedef std::shared_ptr<const std::string> frame_t;
+    typedef struct _subscriber_t {
+        bool sse = true; // or JSON lines
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<frame_t> pending;
+        bool dropped = false;
+    } subscriber_t;
+
+    typedef struct _event_t {
+        uint64_t seq;
+        frame_t sse;
+        frame_t json;
+    } event_t;
+
+    std::mutex subscribers_mtx;
+    std::list<std::shared_ptr<subscriber_t>> subscribers;
+    std::deque<event_t> history; // for a subscriber resuming after a gap
+    size_t history_size = 1024;
+    size_t max_pending = 256;
+    uint64_t dropped = 0;
+
+    std::unique_ptr<httplib::Server> server;
+    std::thread server_thread;
+};
@@ -0,0 +1,603 @@
+#include "search.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string_view>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+// segment file: header, then the session, doc and term tables, the string
+// pool (session names and terms) and the postings, each table 8-byte
+// aligned so the mapped file is read in place
+static const char segment_magic[8] = {'V', 'L', 'I', 'D', 'X', '0', '1', '\0'};
+static const char * field_names[] = {"asr", "refine", "summarize"};
+static const char * field_files[] = {"asr.txt", "refine.txt", "summarize.txt"};
+static const double bm25_k1 = 1.2;
+static const double bm25_b = 0.75;
+
+typedef struct _header_t {
+    char magic[8];
+    uint32_t n_sessions;
+    uint32_t n_docs;
+    uint32_t n_terms;
+    uint32_t reserved;
+    uint64_t total_length; // tokens in all docs
+    uint64_t sessions_offset;
+    uint64_t docs_offset;
+    uint64_t terms_offset;
+    uint64_t strings_offset;
+    uint64_t postings_offset;
+} header_t;
+
+typedef struct _session_entry_t {
+    uint32_t name_offset; // in the string pool
+    uint32_t name_size;
+} session_entry_t;
+
+// a line of a session file
+typedef struct _doc_entry_t {
+    uint32_t session;
+    uint32_t field;
+    uint32_t length; // tokens
+    uint32_t size; // bytes
+    uint64_t offset; // in the file
+} doc_entry_t;
+
+typedef struct _term_entry_t {
+    uint32_t offset; // in the string pool
+    uint32_t size;
+    uint32_t df;
+    uint32_t postings_size;
+    uint64_t postings_offset;
+} term_entry_t;
+
+static void put_varint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out += char(value | 0x80);
+        value >>= 7;
+    }
+    out += char(value);
+}
+
+static uint32_t get_varint(const uint8_t *& p, const uint8_t * end) {
+    uint32_t value = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t byte = *p++;
+        value |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return value;
+}
+
+template <typename T>
+static void put_table(std::string& out, const std::vector<T>& table) {
+    out.append(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(T));
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+static uint32_t next_codepoint(const std::string& text, size_t& pos) {
+    unsigned char c = text[pos];
+    int n = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    uint32_t cp = n == 3 ? c & 0x07 : n == 2 ? c & 0x0F : n == 1 ? c & 0x1F : c;
+    if (pos + n >= text.size()) n = 0;
+    for (int i = 1; i <= n; ++i) cp = (cp << 6) | (text[pos + i] & 0x3F);
+    pos += n + 1;
+    return cp;
+}
+
+// Han, kana and Hangul have no spaces between words
+static bool is_cjk(uint32_t cp) {
+    return (cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0x3400 && cp <= 0x9FFF)
+        || (cp >= 0xAC00 && cp <= 0xD7AF) || (cp >= 0xF900 && cp <= 0xFAFF)
+        || (cp >= 0x20000 && cp <= 0x2FFFF);
+}
+
+static std::string strip_tags(const std::string& text) {
+    std::string result;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t tag = text.find("<|", pos);
+        size_t end = tag == std::string::npos ? tag : text.find("|>", tag + 2);
+        if (end == std::string::npos) {
+            result.append(text, pos);
+            break;
+        }
+        result.append(text, pos, tag - pos);
+        pos = end + 2;
+    }
+    return result;
+}
+
+std::vector<std::string> SearchIndex::tokenize(const std::string& raw) {
+    std::vector<std::string> tokens;
+    std::string text = strip_tags(raw);
+    std::string word;
+    std::string previous; // last CJK character of the current run
+    int run = 0;
+    auto end_run = [&]() {
+        if (run == 1) tokens.push_back(previous);
+        previous.clear();
+        run = 0;
+    };
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t start = pos;
+        uint32_t cp = next_codepoint(text, pos);
+        if (cp < 0x80 && std::isalnum(int(cp))) {
+            end_run();
+            word += char(std::tolower(int(cp)));
+            continue;
+        }
+        if (!word.empty()) {
+            tokens.push_back(word);
+            word.clear();
+        }
+        if (!is_cjk(cp)) {
+            end_run();
+            continue;
+        }
+        std::string character = text.substr(start, pos - start);
+        if (run > 0) tokens.push_back(previous + character);
+        previous = character;
+        ++run;
+    }
+    if (!word.empty()) tokens.push_back(word);
+    end_run();
+    return tokens;
+}
+
+SearchIndex::_segment_t::~_segment_t() {
+    if (data) ::munmap(const_cast<uint8_t *>(data), size);
+}
+
+SearchIndex::~SearchIndex() {
+    shutdown();
+}
+
+int SearchIndex::init(const std::string& root /* = "data" */) {
+    this->root = root;
+    index_path = root + "/.index";
+    std::error_code ec;
+    std::filesystem::create_directories(index_path, ec);
+    if (ec) {
+        std::cerr << "Failed to create " << index_path << ": " << ec.message() << std::endl;
+        return -1;
+    }
+    return reload();
+}
+
+int SearchIndex::shutdown() {
+    if (!running.exchange(false)) return 0;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        cv.notify_all();
+    }
+    if (worker.joinable()) {
+        worker.join();
+    }
+    return 0;
+}
+
+// the manifest may have been rewritten by another process since the last
+// look; segments already mapped are kept
+int SearchIndex::reload() {
+    nlohmann::json manifest = nlohmann::json::object();
+    std::ifstream file(index_path + "/manifest.json");
+    if (file.is_open()) {
+        try {
+            file >> manifest;
+        } catch (const std::exception& e) {
+            std::cerr << "Broken search index manifest: " << e.what() << std::endl;
+            manifest = nlohmann::json::object();
+        }
+    }
+    std::shared_ptr<const segments_t> current;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        current = segments;
+    }
+    auto list = std::make_shared<segments_t>();
+    for (const auto& filename: manifest.value("segments", std::vector<std::string>())) {
+        auto it = std::find_if(current->begin(), current->end(), 
+            [&](const auto& segment) { return segment->filename == filename; });
+        auto segment = it != current->end() ? *it : open_segment(filename);
+        if (segment) list->push_back(segment);
+    }
+    std::lock_guard<std::mutex> lk(mtx);
+    next_segment = std::max(next_segment, manifest.value("next", 1u));
+    segments = list;
+    return 0;
+}
+
+std::shared_ptr<const SearchIndex::segment_t> SearchIndex::open_segment(
+    const std::string& filename) {
+    std::string path = index_path + "/" + filename;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(header_t)) {
+        ::close(fd);
+        return nullptr;
+    }
+    auto segment = std::make_shared<segment_t>();
+    segment->filename = filename;
+    segment->size = st.st_size;
+    void * data = ::mmap(nullptr, segment->size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    segment->data = static_cast<const uint8_t *>(data);
+
+    auto header = reinterpret_cast<const header_t *>(segment->data);
+    bool valid = std::memcmp(header->magic, segment_magic, sizeof(segment_magic)) == 0
+        && header->sessions_offset + header->n_sessions * sizeof(session_entry_t) <= segment->size
+        && header->docs_offset + header->n_docs * sizeof(doc_entry_t) <= segment->size
+        && header->terms_offset + header->n_terms * sizeof(term_entry_t) <= segment->size
+        && header->strings_offset <= segment->size
+        && header->postings_offset <= segment->size;
+    if (!valid) {
+        std::cerr << "Ignoring broken search index segment " << filename << std::endl;
+        return nullptr;
+    }
+    return segment;
+}
+
+std::vector<std::string> SearchIndex::sessions_of(const segment_t& segment) {
+    auto header = reinterpret_cast<const header_t *>(segment.data);
+    auto entries = reinterpret_cast<const session_entry_t *>(
+        segment.data + header->sessions_offset);
+    auto strings = reinterpret_cast<const char *>(segment.data + header->strings_offset);
+    std::vector<std::string> sessions;
+    for (uint32_t i = 0; i < header->n_sessions; ++i) {
+        sessions.emplace_back(strings + entries[i].name_offset, entries[i].name_size);
+    }
+    return sessions;
+}
+
+int SearchIndex::write_segment(const std::vector<std::string>& sessions, 
+    const std::string& filename) {
+    std::vector<session_entry_t> session_entries;
+    std::vector<doc_entry_t> docs;
+    std::string strings;
+    std::map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> postings;
+    uint64_t total_length = 0;
+
+    for (uint32_t s = 0; s < sessions.size(); ++s) {
+        session_entries.push_back({uint32_t(strings.size()), uint32_t(sessions[s].size())});
+        strings += sessions[s];
+        for (uint32_t f = 0; f < 3; ++f) {
+            std::ifstream file(root + "/" + sessions[s] + "/" + field_files[f], 
+                std::ios::binary);
+            if (!file.is_open()) continue;
+            std::string content((std::istreambuf_iterator<char>(file)), 
+                std::istreambuf_iterator<char>());
+            size_t offset = 0;
+            while (offset < content.size()) {
+                size_t eol = content.find('\n', offset);
+                if (eol == std::string::npos) eol = content.size();
+                auto tokens = tokenize(content.substr(offset, eol - offset));
+                if (!tokens.empty()) {
+                    uint32_t doc = docs.size();
+                    std::unordered_map<std::string, uint32_t> tf;
+                    for (const auto& token: tokens) ++tf[token];
+                    for (const auto& [term, n]: tf) postings[term].push_back({doc, n});
+                    docs.push_back({s, f, uint32_t(tokens.size()), 
+                        uint32_t(eol - offset), offset});
+                    total_length += tokens.size();
+                }
+                offset = eol + 1;
+            }
+        }
+    }
+
+    std::vector<term_entry_t> terms;
+    std::string postings_blob;
+    for (const auto& [term, list]: postings) {
+        term_entry_t entry = {uint32_t(strings.size()), uint32_t(term.size()),
+            uint32_t(list.size()), 0, postings_blob.size()};
+        strings += term;
+        uint32_t previous = 0;
+        for (const auto& [doc, n]: list) {
+            put_varint(postings_blob, doc - previous);
+            put_varint(postings_blob, n);
+            previous = doc;
+        }
+        entry.postings_size = postings_blob.size() - entry.postings_offset;
+        terms.push_back(entry);
+    }
+
+    header_t header = {};
+    std::memcpy(header.magic, segment_magic, sizeof(segment_magic));
+    header.n_sessions = session_entries.size();
+    header.n_docs = docs.size();
+    header.n_terms = terms.size();
+    header.total_length = total_length;
+    std::string out(sizeof(header_t), '\0');
+    header.sessions_offset = out.size();
+    put_table(out, session_entries);
+    header.docs_offset = out.size();
+    put_table(out, docs);
+    header.terms_offset = out.size();
+    put_table(out, terms);
+    header.strings_offset = out.size();
+    out += strings;
+    out.append((8 - out.size() % 8) % 8, '\0');
+    header.postings_offset = out.size();
+    out += postings_blob;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::string path = index_path + "/" + filename;
+    {
+        std::ofstream file(path + ".tmp", std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write(out.data(), out.size())) {
+            std::cerr << "Failed to write search index segment " << path << std::endl;
+            return -1;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(path + ".tmp", path, ec);
+    return ec ? -1 : 0;
+}
+
+int SearchIndex::write_manifest(const segments_t& list) {
+    nlohmann::json manifest;
+    manifest["segments"] = nlohmann::json::array();
+    for (const auto& segment: list) manifest["segments"].push_back(segment->filename);
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        manifest["next"] = next_segment;
+    }
+    std::string path = index_path + "/manifest.json";
+    {
+        std::ofstream file(path + ".tmp", std::ios::trunc);
+        if (!file.is_open()) return -1;
+        file << manifest.dump(4);
+    }
+    std::error_code ec;
+    std::filesystem::rename(path + ".tmp", path, ec);
+    return ec ? -1 : 0;
+}
+
+// sessions are archived by renaming a finished directory into place, so
+// any directory that is not hidden is complete
+int SearchIndex::update() {
+    std::lock_guard<std::mutex> update_lk(update_mtx);
+    // another process archiving a session updates the same index
+    int lock_fd = ::open((index_path + "/lock").c_str(), O_CREAT | O_RDWR, 0644);
+    if (lock_fd < 0 || ::flock(lock_fd, LOCK_EX) != 0) {
+        if (lock_fd >= 0) ::close(lock_fd);
+        std::cerr << "Failed to lock the search index." << std::endl;
+        return -1;
+    }
+    auto unlock = [lock_fd]() {
+        ::flock(lock_fd, LOCK_UN);
+        ::close(lock_fd);
+    };
+    reload();
+
+    std::shared_ptr<const segments_t> current;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        current = segments;
+    }
+    std::set<std::string> indexed;
+    for (const auto& segment: *current) {
+        for (auto& session: sessions_of(*segment)) indexed.insert(session);
+    }
+    std::vector<std::string> fresh;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(root, ec);
+        !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (it->is_directory(ec) && name[0] != '.' && !indexed.count(name)) {
+            fresh.push_back(name);
+        }
+    }
+    if (fresh.empty()) {
+        unlock();
+        return 0;
+    }
+    std::sort(fresh.begin(), fresh.end());
+
+    // one new segment per update; past max_segments everything is
+    // rebuilt into a single segment
+    auto list = std::make_shared<segments_t>(*current);
+    std::vector<std::string> sessions = fresh;
+    if (list->size() + 1 > max_segments) {
+        sessions.insert(sessions.end(), indexed.begin(), indexed.end());
+        list->clear();
+    }
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "seg-%06u.idx", next_segment++);
+        filename = buf;
+    }
+    std::shared_ptr<const segment_t> segment;
+    if (write_segment(sessions, filename) != 0
+        || !(segment = open_segment(filename))) {
+        unlock();
+        return -1;
+    }
+    list->push_back(segment);
+    if (write_manifest(*list) != 0) {
+        std::cerr << "Failed to write the search index manifest." << std::endl;
+        unlock();
+        return -1;
+    }
+    // merged segments stay mapped until the last search using them ends
+    for (const auto& old: *current) {
+        if (std::find(list->begin(), list->end(), old) == list->end()) {
+            std::filesystem::remove(index_path + "/" + old->filename, ec);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        segments = list;
+    }
+    unlock();
+    return fresh.size();
+}
+
+void SearchIndex::refresh() {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!running.exchange(true)) {
+        worker = std::thread(&SearchIndex::refresh_worker, this);
+    }
+    update_pending = true;
+    cv.notify_all();
+}
+
+void SearchIndex::refresh_worker() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cv.wait(lk, [this] { return update_pending || !running; });
+            if (!running) break;
+            update_pending = false;
+        }
+        int added = update();
+        if (added > 0) {
+            std::cout << "Search index: " << added << " sessions added." << std::endl;
+        }
+    }
+}
+
+std::vector<SearchIndex::hit_t> SearchIndex::search(const std::string& query, 
+    int limit /* = 50 */) {
+    auto tokens = tokenize(query);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    if (tokens.empty()) return {};
+
+    std::shared_ptr<const segments_t> current;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        current = segments;
+    }
+    auto find_term = [](const segment_t& segment, const std::string& token)
+        -> const term_entry_t * {
+        auto header = reinterpret_cast<const header_t *>(segment.data);
+        auto terms = reinterpret_cast<const term_entry_t *>(
+            segment.data + header->terms_offset);
+        auto strings = reinterpret_cast<const char *>(segment.data + header->strings_offset);
+        auto it = std::lower_bound(terms, terms + header->n_terms, token, 
+            [strings](const term_entry_t& term, const std::string& value) {
+                return std::string_view(strings + term.offset, term.size) < value;
+            });
+        if (it == terms + header->n_terms
+            || std::string_view(strings + it->offset, it->size) != token) {
+            return nullptr;
+        }
+        return it;
+    };
+
+    // corpus statistics over all segments
+    uint64_t n_docs = 0;
+    uint64_t total_length = 0;
+    std::vector<uint64_t> df(tokens.size(), 0);
+    for (const auto& segment: *current) {
+        auto header = reinterpret_cast<const header_t *>(segment->data);
+        n_docs += header->n_docs;
+        total_length += header->total_length;
+        for (size_t t = 0; t < tokens.size(); ++t) {
+            if (auto term = find_term(*segment, tokens[t])) df[t] += term->df;
+        }
+    }
+    if (n_docs == 0) return {};
+    double average_length = double(total_length) / n_docs;
+
+    // best line per session
+    typedef struct _best_t {
+        double score = 0;
+        const segment_t * segment = nullptr;
+        uint32_t doc = 0;
+    } best_t;
+    std::unordered_map<std::string, best_t> best;
+    for (const auto& segment: *current) {
+        auto header = reinterpret_cast<const header_t *>(segment->data);
+        auto docs = reinterpret_cast<const doc_entry_t *>(segment->data + header->docs_offset);
+        auto sessions = reinterpret_cast<const session_entry_t *>(
+            segment->data + header->sessions_offset);
+        auto strings = reinterpret_cast<const char *>(segment->data + header->strings_offset);
+        std::vector<double> scores(header->n_docs, 0.0);
+        std::vector<uint32_t> matched;
+        for (size_t t = 0; t < tokens.size(); ++t) {
+            auto term = find_term(*segment, tokens[t]);
+            if (!term) continue;
+            double idf = std::log(1.0 + (n_docs - df[t] + 0.5) / (df[t] + 0.5));
+            const uint8_t * p = segment->data + header->postings_offset + term->postings_offset;
+            const uint8_t * end = std::min(p + term->postings_size, segment->data + segment->size);
+            uint32_t doc = 0;
+            while (p < end) {
+                doc += get_varint(p, end);
+                uint32_t tf = get_varint(p, end);
+                if (doc >= header->n_docs) break;
+                double norm = 1.0 - bm25_b + bm25_b * docs[doc].length / average_length;
+                if (scores[doc] == 0.0) matched.push_back(doc);
+                scores[doc] += idf * tf * (bm25_k1 + 1.0) / (tf + bm25_k1 * norm);
+            }
+        }
+        // the best line of each session in this segment first
+        std::unordered_map<uint32_t, uint32_t> session_best;
+        for (uint32_t doc: matched) {
+            auto it = session_best.try_emplace(docs[doc].session, doc).first;
+            if (scores[doc] > scores[it->second]) it->second = doc;
+        }
+        for (const auto& [session_id, doc]: session_best) {
+            const auto& entry = sessions[session_id];
+            std::string session(strings + entry.name_offset, entry.name_size);
+            auto& current_best = best[session];
+            if (scores[doc] > current_best.score) {
+                current_best = {scores[doc], segment.get(), doc};
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, best_t>> ranked(best.begin(), best.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second.score != b.second.score ? a.second.score > b.second.score :
+            a.first > b.first;
+    });
+    if (ranked.size() > size_t(limit)) ranked.resize(limit);
+
+    std::vector<hit_t> hits;
+    for (const auto& [session, hit]: ranked) {
+        auto header = reinterpret_cast<const header_t *>(hit.segment->data);
+        const auto& doc = reinterpret_cast<const doc_entry_t *>(
+            hit.segment->data + header->docs_offset)[hit.doc];
+        std::ifstream file(root + "/" + session + "/" + field_files[doc.field], 
+            std::ios::binary);
+        std::string line(doc.size, '\0');
+        if (!file.is_open() || !file.seekg(doc.offset) || !file.read(line.data(), doc.size)) {
+            continue;
+        }
+        line = strip_tags(line);
+        // a window around the first query token found in the line
+        std::string lower = line;
+        for (auto& c: lower) c = std::tolower((unsigned char)c);
+        size_t match = std::string::npos;
+        for (const auto& token: tokens) match = std::min(match, lower.find(token));
+        if (match == std::string::npos) match = 0;
+        size_t start = match > 45 ? match - 45 : 0;
+        size_t end = std::min(line.size(), match + 105);
+        while (start > 0 && (line[start] & 0xC0) == 0x80) --start;
+        while (end < line.size() && (line[end] & 0xC0) == 0x80) ++end;
+        std::string snippet = line.substr(start, end - start);
+        if (start > 0) snippet = "..." + snippet;
+        if (end < line.size()) snippet += "...";
+        hits.push_back({session, field_names[doc.field], snippet, hit.score});
+    }
+    return hits;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// full-text index over the archived sessions under data/. Every line of
+// asr.txt, refine.txt and summarize.txt is a document; CJK text is indexed
+// as character bigrams and Latin text as lowercase words. The index lives
+// in data/.index as immutable segments (one per update, merged when there
+// are too many) that are memory-mapped for search; posting lists are
+// varint-coded doc id deltas and term frequencies.
+class SearchIndex {
+public:
+    SearchIndex() = default;
+    ~SearchIndex();
+    SearchIndex(const SearchIndex&) = delete;
+    SearchIndex operator=(const SearchIndex&) = delete;
+
+    typedef struct _hit_t {
+        std::string session;
+        std::string field; // "asr", "refine" or "summarize"
+        std::string snippet; // the best matching line around the match
+        double score = 0;
+    } hit_t;
+
+    // open the segments listed in root/.index/manifest.json
+    int init(const std::string& root = "data");
+    int shutdown();
+
+    // index the sessions not indexed yet, returns the number added or -1
+    int update();
+    // update() on a background thread
+    void refresh();
+
+    // BM25 over the lines, best line per session, best sessions first
+    std::vector<hit_t> search(const std::string& query, int limit = 50);
+
+    static std::vector<std::string> tokenize(const std::string& text);
+
+private:
+    typedef struct _segment_t {
+        std::string filename;
+        const uint8_t * data = nullptr;
+        size_t size = 0;
+        ~_segment_t();
+    } segment_t;
+    typedef std::vector<std::shared_ptr<const segment_t>> segments_t;
+
+    std::string root = "data";
+    std::string index_path = "data/.index";
+    const size_t max_segments = 8; // merged into one beyond this
+    uint32_t next_segment = 1;
+
+    std::mutex mtx; // guards segments and next_segment
+    std::shared_ptr<const segments_t> segments = std::make_shared<segments_t>();
+    std::mutex update_mtx; // one update at a time
+
+    std::atomic<bool> running = false;
+    bool update_pending = false;
+    std::thread worker;
+    std::condition_variable cv;
+    void refresh_worker();
+
+    int reload();
+    std::shared_ptr<const segment_t> open_segment(const std::string& filename);
+    int write_segment(const std::vector<std::string>& sessions, 
+        const std::string& filename);
+    int write_manifest(const segments_t& list);
+    static std::vector<std::string> sessions_of(const segment_t& segment);
+};
@@ -0,0 +1,374 @@
+#include "semantic.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sys/file.h>
+#include <unistd.h>
+
+// paragraphs are cut at line breaks, and long lines at the first sentence
+// end past this many bytes, about 200 CJK characters, which keeps them
+// inside the model's window
+static const size_t paragraph_bytes = 600;
+static const size_t min_paragraph_bytes = 8;
+
+SemanticIndex::~SemanticIndex() {
+    shutdown();
+}
+
+int SemanticIndex::init(const nlohmann::json& config, 
+    const std::string& root /* = "data" */) {
+    if (!config.value("enabled", false)) return -1;
+    this->root = root;
+    index_path = root + "/.semantic";
+    M = config.value("M", 16);
+    ef_construction = config.value("ef_construction", 200);
+    ef_search = config.value("ef_search", 64);
+    batch_size = std::max(1, config.value("batch_size", 32));
+    threads = std::max(1, config.value("threads", 2));
+
+    std::error_code ec;
+    std::filesystem::create_directories(index_path, ec);
+    if (ec) {
+        std::cerr << "Failed to create " << index_path << ": " << ec.message() << std::endl;
+        return -1;
+    }
+    if (embedder.init(config) != 0) {
+        std::cerr << "Semantic search disabled." << std::endl;
+        return -1;
+    }
+    load();
+    return 0;
+}
+
+int SemanticIndex::shutdown() {
+    stopping = true;
+    if (running.exchange(false)) {
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            cv.notify_all();
+        }
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    // waits for a synchronous update() to notice
+    std::lock_guard<std::mutex> update_lk(update_mtx);
+    embedder.shutdown();
+    return 0;
+}
+
+// the manifest is written last and carries the document count, so a graph
+// or table from an interrupted save is detected and the index rebuilt
+int SemanticIndex::load() {
+    std::shared_ptr<HNSW> loaded;
+    std::vector<std::string> list;
+    std::vector<doc_t> table;
+    int ret = 0;
+    std::ifstream file(index_path + "/manifest.json");
+    if (file.is_open()) {
+        nlohmann::json manifest = nlohmann::json::object();
+        try {
+            file >> manifest;
+            list = manifest.value("sessions", std::vector<std::string>());
+            table.resize(manifest.value("docs", size_t(0)));
+        } catch (const std::exception& e) {
+            std::cerr << "Semantic index manifest unreadable: " << e.what() << std::endl;
+            ret = -1;
+        }
+        std::ifstream docs_file(index_path + "/docs.bin", std::ios::binary);
+        if (ret == 0 && !table.empty()) {
+            loaded = std::make_shared<HNSW>();
+            if (!docs_file.read(reinterpret_cast<char *>(table.data()), 
+                table.size() * sizeof(doc_t))
+                || loaded->load(index_path + "/index.hnsw") != 0
+                || loaded->size() != table.size()) {
+                std::cerr << "Semantic index is incomplete, rebuilding." << std::endl;
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            loaded.reset();
+            list.clear();
+            table.clear();
+        }
+    }
+    std::lock_guard<std::mutex> lk(mtx);
+    graph = std::move(loaded);
+    sessions = std::move(list);
+    docs = std::move(table);
+    return ret;
+}
+
+int SemanticIndex::save() {
+    std::shared_ptr<HNSW> current;
+    std::vector<doc_t> table;
+    nlohmann::json manifest = nlohmann::json::object();
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        current = graph;
+        table = docs;
+        manifest["sessions"] = sessions;
+        manifest["docs"] = docs.size();
+    }
+    if (current && current->save(index_path + "/index.hnsw") != 0) return -1;
+
+    auto replace = [](const std::string& path, const char * data, size_t size) {
+        const std::string tmp = path + ".tmp";
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open() || !out.write(data, size)) return false;
+        out.close();
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    };
+    const std::string text = manifest.dump();
+    if (!replace(index_path + "/docs.bin", 
+        reinterpret_cast<const char *>(table.data()), table.size() * sizeof(doc_t))
+        || !replace(index_path + "/manifest.json", text.data(), text.size())) {
+        std::cerr << "Failed to save the semantic index." << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+std::vector<SemanticIndex::doc_t> SemanticIndex::paragraphs(const std::string& text, 
+    uint32_t session) {
+    std::vector<doc_t> list;
+    auto add = [&](size_t begin, size_t end) {
+        while (begin < end && std::isspace((unsigned char)text[begin])) ++begin;
+        while (end > begin && std::isspace((unsigned char)text[end - 1])) --end;
+        if (end - begin >= min_paragraph_bytes) {
+            list.push_back({session, uint32_t(end - begin), begin});
+        }
+    };
+    static const char * sentence_ends[] = {"。", "！", "？", ".", "!", "?"};
+    size_t begin = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            add(begin, i);
+            begin = i + 1;
+            continue;
+        }
+        if (i - begin < paragraph_bytes) continue;
+        for (const char * mark: sentence_ends) {
+            size_t n = std::strlen(mark);
+            if (text.compare(i, n, mark) == 0) {
+                add(begin, i + n);
+                begin = i + n;
+                i += n - 1;
+                break;
+            }
+        }
+    }
+    add(begin, text.size());
+    return list;
+}
+
+// sessions are archived by renaming a finished directory into place, so
+// any directory that is not hidden is complete
+int SemanticIndex::update() {
+    std::lock_guard<std::mutex> update_lk(update_mtx);
+    if (!embedder.ready() || stopping) return -1;
+    int lock_fd = ::open((index_path + "/lock").c_str(), O_CREAT | O_RDWR, 0644);
+    if (lock_fd < 0 || ::flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        // another instance is embedding, it will save what it did
+        if (lock_fd >= 0) ::close(lock_fd);
+        return 0;
+    }
+    auto unlock = [lock_fd]() {
+        ::flock(lock_fd, LOCK_UN);
+        ::close(lock_fd);
+    };
+    load();
+
+    std::set<std::string> indexed;
+    uint32_t first_session;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        indexed.insert(sessions.begin(), sessions.end());
+        first_session = sessions.size();
+    }
+    std::vector<std::string> fresh;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(root, ec);
+        !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (it->is_directory(ec) && name[0] != '.' && !indexed.count(name)) {
+            fresh.push_back(name);
+        }
+    }
+    if (fresh.empty()) {
+        unlock();
+        return 0;
+    }
+    std::sort(fresh.begin(), fresh.end());
+
+    // only the offsets are kept once the texts are embedded
+    std::vector<doc_t> pending;
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < fresh.size(); ++i) {
+        std::ifstream file(root + "/" + fresh[i] + "/refine.txt", std::ios::binary);
+        std::string text((std::istreambuf_iterator<char>(file)), 
+            std::istreambuf_iterator<char>());
+        for (const auto& doc: paragraphs(text, first_session + i)) {
+            pending.push_back(doc);
+            texts.push_back(text.substr(doc.offset, doc.size));
+        }
+    }
+
+    // batches are embedded in parallel, then appended one at a time so
+    // graph node i stays docs[i]
+    std::atomic<size_t> next_batch = 0;
+    std::atomic<bool> failed = false;
+    std::mutex insert_mtx;
+    const size_t n_batches = (pending.size() + batch_size - 1) / batch_size;
+    auto embed_worker = [&]() {
+        for (size_t b; (b = next_batch++) < n_batches && !stopping && !failed;) {
+            const size_t begin = b * batch_size;
+            const size_t end = std::min(pending.size(), begin + batch_size);
+            std::vector<std::string> batch(texts.begin() + begin, texts.begin() + end);
+            std::vector<std::vector<float>> vectors;
+            try {
+                vectors = embedder.embed(batch);
+            } catch (const std::exception& e) {
+                std::cerr << "Embedding failed: " << e.what() << std::endl;
+                failed = true;
+                break;
+            }
+            if (vectors.size() != batch.size()) {
+                failed = true;
+                break;
+            }
+            std::lock_guard<std::mutex> insert_lk(insert_mtx);
+            std::shared_ptr<HNSW> current;
+            {
+                std::lock_guard<std::mutex> lk(mtx);
+                if (!graph) {
+                    graph = std::make_shared<HNSW>(vectors[0].size(), M, ef_construction);
+                }
+                current = graph;
+            }
+            if (current->dimensions() != int(vectors[0].size())) {
+                std::cerr << "The embedding model changed, remove " << index_path
+                    << " to rebuild the index." << std::endl;
+                failed = true;
+                break;
+            }
+            for (size_t k = 0; k < vectors.size(); ++k) {
+                current->add(vectors[k].data());
+                std::lock_guard<std::mutex> lk(mtx);
+                docs.push_back(pending[begin + k]);
+            }
+        }
+    };
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        sessions.insert(sessions.end(), fresh.begin(), fresh.end());
+    }
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; ++i) pool.emplace_back(embed_worker);
+    for (auto& thread: pool) thread.join();
+
+    // an interrupted run is not saved, the next one starts over from disk
+    if (stopping || failed) {
+        unlock();
+        load();
+        return -1;
+    }
+    int ret = save();
+    unlock();
+    return ret == 0 ? int(fresh.size()) : -1;
+}
+
+void SemanticIndex::refresh() {
+    if (!embedder.ready()) return;
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!running.exchange(true)) {
+        worker = std::thread(&SemanticIndex::refresh_worker, this);
+    }
+    update_pending = true;
+    cv.notify_all();
+}
+
+void SemanticIndex::refresh_worker() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cv.wait(lk, [this] { return update_pending || !running; });
+            if (!running) break;
+            update_pending = false;
+        }
+        int added = update();
+        if (added > 0) {
+            std::cout << "Semantic index: " << added << " sessions added." << std::endl;
+        }
+    }
+}
+
+std::vector<SearchIndex::hit_t> SemanticIndex::search(const std::string& query, 
+    int limit /* = 20 */) {
+    if (!embedder.ready() || query.empty()) return {};
+    std::shared_ptr<HNSW> current;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        current = graph;
+    }
+    if (!current) return {};
+    std::vector<std::vector<float>> vectors;
+    try {
+        vectors = embedder.embed({query}, true);
+    } catch (const std::exception& e) {
+        std::cerr << "Embedding failed: " << e.what() << std::endl;
+        return {};
+    }
+    if (vectors.empty() || int(vectors[0].size()) != current->dimensions()) return {};
+
+    // several paragraphs of one session tend to come back together, ask
+    // for more than needed
+    const size_t k = size_t(limit) * 4;
+    auto found = current->search(vectors[0].data(), k, std::max(size_t(ef_search), k));
+
+    std::map<std::string, std::pair<float, doc_t>> best;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (const auto& [dist, id]: found) {
+            // added by an update still in progress
+            if (id >= docs.size()) continue;
+            const auto& doc = docs[id];
+            const auto& session = sessions[doc.session];
+            auto it = best.find(session);
+            if (it == best.end() || dist < it->second.first) best[session] = {dist, doc};
+        }
+    }
+    std::vector<std::pair<std::string, std::pair<float, doc_t>>> ranked(
+        best.begin(), best.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+        return a.second.first != b.second.first ? a.second.first < b.second.first :
+            a.first > b.first;
+    });
+    if (ranked.size() > size_t(limit)) ranked.resize(limit);
+
+    std::vector<SearchIndex::hit_t> hits;
+    for (const auto& [session, hit]: ranked) {
+        const auto& doc = hit.second;
+        std::ifstream file(root + "/" + session + "/refine.txt", std::ios::binary);
+        // a little past the cut, to back up to a character boundary
+        std::string text(std::min<size_t>(doc.size, 154), '\0');
+        if (!file.is_open() || !file.seekg(doc.offset) || !file.read(text.data(), text.size())) {
+            continue;
+        }
+        size_t end = std::min<size_t>(text.size(), 150);
+        while (end > 0 && end < text.size() && (text[end] & 0xC0) == 0x80) --end;
+        text.resize(end);
+        if (end < doc.size) text += "...";
+        hits.push_back({session, "refine", text, 1.0 - hit.first});
+    }
+    return hits;
+}
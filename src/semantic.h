@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "embedder.h"
+#include "hnsw.h"
+#include "search.h"
+
+// search the archived sessions by meaning: refine.txt is cut into
+// paragraphs, embedded in batches on a few worker threads and kept in an
+// HNSW graph under data/.semantic together with where each paragraph
+// came from. Hits have the same shape as the keyword search ones.
+class SemanticIndex {
+public:
+    SemanticIndex() = default;
+    ~SemanticIndex();
+    SemanticIndex(const SemanticIndex&) = delete;
+    SemanticIndex operator=(const SemanticIndex&) = delete;
+
+    // config is the "semantic" block; returns -1 when disabled or the
+    // model is missing
+    int init(const nlohmann::json& config, const std::string& root = "data");
+    int shutdown();
+    bool ready() const {
+        return embedder.ready();
+    }
+
+    // embed the sessions not indexed yet, returns the number added or -1
+    int update();
+    // update() on a background thread
+    void refresh();
+
+    // nearest paragraphs, best one per session, closest sessions first
+    std::vector<SearchIndex::hit_t> search(const std::string& query, int limit = 20);
+
+private:
+    // a paragraph of a session's refine.txt
+    typedef struct _doc_t {
+        uint32_t session;
+        uint32_t size;
+        uint64_t offset;
+    } doc_t;
+
+    std::string root = "data";
+    std::string index_path = "data/.semantic";
+    Embedder embedder;
+    int M = 16;
+    int ef_construction = 200;
+    int ef_search = 64;
+    size_t batch_size = 32;
+    int threads = 2;
+
+    std::mutex mtx; // guards graph, sessions and docs
+    std::shared_ptr<HNSW> graph; // created once the model's width is known
+    std::vector<std::string> sessions;
+    std::vector<doc_t> docs; // docs[i] is graph node i
+    std::mutex update_mtx; // one update at a time
+
+    std::atomic<bool> running = false;
+    std::atomic<bool> stopping = false;
+    bool update_pending = false;
+    std::thread worker;
+    std::condition_variable cv;
+    void refresh_worker();
+
+    int load();
+    int save();
+    static std::vector<doc_t> paragraphs(const std::string& text, uint32_t session);
+};
@@ -0,0 +1,515 @@
+#include "server.h"
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "httplib.h"
+#include "metrics.h"
+
+static volatile std::sig_atomic_t stop_signal = 0;
+
+static void signal_handler(int) {
+    stop_signal = 1;
+}
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string new_id() {
+    static std::mutex mtx;
+    static std::mt19937_64 rng(std::random_device{}());
+    std::lock_guard<std::mutex> lk(mtx);
+    std::ostringstream oss;
+    oss << std::hex << rng();
+    return oss.str();
+}
+
+static void reply(httplib::Response& res, int status, const nlohmann::json& body) {
+    res.status = status;
+    // ASR text is not always valid UTF-8, dump() would throw on it
+    res.set_content(body.dump(-1, ' ', false, 
+        nlohmann::json::error_handler_t::replace), "application/json");
+}
+
+static nlohmann::json to_json(const text_event_t& event, size_t index) {
+    return {
+        {"index", index},
+        {"event", event.name},
+        {"text", event.text},
+        {"t0", event.t0},
+        {"t1", event.t1}
+    };
+}
+
+int EchoNote::Server::run(const nlohmann::json& config, 
+    const nlohmann::json& llm_config, ASR * asr, LLM * llm) {
+    this->config = config;
+    this->llm_config = llm_config;
+    this->asr = asr;
+    this->llm = llm;
+
+    httplib::Server server;
+    int threads = std::max(config.value("threads", 32), 4);
+    // every streaming upload and event reader holds a thread
+    server.new_task_queue = [threads] { return new httplib::ThreadPool(threads); };
+
+    server.Post("/sessions", [this](const httplib::Request& req, httplib::Response& res) {
+        nlohmann::json request = nlohmann::json::parse(req.body, nullptr, false);
+        bool refine = request.is_object() ? request.value("refine", true) : true;
+        std::string reason;
+        std::string mode = admit(reason);
+        if (mode.empty()) {
+            res.set_header("Retry-After", "10");
+            reply(res, 503, {{"error", reason}});
+            return;
+        }
+        auto session = open(refine && mode == "full");
+        if (!session) {
+            reply(res, 500, {{"error", "failed to start the session"}});
+            return;
+        }
+        reply(res, 201, {
+            {"id", session->id},
+            {"mode", mode},
+            {"refine", session->refine},
+            {"audio", "/sessions/" + session->id + "/audio"},
+            {"events", "/sessions/" + session->id + "/events"}
+        });
+    });
+
+    server.Post(R"(/sessions/(\w+)/audio)", [this](const httplib::Request& req, 
+        httplib::Response& res, const httplib::ContentReader& content_reader) {
+        auto session = find(req.matches[1].str());
+        if (!session) {
+            reply(res, 404, {{"error", "no such session"}});
+            return;
+        }
+        std::string format = req.has_param("format") ? req.get_param_value("format") : "s16le";
+        int rate = req.has_param("rate") ? std::atoi(req.get_param_value("rate").c_str()) : 16000;
+        int channels = req.has_param("channels") ? 
+            std::atoi(req.get_param_value("channels").c_str()) : 1;
+        if (format != "s16le" && format != "f32le") {
+            reply(res, 415, {{"error", "format must be s16le or f32le"}});
+            return;
+        }
+        if (rate < 8000 || rate > 192000 || channels < 1 || channels > 8) {
+            reply(res, 400, {{"error", "bad rate or channels"}});
+            return;
+        }
+        std::unique_lock<std::mutex> upload(session->upload_mtx, std::try_to_lock);
+        if (!upload.owns_lock()) {
+            reply(res, 409, {{"error", "another upload is running"}});
+            return;
+        }
+
+        // a frame may be split across two reads
+        size_t frame_bytes = (format == "s16le" ? 2 : 4) * channels;
+        std::string carry;
+        bool accepted = true;
+        content_reader([&](const char * data, size_t size) {
+            carry.append(data, size);
+            size_t whole = carry.size() / frame_bytes * frame_bytes;
+            if (whole == 0) return true;
+            auto samples = convert(*session, carry.substr(0, whole), format, rate, channels);
+            carry.erase(0, whole);
+            session->last_audio = now_ms();
+            // waits while the pipeline is behind, the client's socket
+            // backs up in turn
+            accepted = session->ingest->push(std::move(samples));
+            return accepted;
+        });
+        if (!accepted) {
+            reply(res, 410, {{"error", "the session is closed"}});
+            return;
+        }
+        reply(res, 200, {
+            {"id", session->id},
+            {"seconds", session->ingest->position() / double(this->asr->getSampleRate())}
+        });
+    });
+
+    server.Get(R"(/sessions/(\w+)/events)", [this](const httplib::Request& req, 
+        httplib::Response& res) {
+        auto session = find(req.matches[1].str());
+        if (!session) {
+            reply(res, 404, {{"error", "no such session"}});
+            return;
+        }
+        size_t from = req.has_param("from") ? 
+            std::strtoull(req.get_param_value("from").c_str(), nullptr, 10) : 0;
+        res.set_chunked_content_provider("application/x-ndjson", 
+            [this, session, next = from](size_t, httplib::DataSink& sink) mutable {
+            std::vector<text_event_t> batch;
+            bool finished = false;
+            {
+                std::unique_lock<std::mutex> lk(session->mtx);
+                session->cv.wait_for(lk, std::chrono::seconds(1), [&] {
+                    return session->finished || session->events.size() > next;
+                });
+                if (next < session->events.size()) {
+                    batch.assign(session->events.begin() + next, session->events.end());
+                }
+                finished = session->finished;
+            }
+            for (const auto& event: batch) {
+                std::string line = to_json(event, next++).dump(-1, ' ', false, 
+                    nlohmann::json::error_handler_t::replace) + "\n";
+                if (!sink.write(line.data(), line.size())) return false;
+            }
+            if (finished || !running) {
+                sink.done();
+            }
+            return true;
+        });
+    });
+
+    server.Delete(R"(/sessions/(\w+))", [this](const httplib::Request& req, 
+        httplib::Response& res) {
+        auto session = find(req.matches[1].str());
+        if (!session) {
+            reply(res, 404, {{"error", "no such session"}});
+            return;
+        }
+        reply(res, 200, close(session));
+    });
+
+    server.Get("/status", [this](const httplib::Request&, httplib::Response& res) {
+        reply(res, 200, status());
+    });
+    Metrics::instance().mount(server);
+
+    std::string host = config.value("host", "127.0.0.1");
+    int port = config.value("port", 8090);
+    if (!server.bind_to_port(host, port)) {
+        std::cerr << "Failed to listen on " << host << ":" << port << std::endl;
+        return -1;
+    }
+
+    int collector = Metrics::instance().addCollector([this](Metrics& metrics) {
+        std::lock_guard<std::mutex> lk(sessions_mtx);
+        metrics.gauge("voicelint_server_sessions", "Open sessions").set(sessions.size());
+    });
+
+    stop_signal = 0;
+    std::signal(SIGINT, signal_handler);
+    std::signal(SIGTERM, signal_handler);
+    std::signal(SIGPIPE, SIG_IGN);
+    running = true;
+    std::thread listen_thread([&server]() { server.listen_after_bind(); });
+    std::thread monitor_thread(&Server::monitor_worker, this);
+    std::cout << "Serving on " << host << ":" << port << std::endl;
+
+    while (!stop_signal) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    running = false;
+
+    // the sessions finish what they heard before the connections go
+    std::vector<std::shared_ptr<session_t>> open_sessions;
+    {
+        std::lock_guard<std::mutex> lk(sessions_mtx);
+        for (const auto& [id, session]: sessions) open_sessions.push_back(session);
+    }
+    for (auto& session: open_sessions) close(session);
+    Metrics::instance().removeCollector(collector);
+    server.stop();
+    if (listen_thread.joinable()) listen_thread.join();
+    if (monitor_thread.joinable()) monitor_thread.join();
+    std::cout << "Server stopped." << std::endl;
+    return 0;
+}
+
+void EchoNote::Server::monitor_worker() {
+    int idle_timeout = config.value("idle_timeout", 300);
+    last_busy_ms = asr->getLoad().busy_ms;
+    auto last = std::chrono::steady_clock::now();
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto now = std::chrono::steady_clock::now();
+        auto load = asr->getLoad();
+        double wall_ms = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+        {
+            std::lock_guard<std::mutex> lk(load_mtx);
+            double used = (load.busy_ms - last_busy_ms) / (wall_ms * load.parallel);
+            last_busy_ms = load.busy_ms;
+            // windows queueing for a turn mean the pool is already full
+            if (load.waiting > 0) used = std::max(used, 1.0);
+            utilization = utilization * 0.7 + std::min(used, 1.0) * 0.3;
+        }
+
+        // clients that went away without closing
+        std::vector<std::shared_ptr<session_t>> idle;
+        {
+            std::lock_guard<std::mutex> lk(sessions_mtx);
+            for (const auto& [id, session]: sessions) {
+                if (now_ms() - session->last_audio > idle_timeout * 1000LL) {
+                    idle.push_back(session);
+                }
+            }
+        }
+        for (auto& session: idle) {
+            std::cout << "Closing idle session " << session->id << std::endl;
+            close(session);
+        }
+    }
+}
+
+std::shared_ptr<EchoNote::Server::session_t> EchoNote::Server::find(const std::string& id) {
+    std::lock_guard<std::mutex> lk(sessions_mtx);
+    auto it = sessions.find(id);
+    return it == sessions.end() ? nullptr : it->second;
+}
+
+// a session is admitted in full while the ASR has headroom; past
+// degrade_load or full_sessions it gets captions without the LLM, and past
+// max_sessions or reject_load it is turned away
+std::string EchoNote::Server::admit(std::string& reason) {
+    size_t active = 0;
+    {
+        std::lock_guard<std::mutex> lk(sessions_mtx);
+        active = sessions.size();
+    }
+    double used = 0;
+    {
+        std::lock_guard<std::mutex> lk(load_mtx);
+        used = utilization;
+    }
+    if (active >= config.value("max_sessions", 16u)) {
+        reason = "too many sessions";
+        return "";
+    }
+    if (used >= config.value("reject_load", 0.9)) {
+        reason = "speech recognition is at capacity";
+        return "";
+    }
+    if (active >= config.value("full_sessions", 8u) || used >= config.value("degrade_load", 0.7)) {
+        return "degraded";
+    }
+    return "full";
+}
+
+nlohmann::json EchoNote::Server::pipeline(bool refine) const {
+    nlohmann::json vad = config.value("vad", nlohmann::json::object());
+    vad["name"] = "vad";
+    vad["type"] = "vad";
+    nlohmann::json asr_stage = config.value("asr", nlohmann::json::object());
+    asr_stage["name"] = "asr";
+    asr_stage["type"] = "asr";
+    nlohmann::json graph = {
+        {"queue_capacity", 64},
+        {"stages", {
+            {{"name", "ingest"}, {"type", "ingest"}, {"sample_rate", asr->getSampleRate()},
+                {"queue_capacity", config.value("ingest_capacity", 32)}},
+            vad,
+            asr_stage,
+            {{"name", "events"}, {"type", "events"}},
+            {{"name", "recorder"}, {"type", "session_file"}}
+        }},
+        {"edges", {
+            {{"from", "ingest.audio"}, {"to", "vad.audio"}},
+            {{"from", "ingest.audio"}, {"to", "recorder.audio"}, {"capacity", 256}},
+            {{"from", "vad.audio"}, {"to", "asr.audio"}},
+            {{"from", "asr.text"}, {"to", "events.text"}},
+            {{"from", "asr.text"}, {"to", "recorder.text"}}
+        }}
+    };
+    if (refine) {
+        graph["stages"].push_back({{"name", "llm"}, {"type", "llm"}});
+        graph["edges"].push_back({{"from", "asr.text"}, {"to", "llm.text"}});
+        graph["edges"].push_back({{"from", "llm.text"}, {"to", "events.text"}});
+        graph["edges"].push_back({{"from", "llm.text"}, {"to", "recorder.text"}});
+    }
+    return graph;
+}
+
+std::shared_ptr<EchoNote::Server::session_t> EchoNote::Server::open(bool refine) {
+    auto session = std::make_shared<session_t>();
+    session->id = new_id();
+    session->path = config.value("path", "output/server") + "/" + session->id;
+    session->refine = refine;
+    session->last_audio = now_ms();
+
+    nlohmann::json file_config = config.value("session", nlohmann::json::object());
+    file_config["enabled"] = true;
+    file_config["output"] = session->path + "/session.vls";
+    if (session->file.init(file_config) != 0) return nullptr;
+
+    if (refine) {
+        // the session keeps its own refine and summary state on the shared
+        // engine; slots and the response cache are per process, so off
+        nlohmann::json session_llm = llm_config;
+        session_llm.merge_patch({
+            {"cache", {{"enabled", false}}},
+            {"refine", {{"slot", -1}, {"save", false}}},
+            {"summarize", {{"slot", -1}, {"save", false}}}
+        });
+        session_llm.merge_patch(config.value("llm", nlohmann::json::object()));
+        session_llm["refine"]["spool"] = session->path + "/refine.spool";
+        session->llm = std::make_unique<LLM>();
+        if (session->llm->init(session_llm, nullptr, llm->getEngine()) != 0) {
+            session->llm.reset();
+            session->refine = false;
+        }
+    }
+
+    session_t * s = session.get();
+    session->graph.define("ingest", []() { return std::make_unique<IngestStage>(); });
+    session->graph.define("vad", []() { return std::make_unique<VadStage>(); });
+    session->graph.define("asr", [this]() { return std::make_unique<AsrStage>(asr); });
+    session->graph.define("llm", [s]() { return std::make_unique<LlmStage>(s->llm.get()); });
+    session->graph.define("session_file", [s]() {
+        return std::make_unique<SessionFileStage>(&s->file);
+    });
+    session->graph.define("events", [s]() {
+        return std::make_unique<EventStage>([s](const text_event_t& event) {
+            if (event.name == "log") return;
+            {
+                std::lock_guard<std::mutex> lk(s->mtx);
+                s->events.push_back(event);
+            }
+            s->cv.notify_all();
+        });
+    });
+    if (session->graph.build(pipeline(session->refine)) != 0 || session->graph.start() != 0) {
+        if (session->llm) session->llm->shutdown();
+        session->file.close();
+        return nullptr;
+    }
+    session->ingest = static_cast<IngestStage *>(session->graph.stage("ingest"));
+
+    std::lock_guard<std::mutex> lk(sessions_mtx);
+    sessions[session->id] = session;
+    std::cout << "Session " << session->id << " opened"
+        << (session->refine ? "" : " without refine") << "." << std::endl;
+    return session;
+}
+
+// waits for the pipeline to drain, so the reply has everything
+nlohmann::json EchoNote::Server::close(std::shared_ptr<session_t> session) {
+    if (!session->closing.exchange(true)) {
+        session->ingest->finish();
+        session->graph.stop();
+        session->file.close();
+
+        SessionFile archived;
+        if (archived.open(session->path + "/session.vls") == 0) {
+            archived.exportText(SessionFile::chunk_asr, session->path + "/asr.txt");
+            archived.exportText(SessionFile::chunk_refine, session->path + "/refine.txt");
+            archived.exportText(SessionFile::chunk_summary, session->path + "/summarize.txt");
+        }
+        {
+            std::lock_guard<std::mutex> lk(sessions_mtx);
+            sessions.erase(session->id);
+        }
+        {
+            std::lock_guard<std::mutex> lk(session->mtx);
+            session->finished = true;
+        }
+        session->cv.notify_all();
+        std::cout << "Session " << session->id << " closed." << std::endl;
+    }
+
+    std::unique_lock<std::mutex> lk(session->mtx);
+    session->cv.wait(lk, [&] { return session->finished; });
+    std::string transcript, refined, summary;
+    for (const auto& event: session->events) {
+        if (event.name == "asr") transcript += event.text;
+        if (event.name == "refine") refined += event.text;
+        if (event.name == "summarize") summary = event.text;
+    }
+    return {
+        {"id", session->id},
+        {"seconds", session->ingest->position() / double(asr->getSampleRate())},
+        {"events", session->events.size()},
+        {"asr", transcript},
+        {"refine", refined},
+        {"summarize", summary},
+        {"path", session->path}
+    };
+}
+
+nlohmann::json EchoNote::Server::status() {
+    auto load = asr->getLoad();
+    nlohmann::json result = {
+        {"asr", {
+            {"parallel", load.parallel},
+            {"busy", load.busy},
+            {"waiting", load.waiting},
+            {"rtf", load.rtf}
+        }}
+    };
+    {
+        std::lock_guard<std::mutex> lk(load_mtx);
+        result["asr"]["utilization"] = utilization;
+    }
+    nlohmann::json list = nlohmann::json::array();
+    std::lock_guard<std::mutex> lk(sessions_mtx);
+    for (const auto& [id, session]: sessions) {
+        size_t events = 0;
+        {
+            std::lock_guard<std::mutex> session_lk(session->mtx);
+            events = session->events.size();
+        }
+        list.push_back({
+            {"id", id},
+            {"refine", session->refine},
+            {"seconds", session->ingest->position() / double(asr->getSampleRate())},
+            {"events", events},
+            {"queues", session->graph.stats()}
+        });
+    }
+    result["sessions"] = list;
+    return result;
+}
+
+// whole frames of interleaved PCM to mono at the ASR's rate
+std::vector<float> EchoNote::Server::convert(session_t& session, 
+    const std::string& bytes, const std::string& format, int rate, int channels) {
+    size_t sample_bytes = format == "s16le" ? 2 : 4;
+    size_t frames = bytes.size() / (sample_bytes * channels);
+    std::vector<float> mono(frames, 0.0f);
+    for (size_t i = 0; i < frames; ++i) {
+        float sum = 0;
+        for (int c = 0; c < channels; ++c) {
+            const char * p = bytes.data() + (i * channels + c) * sample_bytes;
+            if (sample_bytes == 2) {
+                int16_t v;
+                std::memcpy(&v, p, 2);
+                sum += v / 32768.0f;
+            } else {
+                float v;
+                std::memcpy(&v, p, 4);
+                sum += v;
+            }
+        }
+        mono[i] = sum / channels;
+    }
+    int asr_rate = asr->getSampleRate();
+    if (rate == asr_rate) return mono;
+
+    if (!session.swr || session.swr_rate != rate) {
+        if (session.swr) swr_free(&session.swr);
+        const AVChannelLayout layout = AV_CHANNEL_LAYOUT_MONO;
+        swr_alloc_set_opts2(&session.swr, &layout, AV_SAMPLE_FMT_FLT, asr_rate, 
+            &layout, AV_SAMPLE_FMT_FLT, rate, 0, nullptr);
+        if (!session.swr || swr_init(session.swr) < 0) {
+            if (session.swr) swr_free(&session.swr);
+            std::cerr << "Failed to resample from " << rate << " Hz" << std::endl;
+            return {};
+        }
+        session.swr_rate = rate;
+    }
+    int out_samples = swr_get_out_samples(session.swr, mono.size());
+    std::vector<float> resampled(std::max(out_samples, 0));
+    const float * in_data[1] = { mono.data() };
+    float * out_data[1] = { resampled.data() };
+    int ret = swr_convert(session.swr, reinterpret_cast<uint8_t **>(out_data), out_samples, 
+        reinterpret_cast<const uint8_t **>(in_data), mono.size());
+    resampled.resize(std::max(ret, 0));
+    return resampled;
+}
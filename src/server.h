@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "asr.h"
+#include "graph.h"
+#include "llm.h"
+#include "session_file.h"
+#include "stages.h"
+
+extern "C" {
+#include <libswresample/swresample.h>
+}
+
+namespace EchoNote {
+// captions as a local service. Every client that opens a session gets its
+// own pipeline, ingest -> vad -> asr -> llm, recorded to its own session
+// file; all of them share the ASR's inference capacity and the engine of
+// the LLM passed to run(). HTTP API:
+//   POST   /sessions                 open a session, 503 when full
+//   POST   /sessions/{id}/audio      PCM body, ?format=s16le|f32le&rate=&channels=
+//   GET    /sessions/{id}/events     results as JSON lines, ?from=index
+//   DELETE /sessions/{id}            finish, returns the transcript
+//   GET    /status                   sessions and ASR load
+class Server {
+public:
+    static Server& instance() {
+        static Server _inst;
+        return _inst;
+    }
+
+    Server(const Server&) = delete;
+    Server operator =(const Server&) = delete;
+
+    // config is the "server" block, llm_config the "llm" block the session
+    // LLMs start from. Returns on SIGINT/SIGTERM, after closing the sessions.
+    int run(const nlohmann::json& config, const nlohmann::json& llm_config, 
+        ASR * asr, LLM * llm);
+
+private:
+    Server() = default;
+    ~Server() = default;
+
+    typedef struct _session_t {
+        std::string id;
+        std::string path; // directory of its files
+        bool refine = true; // false when admitted degraded
+        // the graph goes first on destruction, its stages use the others
+        std::unique_ptr<LLM> llm;
+        SessionFile file;
+        Graph graph;
+        IngestStage * ingest = nullptr;
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::vector<text_event_t> events;
+        bool finished = false;
+        std::atomic<bool> closing = false;
+
+        // one upload at a time, it owns the resampler
+        std::mutex upload_mtx;
+        SwrContext * swr = nullptr;
+        int swr_rate = 0;
+        std::atomic<int64_t> last_audio = 0; // steady clock ms
+
+        ~_session_t() {
+            if (swr) swr_free(&swr);
+        }
+    } session_t;
+
+    nlohmann::json config;
+    nlohmann::json llm_config;
+    ASR * asr = nullptr;
+    LLM * llm = nullptr;
+
+    std::atomic<bool> running = false;
+    std::mutex sessions_mtx;
+    std::map<std::string, std::shared_ptr<session_t>> sessions;
+
+    // ASR time used per ASR time available, sampled every second
+    std::mutex load_mtx;
+    double utilization = 0;
+    double last_busy_ms = 0;
+    void monitor_worker();
+
+    std::shared_ptr<session_t> find(const std::string& id);
+    // "full", "degraded", or "" to reject, with the reason
+    std::string admit(std::string& reason);
+    std::shared_ptr<session_t> open(bool refine);
+    nlohmann::json close(std::shared_ptr<session_t> session);
+    nlohmann::json pipeline(bool refine) const;
+    nlohmann::json status();
+
+    std::vector<float> convert(session_t& session, const std::string& bytes, 
+        const std::string& format, int rate, int channels);
+};
+}
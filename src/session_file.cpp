@@ -0,0 +1,526 @@
+#include "session_file.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sndfile.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char session_magic[8] = {'V', 'L', 'S', 'E', 'S', 'S', '1', '\0'};
+static const char index_magic[8] = {'V', 'L', 'S', 'I', 'D', 'X', '1', '\0'};
+static const uint32_t chunk_magic = 0x4b434c56; // "VLCK"
+
+typedef struct _header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t sample_rate;
+    uint64_t created; // unix ms
+    uint64_t reserved;
+} header_t;
+
+// followed by the payload, padded to 8 bytes
+typedef struct _chunk_t {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t flags;
+    uint64_t t0;
+    uint64_t t1;
+    uint32_t size;
+    uint32_t crc; // of the payload
+} chunk_t;
+
+// at the very end, after the entries
+typedef struct _trailer_t {
+    uint64_t index_offset;
+    uint32_t count;
+    uint32_t crc; // of the entries
+    char magic[8];
+} trailer_t;
+
+// leads the FLAC data of an audio chunk, the ms stamps alone are too coarse
+// to cut at a sample
+typedef struct _audio_block_t {
+    uint64_t first_sample;
+    uint32_t count;
+    uint32_t reserved;
+} audio_block_t;
+
+static uint32_t crc32(const void * data, size_t size, uint32_t crc = 0) {
+    static const auto table = []() {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+    const auto * p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+static int pwrite_all(int fd, const char * data, size_t size, uint64_t offset) {
+    for (size_t done = 0; done < size;) {
+        ssize_t n = ::pwrite(fd, data + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// libsndfile encodes to and decodes from a string through these
+typedef struct _memory_file_t {
+    std::string data;
+    sf_count_t position = 0;
+} memory_file_t;
+
+static sf_count_t memory_length(void * user) {
+    return static_cast<memory_file_t *>(user)->data.size();
+}
+
+static sf_count_t memory_seek(sf_count_t offset, int whence, void * user) {
+    auto file = static_cast<memory_file_t *>(user);
+    sf_count_t base = 0;
+    if (whence == SF_SEEK_CUR) base = file->position;
+    if (whence == SF_SEEK_END) base = file->data.size();
+    file->position = std::max<sf_count_t>(base + offset, 0);
+    return file->position;
+}
+
+static sf_count_t memory_read(void * buffer, sf_count_t count, void * user) {
+    auto file = static_cast<memory_file_t *>(user);
+    sf_count_t available = static_cast<sf_count_t>(file->data.size()) - file->position;
+    count = std::clamp<sf_count_t>(count, 0, std::max<sf_count_t>(available, 0));
+    std::memcpy(buffer, file->data.data() + file->position, count);
+    file->position += count;
+    return count;
+}
+
+static sf_count_t memory_write(const void * buffer, sf_count_t count, void * user) {
+    auto file = static_cast<memory_file_t *>(user);
+    if (file->position + count > static_cast<sf_count_t>(file->data.size())) {
+        file->data.resize(file->position + count);
+    }
+    std::memcpy(file->data.data() + file->position, buffer, count);
+    file->position += count;
+    return count;
+}
+
+static sf_count_t memory_tell(void * user) {
+    return static_cast<memory_file_t *>(user)->position;
+}
+
+static SF_VIRTUAL_IO memory_io = {
+    memory_length, memory_seek, memory_read, memory_write, memory_tell
+};
+
+static std::string encode_flac(const float * samples, size_t count, int sample_rate) {
+    memory_file_t file;
+    SF_INFO info = {};
+    info.samplerate = sample_rate;
+    info.channels = 1;
+    info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+    SNDFILE * sf = sf_open_virtual(&memory_io, SFM_WRITE, &info, &file);
+    if (!sf) return "";
+    sf_count_t written = sf_writef_float(sf, samples, count);
+    sf_close(sf);
+    return written == static_cast<sf_count_t>(count) ? file.data : "";
+}
+
+static std::vector<float> decode_flac(std::string_view data) {
+    memory_file_t file;
+    file.data.assign(data);
+    SF_INFO info = {};
+    SNDFILE * sf = sf_open_virtual(&memory_io, SFM_READ, &info, &file);
+    if (!sf) return {};
+    std::vector<float> samples(info.frames * std::max(info.channels, 1));
+    sf_count_t frames = sf_readf_float(sf, samples.data(), info.frames);
+    sf_close(sf);
+    samples.resize(std::max<sf_count_t>(frames, 0) * std::max(info.channels, 1));
+    return samples;
+}
+
+// the samples [s0, s1) of an audio chunk
+static void block_samples(std::string_view chunk, uint64_t s0, uint64_t s1, 
+    std::vector<float>& out) {
+    if (chunk.size() < sizeof(audio_block_t)) return;
+    audio_block_t block;
+    std::memcpy(&block, chunk.data(), sizeof(block));
+    std::vector<float> samples = decode_flac(chunk.substr(sizeof(block)));
+    uint64_t first = std::max(s0, block.first_sample) - block.first_sample;
+    uint64_t last = std::min<uint64_t>(s1, block.first_sample + block.count);
+    last = std::min<uint64_t>(last - std::min(last, block.first_sample), samples.size());
+    if (first < last) out.insert(out.end(), samples.begin() + first, samples.begin() + last);
+}
+
+SessionFile::~SessionFile() {
+    close();
+}
+
+int SessionFile::init(const nlohmann::json& config) {
+    if (!config.value("enabled", true)) return -1;
+    block_ms = std::max(config.value("block_ms", 2000), 100);
+    sync_interval = std::chrono::milliseconds(config.value("sync_interval", 5000));
+    return create(config.value("output", "output/session.vls"));
+}
+
+int SessionFile::create(const std::string& filename, int sample_rate /* = 16000 */) {
+    close();
+    std::lock_guard<std::mutex> lk(mtx);
+    auto parent = std::filesystem::path(filename).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to create " << filename << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    this->filename = filename;
+    this->sample_rate = sample_rate;
+    created_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    header_t header = {};
+    std::memcpy(header.magic, session_magic, sizeof(session_magic));
+    header.version = 1;
+    header.sample_rate = sample_rate;
+    header.created = created_ms;
+    if (pwrite_all(fd, reinterpret_cast<const char *>(&header), sizeof(header), 0) != 0) {
+        std::cerr << "Failed to write " << filename << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    writing = true;
+    end = sizeof(header);
+    index.clear();
+    pending.clear();
+    samples = 0;
+    block_start = 0;
+    last_sync = std::chrono::steady_clock::now();
+
+    nlohmann::json meta = {
+        {"created", created_ms},
+        {"sample_rate", sample_rate},
+        {"block_ms", block_ms},
+        {"audio", "flac"}
+    };
+    append_locked(chunk_meta, 0, 0, 0, meta.dump());
+    return 0;
+}
+
+int SessionFile::close() {
+    std::lock_guard<std::mutex> lk(mtx);
+    int ret = 0;
+    if (fd >= 0 && writing) {
+        flush_audio_locked();
+        ret = write_index(fd, end, index);
+        ::fsync(fd);
+    }
+    if (data) ::munmap(const_cast<char *>(data), size);
+    if (fd >= 0) ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+    writing = false;
+    index.clear();
+    pending.clear();
+    return ret;
+}
+
+int SessionFile::open(const std::string& filename) {
+    close();
+    std::lock_guard<std::mutex> lk(mtx);
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << filename << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header_t)) {
+        std::cerr << "Not a session file: " << filename << std::endl;
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    size = st.st_size;
+    void * addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    header_t header;
+    if (addr != MAP_FAILED) std::memcpy(&header, addr, sizeof(header));
+    if (addr == MAP_FAILED
+        || std::memcmp(header.magic, session_magic, sizeof(session_magic)) != 0
+        || header.version != 1 || header.sample_rate == 0) {
+        std::cerr << "Not a session file: " << filename << std::endl;
+        if (addr != MAP_FAILED) ::munmap(addr, size);
+        ::close(fd);
+        fd = -1;
+        size = 0;
+        return -1;
+    }
+    data = static_cast<const char *>(addr);
+    this->filename = filename;
+    sample_rate = header.sample_rate;
+    created_ms = header.created;
+    bool closed = false;
+    load_index(data, size, index, closed);
+    return 0;
+}
+
+int SessionFile::repair(const std::string& filename) {
+    SessionFile file;
+    if (file.open(filename) != 0) return -1;
+    bool closed = false;
+    std::vector<entry_t> index;
+    uint64_t valid = load_index(file.data, file.size, index, closed);
+    file.close();
+    if (closed) return 0;
+
+    int fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) return -1;
+    int ret = write_index(fd, valid, index);
+    ::fsync(fd);
+    ::close(fd);
+    if (ret == 0) {
+        std::cout << "Recovered " << index.size() << " chunks of " << filename << std::endl;
+    }
+    return ret;
+}
+
+int SessionFile::append(uint16_t type, uint64_t t0, uint64_t t1, const std::string& payload) {
+    std::lock_guard<std::mutex> lk(mtx);
+    return append_locked(type, 0, t0, t1, payload);
+}
+
+int SessionFile::append_locked(uint16_t type, uint16_t flags, uint64_t t0, uint64_t t1, 
+    const std::string& payload) {
+    if (fd < 0 || !writing) return -1;
+    chunk_t chunk = {};
+    chunk.magic = chunk_magic;
+    chunk.type = type;
+    chunk.flags = flags;
+    chunk.t0 = t0;
+    chunk.t1 = std::max(t0, t1);
+    chunk.size = payload.size();
+    chunk.crc = crc32(payload.data(), payload.size());
+
+    std::string block(align8(sizeof(chunk) + payload.size()), '\0');
+    std::memcpy(block.data(), &chunk, sizeof(chunk));
+    std::memcpy(block.data() + sizeof(chunk), payload.data(), payload.size());
+    // a failed write is overwritten by the next chunk
+    if (pwrite_all(fd, block.data(), block.size(), end) != 0) {
+        std::cerr << "Failed to append to " << filename << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    index.push_back({type, flags, chunk.size, chunk.t0, chunk.t1, end + sizeof(chunk)});
+    end += block.size();
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_sync >= sync_interval) {
+        ::fsync(fd);
+        last_sync = now;
+    }
+    return 0;
+}
+
+int SessionFile::appendAudio(const float * samples, size_t count) {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (fd < 0 || !writing) return -1;
+    pending.insert(pending.end(), samples, samples + count);
+    this->samples += count;
+    size_t block_samples = static_cast<size_t>(block_ms) * sample_rate / 1000;
+    int ret = 0;
+    while (pending.size() >= block_samples && ret == 0) {
+        std::vector<float> rest(pending.begin() + block_samples, pending.end());
+        pending.resize(block_samples);
+        ret = flush_audio_locked();
+        pending = std::move(rest);
+    }
+    return ret;
+}
+
+int SessionFile::flush_audio_locked() {
+    if (pending.empty()) return 0;
+    std::string flac = encode_flac(pending.data(), pending.size(), sample_rate);
+    if (flac.empty()) {
+        std::cerr << "Failed to encode an audio block of " << filename << std::endl;
+    }
+    audio_block_t block = {block_start, static_cast<uint32_t>(pending.size()), 0};
+    std::string payload(reinterpret_cast<const char *>(&block), sizeof(block));
+    payload += flac;
+    uint64_t t0 = block_start * 1000 / sample_rate;
+    uint64_t t1 = (block_start + pending.size()) * 1000 / sample_rate;
+    block_start += pending.size();
+    pending.clear();
+    return flac.empty() ? -1 : append_locked(chunk_audio, 0, t0, t1, payload);
+}
+
+uint64_t SessionFile::position() const {
+    std::lock_guard<std::mutex> lk(mtx);
+    return samples * 1000 / sample_rate;
+}
+
+int SessionFile::write_index(int fd, uint64_t end, const std::vector<entry_t>& index) {
+    trailer_t trailer = {};
+    trailer.index_offset = end;
+    trailer.count = index.size();
+    trailer.crc = crc32(index.data(), index.size() * sizeof(entry_t));
+    std::memcpy(trailer.magic, index_magic, sizeof(index_magic));
+
+    std::string footer(reinterpret_cast<const char *>(index.data()), index.size() * sizeof(entry_t));
+    footer.append(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+    if (pwrite_all(fd, footer.data(), footer.size(), end) != 0
+        || ::ftruncate(fd, end + footer.size()) != 0) {
+        std::cerr << "Failed to write the session index: " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t SessionFile::load_index(const char * data, size_t size, 
+    std::vector<entry_t>& index, bool& closed) {
+    index.clear();
+    closed = false;
+    if (size >= sizeof(header_t) + sizeof(trailer_t)) {
+        trailer_t trailer;
+        std::memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+        uint64_t entries = static_cast<uint64_t>(trailer.count) * sizeof(entry_t);
+        if (std::memcmp(trailer.magic, index_magic, sizeof(index_magic)) == 0
+            && trailer.index_offset >= sizeof(header_t)
+            && trailer.index_offset + entries + sizeof(trailer) == size
+            && crc32(data + trailer.index_offset, entries) == trailer.crc) {
+            index.resize(trailer.count);
+            std::memcpy(index.data(), data + trailer.index_offset, entries);
+            bool valid = std::all_of(index.begin(), index.end(), [&](const entry_t& e) {
+                return e.offset + e.size <= trailer.index_offset;
+            });
+            if (valid) {
+                closed = true;
+                return trailer.index_offset;
+            }
+            index.clear();
+        }
+    }
+
+    // never closed: take every chunk up to the first torn one
+    uint64_t position = sizeof(header_t);
+    while (position + sizeof(chunk_t) <= size) {
+        chunk_t chunk;
+        std::memcpy(&chunk, data + position, sizeof(chunk));
+        uint64_t payload = position + sizeof(chunk);
+        if (chunk.magic != chunk_magic || payload + chunk.size > size
+            || crc32(data + payload, chunk.size) != chunk.crc) {
+            break;
+        }
+        index.push_back({chunk.type, chunk.flags, chunk.size, chunk.t0, chunk.t1, payload});
+        position = align8(payload + chunk.size);
+    }
+    return std::min<uint64_t>(position, align8(size));
+}
+
+uint64_t SessionFile::duration() const {
+    uint64_t t = 0;
+    for (const auto& entry: index) t = std::max(t, entry.t1);
+    return t;
+}
+
+std::vector<SessionFile::entry_t> SessionFile::find(uint16_t type, 
+    uint64_t t0 /* = 0 */, uint64_t t1 /* = UINT64_MAX */) const {
+    std::vector<entry_t> result;
+    for (const auto& entry: index) {
+        // a segment without length counts where it starts
+        if (entry.type == type && entry.t0 < t1 && (entry.t1 > t0 || entry.t0 >= t0)) {
+            result.push_back(entry);
+        }
+    }
+    return result;
+}
+
+std::string_view SessionFile::payload(const entry_t& entry) const {
+    if (!data || entry.offset + entry.size > size) return {};
+    return std::string_view(data + entry.offset, entry.size);
+}
+
+std::string SessionFile::text(uint16_t type, uint64_t t0 /* = 0 */, 
+    uint64_t t1 /* = UINT64_MAX */) const {
+    std::string result;
+    for (const auto& entry: find(type, t0, t1)) result += payload(entry);
+    return result;
+}
+
+std::vector<float> SessionFile::audio(uint64_t t0 /* = 0 */, 
+    uint64_t t1 /* = UINT64_MAX */) const {
+    std::vector<float> result;
+    uint64_t s0 = t0 * sample_rate / 1000;
+    uint64_t s1 = t1 == UINT64_MAX ? UINT64_MAX : t1 * sample_rate / 1000;
+    for (const auto& entry: find(chunk_audio, t0, t1)) {
+        block_samples(payload(entry), s0, s1, result);
+    }
+    return result;
+}
+
+int SessionFile::exportAudio(const std::string& filename, uint64_t t0 /* = 0 */, 
+    uint64_t t1 /* = UINT64_MAX */) const {
+    std::string extension = std::filesystem::path(filename).extension().string();
+    SF_INFO info = {};
+    info.samplerate = sample_rate;
+    info.channels = 1;
+    if (extension == ".mp3") {
+        info.format = SF_FORMAT_MPEG | SF_FORMAT_MPEG_LAYER_III;
+    } else if (extension == ".flac") {
+        info.format = SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+    } else {
+        info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    }
+    SNDFILE * sf = sf_open(filename.c_str(), SFM_WRITE, &info);
+    if (!sf) {
+        std::cerr << "Failed to create " << filename << std::endl;
+        return -1;
+    }
+    // a block at a time, a long session is never decoded whole
+    uint64_t s0 = t0 * sample_rate / 1000;
+    uint64_t s1 = t1 == UINT64_MAX ? UINT64_MAX : t1 * sample_rate / 1000;
+    int ret = 0;
+    for (const auto& entry: find(chunk_audio, t0, t1)) {
+        std::vector<float> samples;
+        block_samples(payload(entry), s0, s1, samples);
+        if (sf_writef_float(sf, samples.data(), samples.size())
+            != static_cast<sf_count_t>(samples.size())) {
+            ret = -1;
+            break;
+        }
+    }
+    sf_close(sf);
+    return ret;
+}
+
+int SessionFile::exportText(uint16_t type, const std::string& filename, 
+    uint64_t t0 /* = 0 */, uint64_t t1 /* = UINT64_MAX */) const {
+    std::string content;
+    if (type == chunk_summary) {
+        // each summary covers the whole session so far, the last one wins
+        auto entries = find(type, t0, t1);
+        if (!entries.empty()) content = payload(entries.back());
+    } else {
+        content = text(type, t0, t1);
+    }
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || pwrite_all(fd, content.data(), content.size(), 0) != 0) {
+        std::cerr << "Failed to write " << filename << std::endl;
+        if (fd >= 0) ::close(fd);
+        return -1;
+    }
+    ::close(fd);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+// everything a session produces in one append-only file: FLAC audio blocks
+// of a couple of seconds, the ASR segments, refine blocks and summaries,
+// each a chunk stamped with the audio time it covers and guarded by a
+// CRC. Closing appends an index of the chunks, so a reader maps the file
+// and jumps to any time range; a file left behind by a crash is indexed by
+// walking the chunks up to the first torn one.
+class SessionFile {
+public:
+    enum chunk_type_t : uint16_t {
+        chunk_audio = 1, // 16 bit FLAC, mono at the session's sample rate
+        chunk_asr = 2,
+        chunk_refine = 3,
+        chunk_summary = 4,
+        chunk_meta = 5 // JSON
+    };
+
+    // where a chunk is; t0 and t1 are ms of recorded audio
+    typedef struct _entry_t {
+        uint16_t type;
+        uint16_t flags;
+        uint32_t size; // of the payload
+        uint64_t t0;
+        uint64_t t1;
+        uint64_t offset; // of the payload
+    } entry_t;
+
+    SessionFile() = default;
+    ~SessionFile();
+    SessionFile(const SessionFile&) = delete;
+    SessionFile operator=(const SessionFile&) = delete;
+
+    // config is the "session" block; creates the container to write to,
+    // returns -1 when disabled
+    int init(const nlohmann::json& config);
+    int create(const std::string& filename, int sample_rate = 16000);
+    // flush the last audio block and write the index
+    int close();
+
+    // memory-map a container for reading
+    int open(const std::string& filename);
+    // index a container that was never closed, cutting a torn last chunk
+    static int repair(const std::string& filename);
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+    std::string getOutFile() const {
+        return filename;
+    }
+
+    // writing, from any thread
+    int append(uint16_t type, uint64_t t0, uint64_t t1, const std::string& payload);
+    // mono samples at the sample rate, stored in blocks of block_ms
+    int appendAudio(const float * samples, size_t count);
+    // ms of audio appended so far, the clock of the other chunks
+    uint64_t position() const;
+
+    // reading, after open()
+    int sampleRate() const {
+        return sample_rate;
+    }
+    std::chrono::system_clock::time_point created() const {
+        return std::chrono::system_clock::time_point(
+            std::chrono::milliseconds(created_ms));
+    }
+    uint64_t duration() const;
+    // chunks of a type overlapping [t0, t1), in file order
+    std::vector<entry_t> find(uint16_t type, uint64_t t0 = 0, 
+        uint64_t t1 = UINT64_MAX) const;
+    std::string_view payload(const entry_t& entry) const;
+    // the payloads of a type concatenated, like the old text outputs
+    std::string text(uint16_t type, uint64_t t0 = 0, uint64_t t1 = UINT64_MAX) const;
+    // decodes only the blocks overlapping [t0, t1)
+    std::vector<float> audio(uint64_t t0 = 0, uint64_t t1 = UINT64_MAX) const;
+    // .mp3, .flac or .wav by the extension
+    int exportAudio(const std::string& filename, uint64_t t0 = 0, 
+        uint64_t t1 = UINT64_MAX) const;
+    int exportText(uint16_t type, const std::string& filename, 
+        uint64_t t0 = 0, uint64_t t1 = UINT64_MAX) const;
+
+private:
+    std::string filename;
+    int fd = -1;
+    bool writing = false;
+    int sample_rate = 16000;
+    uint64_t created_ms = 0;
+
+    // write side
+    mutable std::mutex mtx;
+    uint64_t end = 0; // where the next chunk goes
+    int block_ms = 2000;
+    std::chrono::milliseconds sync_interval{5000};
+    std::chrono::steady_clock::time_point last_sync;
+    std::vector<float> pending; // audio not yet a full block
+    uint64_t samples = 0; // appended, pending included
+    uint64_t block_start = 0; // first sample of pending
+
+    // read side
+    const char * data = nullptr;
+    size_t size = 0;
+
+    std::vector<entry_t> index;
+
+    int append_locked(uint16_t type, uint16_t flags, uint64_t t0, uint64_t t1, 
+        const std::string& payload);
+    int flush_audio_locked();
+    static int write_index(int fd, uint64_t end, const std::vector<entry_t>& index);
+    // the index from the footer, or by walking the chunks; returns where
+    // the last good chunk ends
+    static uint64_t load_index(const char * data, size_t size, 
+        std::vector<entry_t>& index, bool& closed);
+};
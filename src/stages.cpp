@@ -0,0 +1,387 @@
+#include "stages.h"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+CaptureStage::CaptureStage(Audio * audio)
+    : audio(audio), out(add_output<audio_chunk_t>("audio")) {
+}
+
+int CaptureStage::init(const nlohmann::json& config) {
+    if (!audio) return -1;
+    chunk_ms = std::max(config.value("chunk_ms", 100), 10);
+    threads = 1; // one reader keeps the samples in order
+    return 0;
+}
+
+void CaptureStage::run(int worker) {
+    (void)worker;
+    while (!stopping()) {
+        audio_chunk_t chunk;
+        chunk.samples = audio->readAudio(chunk_ms);
+        if (chunk.samples.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(chunk_ms / 2));
+            continue;
+        }
+        chunk.first_sample = next_sample;
+        chunk.sample_rate = audio->getSampleRate();
+        chunk.time = std::chrono::steady_clock::now();
+        next_sample += chunk.samples.size();
+        out.emit(chunk);
+    }
+}
+
+IngestStage::IngestStage()
+    : out(add_output<audio_chunk_t>("audio")) {
+}
+
+int IngestStage::init(const nlohmann::json& config) {
+    sample_rate = config.value("sample_rate", 16000);
+    queue = std::make_unique<BoundedQueue<std::vector<float>>>(
+        config.value("queue_capacity", 32));
+    threads = 1;
+    return 0;
+}
+
+void IngestStage::run(int worker) {
+    (void)worker;
+    std::vector<float> samples;
+    uint64_t next_sample = 0;
+    while (queue->pop(samples)) {
+        audio_chunk_t chunk;
+        chunk.first_sample = next_sample;
+        chunk.sample_rate = sample_rate;
+        chunk.time = std::chrono::steady_clock::now();
+        next_sample += samples.size();
+        chunk.samples = std::move(samples);
+        out.emit(chunk);
+    }
+}
+
+void IngestStage::stop() {
+    queue->close();
+}
+
+bool IngestStage::push(std::vector<float> samples) {
+    if (samples.empty()) return true;
+    size_t n = samples.size();
+    if (!queue->push(std::move(samples))) return false;
+    pushed += n;
+    return true;
+}
+
+void IngestStage::finish() {
+    queue->close();
+}
+
+VadStage::VadStage()
+    : in(add_input<audio_chunk_t>("audio")), out(add_output<audio_chunk_t>("audio")) {
+}
+
+int VadStage::init(const nlohmann::json& config) {
+    frame_ms = std::max(config.value("frame_ms", 20), 5);
+    threshold_db = config.value("threshold_db", -50.0);
+    margin_db = config.value("margin_db", 10.0);
+    hangover_ms = config.value("hangover_ms", 500);
+    preroll_ms = config.value("preroll_ms", 200);
+    threads = 1; // the noise floor follows the stream in order
+    return 0;
+}
+
+void VadStage::run(int worker) {
+    (void)worker;
+    double floor_db = 0;
+    bool has_floor = false;
+    bool speaking = false;
+    int silent_ms = 0;
+    audio_chunk_t preroll; // the quiet audio right before the current frame
+    audio_chunk_t speech;
+    audio_chunk_t chunk;
+    while (in.pop(chunk)) {
+        size_t frame = std::max<size_t>(static_cast<size_t>(chunk.sample_rate) * frame_ms / 1000, 1);
+        size_t preroll_samples = static_cast<size_t>(chunk.sample_rate) * preroll_ms / 1000;
+        for (size_t i = 0; i < chunk.samples.size(); i += frame) {
+            size_t n = std::min(frame, chunk.samples.size() - i);
+            const float * samples = chunk.samples.data() + i;
+            double energy = 0;
+            for (size_t j = 0; j < n; ++j) energy += samples[j] * samples[j];
+            double db = 10 * std::log10(energy / n + 1e-10);
+            // the floor drops to a quiet frame fast and rises to a loud
+            // one slowly, so speech barely moves it
+            if (!has_floor) floor_db = db;
+            floor_db = db < floor_db ? floor_db * 0.9 + db * 0.1 : floor_db * 0.999 + db * 0.001;
+            has_floor = true;
+            bool voiced = db > std::max(threshold_db, floor_db + margin_db);
+
+            if (!speaking && !voiced) {
+                if (preroll.samples.empty()) preroll.first_sample = chunk.first_sample + i;
+                preroll.samples.insert(preroll.samples.end(), samples, samples + n);
+                if (preroll.samples.size() > preroll_samples) {
+                    size_t drop = preroll.samples.size() - preroll_samples;
+                    preroll.samples.erase(preroll.samples.begin(), preroll.samples.begin() + drop);
+                    preroll.first_sample += drop;
+                }
+                continue;
+            }
+            if (!speaking) {
+                speaking = true;
+                speech = std::move(preroll);
+                speech.sample_rate = chunk.sample_rate;
+                preroll = audio_chunk_t();
+            }
+            if (speech.samples.empty()) speech.first_sample = chunk.first_sample + i;
+            speech.samples.insert(speech.samples.end(), samples, samples + n);
+            silent_ms = voiced ? 0 : silent_ms + frame_ms;
+            if (silent_ms >= hangover_ms) {
+                speech.time = chunk.time;
+                out.emit(speech);
+                out.emit(audio_chunk_t()); // the end of the utterance
+                speech = audio_chunk_t();
+                speaking = false;
+                silent_ms = 0;
+            }
+        }
+        // what was heard of the utterance so far goes on with every chunk
+        if (!speech.samples.empty()) {
+            speech.sample_rate = chunk.sample_rate;
+            speech.time = chunk.time;
+            out.emit(speech);
+            speech = audio_chunk_t();
+        }
+    }
+    if (speaking) out.emit(audio_chunk_t());
+}
+
+AsrStage::AsrStage(ASR * asr)
+    : asr(asr), in(add_input<audio_chunk_t>("audio")),
+      out(add_output<text_event_t>("text")) {
+}
+
+int AsrStage::init(const nlohmann::json& config) {
+    if (!asr) return -1;
+    sample_rate = asr->getSampleRate();
+    int chunk_time = config.value("chunk_time", asr->getChunkTime());
+    int overlap_time = std::min(config.value("overlap_time", asr->getOverlapTime()), chunk_time);
+    int min_time = std::min(config.value("min_time", 300), chunk_time);
+    window_samples = static_cast<size_t>(chunk_time) * sample_rate / 1000;
+    overlap_samples = static_cast<size_t>(overlap_time) * sample_rate / 1000;
+    min_samples = static_cast<size_t>(min_time) * sample_rate / 1000;
+    latency = &Metrics::instance().histogram("voicelint_asr_buffer_to_asr_seconds", 
+        "Time from the newest audio of a window leaving the buffer to its recognition", 
+        {{"stage", getName()}});
+    return 0;
+}
+
+void AsrStage::run(int worker) {
+    (void)worker;
+    while (true) {
+        uint64_t window = 0;
+        std::vector<float> samples;
+        uint64_t first = 0;
+        uint64_t end = 0;
+        std::chrono::steady_clock::time_point time;
+        {
+            std::lock_guard<std::mutex> lk(window_mtx);
+            audio_chunk_t chunk;
+            bool cut = false;
+            while (!cut && (pending.size() < window_samples || fresh == 0)) {
+                if (!in.pop(chunk)) {
+                    if (fresh < min_samples) return;
+                    cut = true;
+                } else if (chunk.samples.empty()) {
+                    cut = fresh >= min_samples;
+                } else {
+                    if (pending.empty()) pending_first = chunk.first_sample;
+                    pending.insert(pending.end(), chunk.samples.begin(), chunk.samples.end());
+                    pending_end = chunk.first_sample + chunk.samples.size();
+                    pending_time = chunk.time;
+                    fresh += chunk.samples.size();
+                }
+            }
+            window = next_window++;
+            samples = pending;
+            first = pending_first;
+            end = pending_end;
+            time = pending_time;
+            // the next utterance starts clean, a full window carries the
+            // overlap into the next one
+            size_t keep = cut ? 0 : std::min(overlap_samples, pending.size());
+            pending.erase(pending.begin(), pending.end() - keep);
+            pending_first = end - keep;
+            fresh = 0;
+        }
+
+        text_event_t event;
+        event.name = "asr";
+        if (time.time_since_epoch().count()) latency->observe(std::chrono::steady_clock::now() - time);
+        event.text = asr->recognize(samples);
+        event.t0 = first * 1000 / sample_rate;
+        event.t1 = end * 1000 / sample_rate;
+        deliver(window, std::move(event));
+    }
+}
+
+void AsrStage::deliver(uint64_t window, text_event_t event) {
+    std::lock_guard<std::mutex> lk(order_mtx);
+    done[window] = std::move(event);
+    for (auto it = done.begin(); it != done.end() && it->first == next_out;
+        it = done.erase(it), ++next_out) {
+        if (it->second.text.empty()) continue;
+        asr->saveResult(it->second.text);
+        out.emit(it->second);
+    }
+}
+
+LlmStage::LlmStage(LLM * llm)
+    : llm(llm), in(add_input<text_event_t>("text")),
+      out(add_output<text_event_t>("text")) {
+}
+
+LlmStage::~LlmStage() {
+    if (llm) llm->setCallback(nullptr);
+}
+
+int LlmStage::init(const nlohmann::json& config) {
+    (void)config;
+    if (!llm) return -1;
+    threads = 1;
+    llm->setCallback([this](const std::string& name, const std::string& result) {
+        text_event_t event;
+        event.name = name;
+        event.text = result;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            // a refine block picks up where the last one ended, a summary
+            // covers everything heard so far
+            event.t0 = name == "refine" ? refined : name == "summarize" ? 0 : heard;
+            event.t1 = heard;
+            if (name == "refine") refined = heard;
+        }
+        out.emit(event);
+    });
+    return 0;
+}
+
+void LlmStage::run(int worker) {
+    (void)worker;
+    text_event_t event;
+    while (in.pop(event)) {
+        if (event.name != "asr") continue;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            heard = std::max(heard, event.t1);
+        }
+        llm->refine(event.text);
+    }
+}
+
+void LlmStage::drain() {
+    llm->drain();
+    llm->shutdown();
+}
+
+DisplayStage::DisplayStage(show_t show)
+    : show(std::move(show)), in(add_input<text_event_t>("text")) {
+}
+
+int DisplayStage::init(const nlohmann::json& config) {
+    (void)config;
+    threads = 1; // lines show up in the order they came
+    return show ? 0 : -1;
+}
+
+void DisplayStage::run(int worker) {
+    (void)worker;
+    text_event_t event;
+    while (in.pop(event)) show(event.name, event.text);
+}
+
+EventStage::EventStage(sink_t sink)
+    : sink(std::move(sink)), in(add_input<text_event_t>("text")) {
+}
+
+int EventStage::init(const nlohmann::json& config) {
+    (void)config;
+    threads = 1;
+    return sink ? 0 : -1;
+}
+
+void EventStage::run(int worker) {
+    (void)worker;
+    text_event_t event;
+    while (in.pop(event)) sink(event);
+}
+
+PublishStage::PublishStage(Publisher * publisher)
+    : publisher(publisher), in(add_input<text_event_t>("text")) {
+}
+
+int PublishStage::init(const nlohmann::json& config) {
+    (void)config;
+    threads = 1;
+    return publisher ? 0 : -1;
+}
+
+void PublishStage::run(int worker) {
+    (void)worker;
+    text_event_t event;
+    while (in.pop(event)) publisher->publish(event.name, event.text, event.t0, event.t1);
+}
+
+SessionFileStage::SessionFileStage(SessionFile * file)
+    : file(file), audio(add_input<audio_chunk_t>("audio")),
+      text(add_input<text_event_t>("text")) {
+}
+
+int SessionFileStage::init(const nlohmann::json& config) {
+    (void)config;
+    if (!file) return -1;
+    threads = 2;
+    return 0;
+}
+
+void SessionFileStage::run(int worker) {
+    if (worker == 0) {
+        audio_chunk_t chunk;
+        while (audio.pop(chunk)) {
+            file->appendAudio(chunk.samples.data(), chunk.samples.size());
+        }
+        return;
+    }
+    static const std::map<std::string, uint16_t> types = {
+        {"asr", SessionFile::chunk_asr},
+        {"refine", SessionFile::chunk_refine},
+        {"summarize", SessionFile::chunk_summary}
+    };
+    text_event_t event;
+    while (text.pop(event)) {
+        auto type = types.find(event.name);
+        if (type == types.end()) continue;
+        file->append(type->second, event.t0, event.t1, event.text);
+    }
+}
+
+nlohmann::json default_pipeline() {
+    return {
+        {"queue_capacity", 64},
+        {"stages", {
+            {{"name", "mic"}, {"type", "capture"}, {"chunk_ms", 100}},
+            {{"name", "asr"}, {"type", "asr"}, {"threads", 1}},
+            {{"name", "llm"}, {"type", "llm"}},
+            {{"name", "display"}, {"type", "display"}},
+            {{"name", "recorder"}, {"type", "session_file"}},
+            {{"name", "publisher"}, {"type", "publish"}}
+        }},
+        {"edges", {
+            {{"from", "mic.audio"}, {"to", "asr.audio"}},
+            {{"from", "mic.audio"}, {"to", "recorder.audio"}, {"capacity", 256}},
+            {{"from", "asr.text"}, {"to", "llm.text"}},
+            {{"from", "asr.text"}, {"to", "display.text"}},
+            {{"from", "asr.text"}, {"to", "recorder.text"}},
+            {{"from", "llm.text"}, {"to", "display.text"}},
+            {{"from", "llm.text"}, {"to", "recorder.text"}},
+            {{"from", "asr.text"}, {"to", "publisher.text"}},
+            {{"from", "llm.text"}, {"to", "publisher.text"}}
+        }}
+    };
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "asr.h"
+#include "audio.h"
+#include "graph.h"
+#include "llm.h"
+#include "publisher.h"
+#include "session_file.h"
+
+// mono samples; first_sample counts from the start of the stream and is
+// the clock every later message is stamped with. time is when the samples
+// left the capture buffer or the client, for the latency metrics.
+typedef struct _audio_chunk_t {
+    std::vector<float> samples;
+    uint64_t first_sample = 0;
+    int sample_rate = 16000;
+    std::chrono::steady_clock::time_point time;
+} audio_chunk_t;
+
+// name: "asr", "refine", "summarize", "log"; t0 and t1 are ms of audio
+typedef struct _text_event_t {
+    std::string name;
+    std::string text;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
+} text_event_t;
+
+// the stages of one recording session, wired as default_pipeline() below
+// unless the config has a "graph" block. Each binds a module passed in by
+// whoever defines the stage type on the graph.
+
+// "capture": the capture buffer of an Audio in pieces of chunk_ms
+class CaptureStage : public Stage {
+public:
+    explicit CaptureStage(Audio * audio);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    Audio * audio;
+    Output<audio_chunk_t>& out;
+    int chunk_ms = 100;
+    uint64_t next_sample = 0;
+};
+
+// "ingest": audio pushed by another thread, a client of the server; push
+// waits while the queue is full so a client cannot outrun the pipeline
+class IngestStage : public Stage {
+public:
+    IngestStage();
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+    void stop() override;
+
+    // mono samples at sample_rate; false once finished
+    bool push(std::vector<float> samples);
+    // the end of the stream, what was pushed still goes through
+    void finish();
+    // samples pushed so far
+    uint64_t position() const {
+        return pushed;
+    }
+
+private:
+    Output<audio_chunk_t>& out;
+    std::unique_ptr<BoundedQueue<std::vector<float>>> queue;
+    int sample_rate = 16000;
+    std::atomic<uint64_t> pushed = 0;
+};
+
+// "vad": passes on the speech only. A frame is speech when its energy is
+// margin_db above the noise floor it tracks and above threshold_db; speech
+// keeps preroll_ms of audio before it and ends after hangover_ms of
+// silence, marked by an empty chunk.
+class VadStage : public Stage {
+public:
+    VadStage();
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    Input<audio_chunk_t>& in;
+    Output<audio_chunk_t>& out;
+    int frame_ms = 20;
+    double threshold_db = -50;
+    double margin_db = 10;
+    int hangover_ms = 500;
+    int preroll_ms = 200;
+};
+
+// "asr": cuts the audio into windows of chunk_time that overlap by
+// overlap_time; windows are recognized on "threads" workers and the text
+// leaves in window order. The end of an utterance from a vad stage, or the
+// end of the stream, cuts a window short once it has min_time of new audio.
+class AsrStage : public Stage {
+public:
+    explicit AsrStage(ASR * asr);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    ASR * asr;
+    Input<audio_chunk_t>& in;
+    Output<text_event_t>& out;
+    size_t window_samples = 0;
+    size_t overlap_samples = 0;
+    size_t min_samples = 0;
+
+    std::mutex window_mtx; // one worker takes audio at a time
+    std::vector<float> pending;
+    uint64_t pending_first = 0;
+    uint64_t pending_end = 0; // vad leaves gaps, first + size is not the end
+    size_t fresh = 0; // pending samples not in the last window
+    std::chrono::steady_clock::time_point pending_time; // of the latest chunk
+    Histogram * latency = nullptr;
+    int sample_rate = 16000;
+    uint64_t next_window = 0;
+
+    std::mutex order_mtx;
+    std::map<uint64_t, text_event_t> done; // recognized out of order
+    uint64_t next_out = 0;
+    void deliver(uint64_t window, text_event_t event);
+};
+
+// "llm": ASR text in, refine and summary results out. The LLM keeps its
+// own lanes; the stage stamps the results with the audio they cover.
+class LlmStage : public Stage {
+public:
+    explicit LlmStage(LLM * llm);
+    ~LlmStage();
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+    // lets the requests in flight finish
+    void drain() override;
+
+private:
+    LLM * llm;
+    Input<text_event_t>& in;
+    Output<text_event_t>& out;
+    std::mutex mtx;
+    uint64_t heard = 0; // end of the latest ASR text
+    uint64_t refined = 0; // end of the latest refine block
+};
+
+// "display": events to a show(name, text) function, in order
+class DisplayStage : public Stage {
+public:
+    typedef std::function<void(const std::string&, const std::string&)> show_t;
+    explicit DisplayStage(show_t show);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    show_t show;
+    Input<text_event_t>& in;
+};
+
+// "events": every event with its times to a function, in order
+class EventStage : public Stage {
+public:
+    typedef std::function<void(const text_event_t&)> sink_t;
+    explicit EventStage(sink_t sink);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    sink_t sink;
+    Input<text_event_t>& in;
+};
+
+// "publish": events to a Publisher, one worker as the ring has one writer
+class PublishStage : public Stage {
+public:
+    explicit PublishStage(Publisher * publisher);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    Publisher * publisher;
+    Input<text_event_t>& in;
+};
+
+// "session_file": audio and text into a SessionFile, a worker per input
+class SessionFileStage : public Stage {
+public:
+    explicit SessionFileStage(SessionFile * file);
+    int init(const nlohmann::json& config) override;
+    void run(int worker) override;
+
+private:
+    SessionFile * file;
+    Input<audio_chunk_t>& audio;
+    Input<text_event_t>& text;
+};
+
+// mic -> asr -> llm, with the display, the session file and the publisher
+// listening
+nlohmann::json default_pipeline();
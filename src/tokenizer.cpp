@@ -0,0 +1,382 @@
+#include "tokenizer.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "httplib.h"
+
+// decode one UTF-8 sequence at text[pos], advancing pos; invalid bytes are
+// returned as is so that counting never gets stuck
+static uint32_t next_codepoint(const std::string& text, size_t& pos) {
+    unsigned char c = text[pos];
+    int n = 0;
+    uint32_t cp = c;
+    if (c >= 0xF0) { n = 3; cp = c & 0x07; }
+    else if (c >= 0xE0) { n = 2; cp = c & 0x0F; }
+    else if (c >= 0xC0) { n = 1; cp = c & 0x1F; }
+    if (n && pos + n >= text.size()) {
+        n = 0;
+        cp = c;
+    }
+    for (int i = 1; i <= n; ++i) {
+        if ((text[pos + i] & 0xC0) != 0x80) {
+            n = 0;
+            cp = c;
+            break;
+        }
+        cp = (cp << 6) | (text[pos + i] & 0x3F);
+    }
+    pos += n + 1;
+    return cp;
+}
+
+static std::string encode_codepoint(uint32_t cp) {
+    std::string s;
+    if (cp < 0x80) {
+        s += char(cp);
+    } else if (cp < 0x800) {
+        s += char(0xC0 | (cp >> 6));
+        s += char(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        s += char(0xE0 | (cp >> 12));
+        s += char(0x80 | ((cp >> 6) & 0x3F));
+        s += char(0x80 | (cp & 0x3F));
+    } else {
+        s += char(0xF0 | (cp >> 18));
+        s += char(0x80 | ((cp >> 12) & 0x3F));
+        s += char(0x80 | ((cp >> 6) & 0x3F));
+        s += char(0x80 | (cp & 0x3F));
+    }
+    return s;
+}
+
+static bool is_space(uint32_t cp) {
+    return cp == ' ' || cp == '\t' || cp == '\r' || cp == '\n' || cp == 0x3000;
+}
+
+static bool is_digit(uint32_t cp) {
+    return cp >= '0' && cp <= '9';
+}
+
+static bool is_cjk_punct(uint32_t cp) {
+    return (cp >= 0x2000 && cp <= 0x206F) || (cp >= 0x3000 && cp <= 0x303F)
+        || (cp >= 0xFF00 && cp <= 0xFF0F) || (cp >= 0xFF1A && cp <= 0xFF20)
+        || (cp >= 0xFF3B && cp <= 0xFF40) || (cp >= 0xFF5B && cp <= 0xFF65);
+}
+
+static bool is_letter(uint32_t cp) {
+    if (cp < 0x80) return (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z');
+    return !is_cjk_punct(cp) && !is_space(cp);
+}
+
+// sentence terminators, '.' only counts when followed by whitespace
+static bool is_terminator(uint32_t cp) {
+    return cp == 0x3002 || cp == 0xFF01 || cp == 0xFF1F || cp == 0xFF1B
+        || cp == 0x2026 || cp == '!' || cp == '?' || cp == ';' || cp == '\n';
+}
+
+static bool is_closing(uint32_t cp) {
+    return cp == 0x201D || cp == 0x2019 || cp == 0x300D || cp == 0x300F
+        || cp == 0xFF09 || cp == '"' || cp == '\'' || cp == ')';
+}
+
+Tokenizer::Tokenizer() = default;
+
+Tokenizer::~Tokenizer() = default;
+
+int Tokenizer::init(const nlohmann::json& config, 
+    const std::string& schema_host_port) {
+    this->schema_host_port = schema_host_port;
+    std::string name = config.value("type", "server");
+    if (name == "server") {
+        type = TOKENIZER_SERVER;
+    } else if (name == "local") {
+        if (load_bpe(config.value("path", "")) != 0) {
+            std::cerr << "Failed to load tokenizer, using estimate." << std::endl;
+            type = TOKENIZER_ESTIMATE;
+            return -1;
+        }
+        type = TOKENIZER_LOCAL;
+    } else {
+        type = TOKENIZER_ESTIMATE;
+    }
+    return 0;
+}
+
+int Tokenizer::load_bpe(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) return -1;
+
+    nlohmann::json tokenizer;
+    try {
+        file >> tokenizer;
+        const auto& merges = tokenizer["model"]["merges"];
+        merge_ranks.reserve(merges.size());
+        for (int i = 0; i < merges.size(); ++i) {
+            std::string key;
+            if (merges[i].is_array()) {
+                key = merges[i][0].get<std::string>() + " " +
+                    merges[i][1].get<std::string>();
+            } else {
+                key = merges[i].get<std::string>();
+            }
+            merge_ranks.emplace(key, i);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing " << path << ": " << e.what() << std::endl;
+        return -1;
+    }
+    if (merge_ranks.empty()) return -1;
+
+    // GPT-2 byte to unicode table, printable bytes map to themselves
+    int n = 0;
+    for (int b = 0; b < 256; ++b) {
+        bool printable = (b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC)
+            || (b >= 0xAE && b <= 0xFF);
+        byte_encoder[b] = encode_codepoint(printable ? b : 256 + n++);
+    }
+    return 0;
+}
+
+int Tokenizer::bpe_count(const std::string& word) {
+    int value = 0;
+    if (word_cache.get(word, value)) return value;
+
+    std::vector<std::string> symbols;
+    symbols.reserve(word.size());
+    for (unsigned char c: word) {
+        symbols.push_back(byte_encoder[c]);
+    }
+    while (symbols.size() > 1) {
+        int best_rank = -1;
+        size_t best = 0;
+        for (size_t i = 0; i + 1 < symbols.size(); ++i) {
+            auto it = merge_ranks.find(symbols[i] + " " + symbols[i + 1]);
+            if (it != merge_ranks.end()
+                && (best_rank < 0 || it->second < best_rank)) {
+                best_rank = it->second;
+                best = i;
+            }
+        }
+        if (best_rank < 0) break;
+        const std::string first = symbols[best];
+        const std::string second = symbols[best + 1];
+        std::vector<std::string> merged;
+        merged.reserve(symbols.size());
+        for (size_t i = 0; i < symbols.size(); ++i) {
+            if (i + 1 < symbols.size() && symbols[i] == first
+                && symbols[i + 1] == second) {
+                merged.push_back(first + second);
+                ++i;
+            } else {
+                merged.push_back(symbols[i]);
+            }
+        }
+        symbols.swap(merged);
+    }
+    value = symbols.size();
+    word_cache.put(word, value);
+    return value;
+}
+
+// several texts are tokenized as one and every token counts for the text
+// its first byte is in; a token across a boundary is rare and only moves
+// one count to the neighbour
+std::vector<int> Tokenizer::server_count(const std::vector<std::string>& texts) {
+    std::vector<int> counts(texts.size(), -1);
+    if (texts.empty()) return counts;
+    std::string content;
+    for (const auto& text: texts) content += text;
+    bool pieces = texts.size() > 1;
+    nlohmann::json body = {{"content", content}, {"add_special", false},
+        {"with_pieces", pieces}};
+    try {
+        std::lock_guard<std::mutex> lk(client_mtx);
+        if (!client) {
+            client = std::make_unique<httplib::Client>(schema_host_port);
+            client->set_keep_alive(true);
+        }
+        auto res = client->Post("/tokenize", body.dump(-1, ' ', false, 
+            nlohmann::json::error_handler_t::replace), "application/json");
+        if (!res || res->status != 200) {
+            if (!server_failed.exchange(true)) {
+                std::cout << "Tokenize failed, estimating token counts." << std::endl;
+            }
+            return counts;
+        }
+        auto tokens = nlohmann::json::parse(res->body)["tokens"];
+        if (!pieces) {
+            counts[0] = tokens.size();
+            return counts;
+        }
+        std::fill(counts.begin(), counts.end(), 0);
+        size_t offset = 0;
+        size_t index = 0;
+        size_t end = texts[0].size();
+        for (const auto& token: tokens) {
+            while (offset >= end && index + 1 < texts.size()) end += texts[++index].size();
+            ++counts[index];
+            // the piece is a string, or its bytes when it is not valid UTF-8
+            const auto& piece = token["piece"];
+            offset += piece.is_string() ? piece.get<std::string>().size() : piece.size();
+        }
+    } catch (const std::exception& e) {
+        if (!server_failed.exchange(true)) {
+            std::cout << "Error tokenize, estimating token counts: " << e.what() << std::endl;
+        }
+        std::fill(counts.begin(), counts.end(), -1);
+    }
+    return counts;
+}
+
+std::vector<int> Tokenizer::count(const std::vector<std::string>& texts) {
+    std::vector<int> values(texts.size(), -1);
+    std::vector<std::string> missing;
+    std::vector<size_t> missing_index;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        if (texts[i].empty()) {
+            values[i] = 0;
+        } else if (!cache.get(texts[i], values[i])) {
+            values[i] = -1;
+            missing.push_back(texts[i]);
+            missing_index.push_back(i);
+        }
+    }
+    if (type == TOKENIZER_SERVER && !missing.empty()) {
+        auto counts = server_count(missing);
+        for (size_t k = 0; k < missing.size(); ++k) {
+            int value = counts[k] < 0 ? estimate(missing[k]) : counts[k];
+            values[missing_index[k]] = value;
+            cache.put(missing[k], value);
+        }
+    }
+    for (size_t i = 0; i < texts.size(); ++i) {
+        if (values[i] < 0) values[i] = count(texts[i]);
+    }
+    return values;
+}
+
+int Tokenizer::count(const std::string& text) {
+    if (text.empty()) return 0;
+    int value = 0;
+    if (cache.get(text, value)) return value;
+
+    value = -1;
+    if (type == TOKENIZER_SERVER) {
+        value = server_count({text})[0];
+    } else if (type == TOKENIZER_LOCAL) {
+        // pre-tokenize roughly like the Qwen2 / GPT-4 split pattern
+        std::vector<uint32_t> cps;
+        std::vector<size_t> offsets;
+        for (size_t pos = 0; pos < text.size(); ) {
+            offsets.push_back(pos);
+            cps.push_back(next_codepoint(text, pos));
+        }
+        offsets.push_back(text.size());
+        value = 0;
+        size_t i = 0;
+        while (i < cps.size()) {
+            size_t start = i;
+            uint32_t c = cps[i];
+            bool next_letter = i + 1 < cps.size() && is_letter(cps[i + 1]);
+            if (is_letter(c) || (!is_digit(c) && c != '\r' && c != '\n'
+                && next_letter)) {
+                ++i;
+                while (i < cps.size() && is_letter(cps[i])) ++i;
+            } else if (is_digit(c)) {
+                ++i;
+            } else if (!is_space(c) || (c == ' ' && i + 1 < cps.size()
+                && !is_space(cps[i + 1]) && !is_digit(cps[i + 1]))) {
+                ++i;
+                while (i < cps.size() && !is_space(cps[i]) && !is_letter(cps[i])
+                    && !is_digit(cps[i])) ++i;
+                while (i < cps.size() && (cps[i] == '\r' || cps[i] == '\n')) ++i;
+            } else {
+                size_t j = i;
+                size_t last_newline = 0;
+                while (j < cps.size() && is_space(cps[j])) {
+                    if (cps[j] == '\n' || cps[j] == '\r') last_newline = j + 1;
+                    ++j;
+                }
+                if (last_newline) i = last_newline;
+                else if (j < cps.size() && j - i > 1) i = j - 1;
+                else i = j;
+            }
+            value += bpe_count(text.substr(offsets[start], 
+                offsets[i] - offsets[start]));
+        }
+    }
+    if (value < 0) value = estimate(text);
+    cache.put(text, value);
+    return value;
+}
+
+std::string Tokenizer::tail(const std::string& text, int max_tokens) {
+    if (max_tokens <= 0 || text.empty()) return "";
+    auto sentences = split_sentences(text);
+    std::string result = "";
+    int tokens = 0;
+    for (auto it = sentences.rbegin(); it != sentences.rend(); ++it) {
+        tokens += count(*it);
+        if (tokens > max_tokens) break;
+        result = *it + result;
+    }
+    return result;
+}
+
+int Tokenizer::estimate(const std::string& text) {
+    int tokens = 0;
+    int word = 0;
+    for (size_t pos = 0; pos < text.size(); ) {
+        uint32_t cp = next_codepoint(text, pos);
+        if (cp < 0x80 && is_letter(cp)) {
+            ++word;
+            continue;
+        }
+        tokens += (word + 3) / 4;
+        word = 0;
+        if (!is_space(cp)) ++tokens;
+    }
+    tokens += (word + 3) / 4;
+    return tokens;
+}
+
+std::vector<std::string> Tokenizer::split_sentences(const std::string& text) {
+    std::vector<std::string> sentences;
+    size_t start = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        uint32_t cp = next_codepoint(text, pos);
+        bool end = is_terminator(cp);
+        if (cp == '.') {
+            size_t next = pos;
+            end = next >= text.size() || is_space(next_codepoint(text, next));
+        }
+        if (!end) continue;
+        // keep closing quotes, repeated punctuation and trailing spaces
+        while (pos < text.size()) {
+            size_t next = pos;
+            uint32_t c = next_codepoint(text, next);
+            if (!is_closing(c) && !is_space(c) && !is_terminator(c) && c != '.') break;
+            pos = next;
+        }
+        sentences.push_back(text.substr(start, pos - start));
+        start = pos;
+    }
+    if (start < text.size()) sentences.push_back(text.substr(start));
+    return sentences;
+}
+
+bool Tokenizer::is_sentence_end(const std::string& sentence) {
+    size_t pos = sentence.size();
+    while (pos > 0) {
+        size_t begin = pos - 1;
+        while (begin > 0 && (sentence[begin] & 0xC0) == 0x80) --begin;
+        size_t next = begin;
+        uint32_t cp = next_codepoint(sentence, next);
+        if (is_terminator(cp) || cp == '.') return true;
+        if (!is_closing(cp) && !is_space(cp)) return false;
+        pos = begin;
+    }
+    return false;
+}
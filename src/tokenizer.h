@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace httplib {
+class Client;
+}
+
+// counts model tokens for chunking, either through llama-server /tokenize or
+// a local byte-level BPE loaded from a HuggingFace tokenizer.json, falling
+// back to a per-character estimate when neither is available
+class Tokenizer {
+public:
+    Tokenizer();
+    ~Tokenizer();
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer operator=(const Tokenizer&) = delete;
+
+    // config: {"type": "server" | "local", "path": "models/.../tokenizer.json"}
+    int init(const nlohmann::json& config, const std::string& schema_host_port);
+
+    int count(const std::string& text);
+    // the counts of several texts, with a single /tokenize call for the
+    // ones not cached
+    std::vector<int> count(const std::vector<std::string>& texts);
+
+    // last sentences of text that fit in max_tokens
+    std::string tail(const std::string& text, int max_tokens);
+
+    static int estimate(const std::string& text);
+    // split after sentence punctuation, keeping the punctuation and any
+    // whitespace that follows it
+    static std::vector<std::string> split_sentences(const std::string& text);
+    static bool is_sentence_end(const std::string& sentence);
+
+private:
+    typedef enum {
+        TOKENIZER_ESTIMATE = 0,
+        TOKENIZER_SERVER,
+        TOKENIZER_LOCAL
+    } TokenizerType;
+    TokenizerType type = TOKENIZER_ESTIMATE;
+    std::string schema_host_port = "http://localhost:8080";
+
+    // byte-level BPE
+    std::unordered_map<std::string, int> merge_ranks;
+    std::string byte_encoder[256];
+    int load_bpe(const std::string& path);
+    int bpe_count(const std::string& word);
+    // -1 for a text the server did not count
+    std::vector<int> server_count(const std::vector<std::string>& texts);
+    std::mutex client_mtx;
+    std::unique_ptr<httplib::Client> client; // kept alive between calls
+    std::atomic<bool> server_failed = false; // the fallback is logged once
+
+    typedef struct _cache_t {
+        typedef std::pair<std::string, int> entry_t;
+        std::list<entry_t> lru;
+        std::unordered_map<std::string, std::list<entry_t>::iterator> index;
+        std::mutex mtx;
+        const size_t max_size = 8192;
+
+        bool get(const std::string& key, int& value) {
+            std::lock_guard<std::mutex> lk(mtx);
+            auto it = index.find(key);
+            if (it == index.end()) return false;
+            lru.splice(lru.begin(), lru, it->second);
+            value = it->second->second;
+            return true;
+        }
+
+        void put(const std::string& key, int value) {
+            std::lock_guard<std::mutex> lk(mtx);
+            auto it = index.find(key);
+            if (it != index.end()) {
+                it->second->second = value;
+                lru.splice(lru.begin(), lru, it->second);
+                return;
+            }
+            lru.emplace_front(key, value);
+            index[key] = lru.begin();
+            if (lru.size() > max_size) {
+                index.erase(lru.back().first);
+                lru.pop_back();
+            }
+        }
+    } cache_t;
+    cache_t cache;
+    cache_t word_cache;
+};
@@ -0,0 +1,213 @@
+#include "transcript.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Transcript::Transcript(size_t page_lines /* = 64 */, size_t max_pages /* = 16 */)
+    : page_lines(std::max<size_t>(page_lines, 1)),
+      max_pages(std::max<size_t>(max_pages, 1)) {
+}
+
+Transcript::~Transcript() {
+    close();
+}
+
+int Transcript::open(const std::string& filename, bool truncate /* = true */) {
+    close();
+    std::lock_guard<std::mutex> lk(mtx);
+    auto parent = std::filesystem::path(filename).parent_path();
+    std::error_code ec;
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+    fd = ::open(filename.c_str(), flags, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << filename << ": " << std::strerror(errno) << std::endl;
+        return -1;
+    }
+    this->filename = filename;
+    offsets.assign(1, 0);
+
+    // index the lines already there
+    char buffer[65536];
+    uint64_t position = 0;
+    for (ssize_t n; (n = ::pread(fd, buffer, sizeof(buffer), position)) > 0; position += n) {
+        for (const char * p = buffer; (p = static_cast<const char *>(
+            std::memchr(p, '\n', buffer + n - p))); ++p) {
+            offsets.push_back(position + (p - buffer) + 1);
+        }
+    }
+    if (position > offsets.back() && ::ftruncate(fd, offsets.back()) != 0) {
+        std::cerr << "Failed to drop the torn line of " << filename << std::endl;
+    }
+    return 0;
+}
+
+void Transcript::close() {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    offsets.assign(1, 0);
+    pages.clear();
+    lru.clear();
+}
+
+bool Transcript::isOpen() const {
+    std::lock_guard<std::mutex> lk(mtx);
+    return fd >= 0;
+}
+
+void Transcript::clear() {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (fd >= 0 && ::ftruncate(fd, 0) != 0) {
+        std::cerr << "Failed to truncate " << filename << std::endl;
+    }
+    offsets.assign(1, 0);
+    pages.clear();
+    lru.clear();
+}
+
+size_t Transcript::append(const std::string& text) {
+    std::string block;
+    std::vector<uint64_t> added;
+    std::lock_guard<std::mutex> lk(mtx);
+    if (fd < 0) return 0;
+    uint64_t end = offsets.back();
+    for (size_t start = 0; start < text.size();) {
+        size_t eol = text.find('\n', start);
+        if (eol == std::string::npos) eol = text.size();
+        block.append(text, start, eol - start);
+        block += '\n';
+        added.push_back(end + block.size());
+        start = eol + 1;
+    }
+    if (block.empty()) return 0;
+
+    for (size_t done = 0; done < block.size();) {
+        ssize_t n = ::pwrite(fd, block.data() + done, block.size() - done, end + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            std::cerr << "Failed to append to " << filename << ": "
+                << std::strerror(errno) << std::endl;
+            return 0;
+        }
+        done += n;
+    }
+    // the last page may have been cached partly filled
+    if (offsets.size() > 1) {
+        size_t number = (offsets.size() - 2) / page_lines;
+        auto it = pages.find(number);
+        if (it != pages.end()) {
+            lru.erase(it->second.second);
+            pages.erase(it);
+        }
+    }
+    offsets.insert(offsets.end(), added.begin(), added.end());
+    return added.size();
+}
+
+size_t Transcript::size() const {
+    std::lock_guard<std::mutex> lk(mtx);
+    return offsets.size() - 1;
+}
+
+uint64_t Transcript::bytes() const {
+    std::lock_guard<std::mutex> lk(mtx);
+    return offsets.back();
+}
+
+std::string Transcript::pread_locked(uint64_t offset, size_t size) const {
+    std::string data(size, '\0');
+    size_t done = 0;
+    while (fd >= 0 && done < size) {
+        ssize_t n = ::pread(fd, data.data() + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    data.resize(done);
+    return data;
+}
+
+Transcript::page_t Transcript::page(size_t number) const {
+    auto it = pages.find(number);
+    if (it != pages.end()) {
+        lru.splice(lru.begin(), lru, it->second.second);
+        return it->second.first;
+    }
+    size_t first = number * page_lines;
+    size_t last = std::min(first + page_lines, offsets.size() - 1);
+    auto lines = std::make_shared<std::vector<std::string>>();
+    if (first < last) {
+        std::string data = pread_locked(offsets[first], offsets[last] - offsets[first]);
+        for (size_t i = first; i < last; ++i) {
+            size_t begin = offsets[i] - offsets[first];
+            size_t size = offsets[i + 1] - offsets[i] - 1;
+            lines->push_back(begin < data.size() ? data.substr(begin, size) : "");
+        }
+    }
+    lru.push_front(number);
+    pages[number] = {lines, lru.begin()};
+    while (pages.size() > max_pages) {
+        pages.erase(lru.back());
+        lru.pop_back();
+    }
+    return lines;
+}
+
+std::vector<std::string> Transcript::lines(size_t first, size_t last) const {
+    std::lock_guard<std::mutex> lk(mtx);
+    last = std::min(last, offsets.size() - 1);
+    std::vector<std::string> result;
+    for (size_t i = first; i < last;) {
+        auto lines = page(i / page_lines);
+        size_t begin = i % page_lines;
+        size_t end = std::min(lines->size(), begin + (last - i));
+        if (begin >= end) break;
+        result.insert(result.end(), lines->begin() + begin, lines->begin() + end);
+        i += end - begin;
+    }
+    return result;
+}
+
+void Transcript::scan(size_t first, size_t last, 
+    const std::function<void(size_t, const std::string&)>& line) const {
+    const size_t block_lines = 1024;
+    for (size_t i = first; i < last; i += block_lines) {
+        std::vector<uint64_t> range;
+        std::string data;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            size_t end = std::min({last, i + block_lines, offsets.size() - 1});
+            if (i >= end) return;
+            range.assign(offsets.begin() + i, offsets.begin() + end + 1);
+            data = pread_locked(range.front(), range.back() - range.front());
+        }
+        for (size_t k = 0; k + 1 < range.size(); ++k) {
+            size_t begin = range[k] - range.front();
+            if (begin >= data.size()) return;
+            line(i + k, data.substr(begin, range[k + 1] - range[k] - 1));
+        }
+    }
+}
+
+std::string Transcript::read(uint64_t offset, size_t size) const {
+    std::lock_guard<std::mutex> lk(mtx);
+    if (offset >= offsets.back()) return "";
+    return pread_locked(offset, std::min<uint64_t>(size, offsets.back() - offset));
+}
+
+std::string Transcript::tail(size_t size) const {
+    std::lock_guard<std::mutex> lk(mtx);
+    uint64_t end = offsets.back();
+    uint64_t start = end > size ? end - size : 0;
+    std::string data = pread_locked(start, end - start);
+    // do not start inside a UTF-8 sequence
+    size_t skip = 0;
+    while (skip < data.size() && (data[skip] & 0xC0) == 0x80) ++skip;
+    return data.substr(skip);
+}
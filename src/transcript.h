@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// an append-only text log on disk with the line offsets in memory and a
+// small LRU cache of line pages, so a transcript of many hours costs a few
+// bytes per line in RAM and any range can be read back. The file is plain
+// text, one line per '\n', which is also what a crash leaves behind; a
+// torn last line is dropped when the file is reopened.
+class Transcript {
+public:
+    Transcript(size_t page_lines = 64, size_t max_pages = 16);
+    ~Transcript();
+    Transcript(const Transcript&) = delete;
+    Transcript operator=(const Transcript&) = delete;
+
+    // truncate or keep and index what is there
+    int open(const std::string& filename, bool truncate = true);
+    void close();
+    bool isOpen() const;
+    void clear();
+
+    // text with line breaks becomes several lines; returns the lines added
+    size_t append(const std::string& text);
+
+    size_t size() const; // lines
+    uint64_t bytes() const;
+
+    // lines [first, last), through the page cache
+    std::vector<std::string> lines(size_t first, size_t last) const;
+    // lines [first, last) read straight from the file, for one-off passes
+    // that would only evict the pages being scrolled
+    void scan(size_t first, size_t last, 
+        const std::function<void(size_t, const std::string&)>& line) const;
+    // raw bytes, lines still separated by '\n'
+    std::string read(uint64_t offset, size_t size) const;
+    std::string tail(size_t size) const;
+
+private:
+    const size_t page_lines;
+    const size_t max_pages;
+
+    std::string filename;
+    int fd = -1;
+    mutable std::mutex mtx;
+    std::vector<uint64_t> offsets{0}; // start of every line, then the end
+
+    typedef std::shared_ptr<const std::vector<std::string>> page_t;
+    mutable std::list<size_t> lru; // page numbers, most recent first
+    mutable std::unordered_map<size_t, std::pair<page_t, std::list<size_t>::iterator>> pages;
+
+    page_t page(size_t number) const;
+    std::string pread_locked(uint64_t offset, size_t size) const;
+};
@@ -1,4 +1,6 @@
 #include "ui.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <format>
 #include <fstream>
@@ -18,6 +20,8 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "metrics.h"
+
 static auto error_callback = [](
     int error_code, const char* description 
 ) {
@@ -29,10 +33,10 @@ typedef struct _user_data_t {
     Audio * audio;
     LLM * llm;
     bool& show_log;
+    bool& show_metrics;
     GLuint& waiting;
     GLuint& processing;
-    std::vector<std::string>& history;
-    int& current_history_index;
+    std::string& current_history;
 } user_data_t;
 
 static auto key_callback = [](GLFWwindow* window, int key, 
@@ -45,7 +49,7 @@ static auto key_callback = [](GLFWwindow* window, int key,
         && (mods & GLFW_MOD_CONTROL) != GLFW_MOD_CONTROL) {
         user_data->audio->start();
         user_data->ui->clear();
-        user_data->current_history_index = -1;
+        user_data->current_history.clear();
     }
     if (key == GLFW_KEY_P && action == GLFW_PRESS) {
         user_data->audio->stop();
@@ -53,6 +57,9 @@ static auto key_callback = [](GLFWwindow* window, int key,
     if (key == GLFW_KEY_L && action == GLFW_PRESS) {
         user_data->show_log = !user_data->show_log;
     }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        user_data->show_metrics = !user_data->show_metrics;
+    }
     if (key == GLFW_KEY_R && action == GLFW_PRESS) {
         user_data->llm->refine("");
     }
@@ -61,47 +68,6 @@ static auto key_callback = [](GLFWwindow* window, int key,
     }
 };
 
-static auto setup_fonts = [](const nlohmann::json& fonts) {
-    auto io = ImGui::GetIO();
-    ImFontConfig fc;
-    fc.MergeMode = false;
-    fc.OversampleH = fc.OversampleV = 3;
-    fc.PixelSnapH = false;
-    io.FontDefault = io.Fonts->AddFontFromFileTTF(
-        fonts[0]["filename"].get<std::string>().c_str(), 
-        fonts[0]["size"].get<float>(), 
-        &fc
-    );
-    for (int i=1; i<fonts.size(); ++i) {
-        const ImWchar * ranges = nullptr;
-        if (fonts[i]["language"].get<std::string>() == "chinese") {
-            ranges = io.Fonts->GetGlyphRangesChineseFull();
-        } else if (fonts[i]["language"].get<std::string>() == "greek") {
-            ranges = io.Fonts->GetGlyphRangesGreek();
-        } else if (fonts[i]["language"].get<std::string>() == "korean") {
-            ranges = io.Fonts->GetGlyphRangesKorean();
-        } else if (fonts[i]["language"].get<std::string>() == "japanese") {
-            ranges = io.Fonts->GetGlyphRangesJapanese();
-        } else if (fonts[i]["language"].get<std::string>() == "cyrillic") {
-            ranges = io.Fonts->GetGlyphRangesCyrillic();
-        } else if (fonts[i]["language"].get<std::string>() == "thai") {
-            ranges = io.Fonts->GetGlyphRangesThai();
-        } else if (fonts[i]["language"].get<std::string>() == "vietnamese") {
-            ranges = io.Fonts->GetGlyphRangesVietnamese();
-        } else {
-            continue;
-        }
-        fc.MergeMode = true;
-        io.Fonts->AddFontFromFileTTF(
-            fonts[i]["filename"].get<std::string>().c_str(), 
-            fonts[i]["size"].get<float>(), 
-            &fc,
-            ranges
-        );
-    }
-    io.Fonts->Build();
-};
-
 typedef void (*create_child_components)(const user_data_t&);
 static auto create_component = [](const user_data_t& user_data, 
     const ImVec2& pos, const ImVec2& size, const std::string& name, 
@@ -120,55 +86,6 @@ static auto create_component = [](const user_data_t& user_data,
     ImGui::End();
 };
 
-static std::vector<std::string> load_history() {
-    std::vector<std::string> history;
-    for (auto & entry: std::filesystem::directory_iterator("data")) {
-        if (entry.is_directory()) {
-            history.push_back(entry.path().filename().string());
-        }
-    }
-    if (!history.empty()) {
-        std::sort(history.begin(), history.end(), 
-            std::greater<std::string>());
-    }
-    return history;
-}
-
-static void load_history_to_ui(EchoNote::UI * ui, const std::string& history) {
-    const std::string path = "data/" + history;
-    ui->clear();
-    {
-        std::ifstream file(path + "/asr.txt");
-        if (file.is_open()) {
-            std::string line;
-            while (std::getline(file, line)) {
-                ui->show("asr", line);
-            }
-            file.close();
-        }
-    }
-    {
-        std::ifstream file(path + "/refine.txt");
-        if (file.is_open()) {
-            std::string line;
-            while (std::getline(file, line)) {
-                ui->show("refine", line);
-            }
-            file.close();
-        }
-    }
-    {
-        std::ifstream file(path + "/summarize.txt");
-        if (file.is_open()) {
-            std::string line = std::string(
-                std::istreambuf_iterator<char>(file), 
-                std::istreambuf_iterator<char>());
-            ui->show("summarize", line);
-            file.close();
-        }
-    }
-}
-
 static GLuint load_texture(const std::string& filename) {
     GLuint texture_id;
     glGenTextures(1, &texture_id);
@@ -195,6 +112,10 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
     std::string name = config.value("name", "EchoNote");
     int width = config.value("width", 1280);
     int height = config.value("height", 720);
+    // redraw period in ms while recording or the LLM is busy, so the
+    // status icons follow; otherwise only input and new text redraw
+    double busy_interval = config.value("busy_interval", 250) / 1000.0;
+    double idle_interval = config.value("idle_interval", 1000) / 1000.0;
     const float status_bar_height = 30.f;
     auto fonts = config.value("fonts", R"(
         [
@@ -229,6 +150,10 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
         return;
     }
     glfwMakeContextCurrent(window);
+    {
+        std::lock_guard<std::mutex> lk(window_mtx);
+        window_open = true;
+    }
 
     auto status_waiting = load_texture("res/images/emoji_1067.png");
     auto status_processing = load_texture("res/images/emoji_1068.png");
@@ -237,15 +162,28 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
         return;
     }
 
-    auto history = load_history();
-    //for (int i=0; i<100; ++i) history.push_back(std::to_string(i) + "_202506171800");
-    int current_history_index = -1;
+    // the transcript panels keep every line on disk and page them in while
+    // scrolling; summary and log stay in memory
+    const std::string spool = config.value("spool", "output");
+    if (asr_messages.open(spool + "/ui-asr.log") != 0
+        || refine_messages.open(spool + "/ui-refine.log") != 0) {
+        std::cout << "Transcript spool unavailable, keeping the last "
+            << asr_messages.max_size << " lines." << std::endl;
+    }
+
+    history.init("data");
+    if (index.init("data") == 0) index.refresh();
+    if (semantic.init(config.value("semantic", nlohmann::json::object()), "data") == 0) {
+        semantic.refresh();
+    }
+    std::string current_history;
 
     bool show_log = false;
+    bool show_metrics = false;
     user_data_t user_data = {
-        this, audio, llm, show_log, 
+        this, audio, llm, show_log, show_metrics,
         status_waiting, status_processing,
-        history, current_history_index
+        current_history
     };
     glfwSetWindowUserPointer(window, &user_data);
     glfwSetKeyCallback(window, key_callback);
@@ -257,15 +195,32 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init();
 
-    setup_fonts(fonts);
+    font_atlas.init(fonts, config.value("font_cache", nlohmann::json::object()));
 
+    // every wake-up draws one more frame, ImGui applies scrolling and
+    // layout changes a frame late
+    int settle_frames = 0;
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        bool busy = audio->isRecording() || llm->isRefine() || llm->isSummarize()
+            || history.isLoading();
+        if (settle_frames > 0) {
+            glfwPollEvents();
+            --settle_frames;
+        } else {
+            glfwWaitEventsTimeout(busy ? busy_interval : idle_interval);
+            settle_frames = 1;
+        }
         if (glfwGetWindowAttrib(window, GLFW_ICONIFIED)) {
-            ImGui_ImplGlfw_Sleep(10);
+            settle_frames = 0;
             continue;
         }
 
+        // glyphs first seen in the last frame are baked before this one
+        if (font_atlas.update()) {
+            ImGui_ImplOpenGL3_DestroyFontsTexture();
+            ImGui_ImplOpenGL3_CreateFontsTexture();
+            settle_frames = 1;
+        }
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -277,19 +232,58 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                 "History", 
                 [](const user_data_t& user_data) {
                     ImGui::SeparatorText("History");
+                    EchoNote::UI * ui = user_data.ui;
+                    // embedding the query takes a moment, so search by
+                    // meaning runs on enter instead of on every key
+                    auto run_search = [ui]() {
+                        ui->search_hits = ui->search_by_meaning ? 
+                            ui->semantic.search(ui->search_query) :
+                            ui->index.search(ui->search_query);
+                    };
+                    ImGui::SetNextItemWidth(-1.f);
+                    if (ImGui::InputTextWithHint("##search", "Search", 
+                        ui->search_query, sizeof(ui->search_query), 
+                        ui->search_by_meaning ? ImGuiInputTextFlags_EnterReturnsTrue : 0)) {
+                        run_search();
+                    }
+                    if (ui->semantic.ready() && ImGui::Checkbox("By meaning", 
+                        &ui->search_by_meaning)) {
+                        run_search();
+                    }
+                    if (ui->history.isLoading()) {
+                        ImGui::ProgressBar(ui->history.progress(), ImVec2(-1.f, 0.f));
+                    }
+                    if (ui->history.version() != ui->history_version) {
+                        ui->history_entries = ui->history.entries(ui->history_version);
+                        ui->index.refresh();
+                        ui->semantic.refresh();
+                    }
                     auto size = ImGui::GetContentRegionAvail();
                     ImGui::BeginChild("history", size);
-                    for (int i=0; i<user_data.history.size(); ++i) {
-                        bool is_selected = (i == user_data.current_history_index);
-                        ImGui::Selectable(user_data.history[i].c_str(), 
-                            is_selected);
-                        if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0)) {
-                            if (user_data.audio->isRecording()) {
-                                user_data.ui->log("Cannot load history while recording.");
-                                continue;
-                            }
-                            load_history_to_ui(user_data.ui, user_data.history[i]);
-                            user_data.current_history_index = i;
+                    auto open = [&](const std::string& name) {
+                        if (ImGui::IsItemHovered() && ImGui::IsMouseDoubleClicked(0)
+                            && ui->load_session(name, user_data.audio) == 0) {
+                            user_data.current_history = name;
+                        }
+                    };
+                    if (ui->search_query[0]) {
+                        for (size_t i = 0; i < ui->search_hits.size(); ++i) {
+                            const auto& hit = ui->search_hits[i];
+                            ImGui::PushID(int(i));
+                            ImGui::Selectable(hit.session.c_str(), 
+                                hit.session == user_data.current_history);
+                            open(hit.session);
+                            ImGui::PushTextWrapPos(0.f);
+                            ui->font_atlas.require(hit.snippet);
+                            ImGui::TextDisabled("%s", hit.snippet.c_str());
+                            ImGui::PopTextWrapPos();
+                            ImGui::PopID();
+                        }
+                    } else {
+                        for (const auto& name: *ui->history_entries) {
+                            bool is_selected = (name == user_data.current_history);
+                            ImGui::Selectable(name.c_str(), is_selected);
+                            open(name);
                         }
                     }
                     ImGui::EndChild();
@@ -303,17 +297,7 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                     ImGui::BeginChild("asr messages", ImVec2(0, 0), 
                         ImGuiChildFlags_None, 
                         ImGuiWindowFlags_AlwaysVerticalScrollbar);
-                    auto q = user_data.ui->asr_messages.snapshot();
-                    for (auto& text: q) {
-                        ImGui::TextWrapped("%s", text.c_str());
-                    }
-
-                    float scroll_y = ImGui::GetScrollY();
-                    float scroll_max_y = ImGui::GetScrollMaxY();
-                    float delta_y = scroll_max_y - scroll_y;
-                    bool auto_scroll = (delta_y > 1.0f) ? false : true;
-                    if (auto_scroll) ImGui::SetScrollHereY(1.0f);
-
+                    draw(user_data.ui->asr_messages, user_data.ui->asr_view);
                     ImGui::EndChild();
                 });
         }
@@ -327,17 +311,7 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                     ImGui::BeginChild("refine messages", ImVec2(0, 0), 
                         ImGuiChildFlags_None, 
                         ImGuiWindowFlags_AlwaysVerticalScrollbar);
-                    auto q = user_data.ui->refine_messages.snapshot();
-                    for (auto& text: q) {
-                        ImGui::TextWrapped("%s", text.c_str());
-                    }
-
-                    float scroll_y = ImGui::GetScrollY();
-                    float scroll_max_y = ImGui::GetScrollMaxY();
-                    float delta_y = scroll_max_y - scroll_y;
-                    bool auto_scroll = (delta_y > 1.0f) ? false : true;
-                    if (auto_scroll) ImGui::SetScrollHereY(1.0f);
-
+                    draw(user_data.ui->refine_messages, user_data.ui->refine_view);
                     ImGui::EndChild();
                 });
         }
@@ -351,7 +325,8 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                     ImGui::BeginChild("summary message", ImVec2(0, 0), 
                         ImGuiChildFlags_None, 
                         ImGuiWindowFlags_AlwaysVerticalScrollbar);
-                    ImGui::TextWrapped("%s", user_data.ui->summarize_message.c_str());
+                    draw(user_data.ui->summarize_message, 
+                        user_data.ui->summarize_view, false);
                     ImGui::EndChild();
                 });
         }
@@ -367,6 +342,7 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                         "Press 'R' to refine. "
                         "Press 'S' to summarize. "
                         "Press 'L' to show|hide log window. "
+                        "Press 'M' to show|hide performance. "
                     );
                 });
             ImGui::SameLine();
@@ -413,21 +389,21 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
                     ImGui::BeginChild("Log messages", ImVec2(0, 0), 
                         ImGuiChildFlags_None, 
                         ImGuiWindowFlags_AlwaysVerticalScrollbar);
-                    auto q = user_data.ui->log_messages.snapshot();
-                    for (auto& text: q) {
-                        ImGui::TextWrapped("%s", text.c_str());
-                    }
-
-                    float scroll_y = ImGui::GetScrollY();
-                    float scroll_max_y = ImGui::GetScrollMaxY();
-                    float delta_y = scroll_max_y - scroll_y;
-                    bool auto_scroll = (delta_y > 1.0f) ? false : true;
-                    if (auto_scroll) ImGui::SetScrollHereY(1.0f);
-
+                    draw(user_data.ui->log_messages, user_data.ui->log_view);
                     ImGui::EndChild();
                 }, false);
         }
 
+        if (show_metrics) {
+            create_component(user_data, {width * 0.2f, height * 0.15f}, 
+                {width * 0.6f, height * 0.7f},
+                "performance", 
+                [](const user_data_t& user_data) {
+                    ImGui::SeparatorText("Performance");
+                    user_data.ui->draw_metrics();
+                }, false);
+        }
+
         ImGui::Render();
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -435,24 +411,197 @@ void EchoNote::UI::show(const nlohmann::json& config, Audio * audio, LLM * llm)
         glfwSwapBuffers(window);
     }
 
+    history.shutdown();
+    index.shutdown();
+    semantic.shutdown();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    {
+        std::lock_guard<std::mutex> lk(window_mtx);
+        window_open = false;
+    }
     glfwDestroyWindow(window);
     glfwTerminate();
 }
 
+// latencies in ms, everything else as counted
+void EchoNote::UI::draw_metrics() {
+    auto now = std::chrono::steady_clock::now();
+    if (metrics_snapshot.is_null() || now - metrics_time > std::chrono::seconds(1)) {
+        metrics_snapshot = Metrics::instance().snapshot();
+        metrics_time = now;
+    }
+    if (ImGui::Button("Reset")) {
+        Metrics::instance().reset();
+        metrics_snapshot = nullptr;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders
+        | ImGuiTableFlags_ScrollY;
+    if (metrics_snapshot.is_null() || !ImGui::BeginTable("metrics", 6, flags)) return;
+    ImGui::TableSetupColumn("metric");
+    for (const char * column: {"count", "p50", "p90", "p99", "max"}) {
+        ImGui::TableSetupColumn(column);
+    }
+    ImGui::TableHeadersRow();
+    for (const auto& [name, value]: metrics_snapshot.items()) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(name.c_str());
+        ImGui::TableNextColumn();
+        if (!value.is_object()) {
+            ImGui::Text("%g", value.get<double>());
+            continue;
+        }
+        ImGui::Text("%llu", static_cast<unsigned long long>(value.value("count", 0ull)));
+        double scale = name.find("_seconds") != std::string::npos ? 1000 : 1;
+        for (const char * key: {"p50", "p90", "p99", "max"}) {
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", value.value(key, 0.0) * scale);
+        }
+    }
+    ImGui::EndTable();
+}
+
+// ImGuiListClipper needs items of one height and wrapped lines are not, so
+// the visible range comes from the measured line offsets instead; lines are
+// measured again only when the text or the panel width changes
+void EchoNote::UI::draw(queue_t& queue, view_t& view, 
+    bool auto_scroll /* = true */) {
+    float spacing = ImGui::GetStyle().ItemSpacing.y;
+    if (queue.version != view.version) {
+        uint64_t generation = 0;
+        size_t count = 0;
+        view.lines = queue.snapshot(view.version, generation, count);
+        if (generation != view.generation) {
+            view.generation = generation;
+            view.widths.clear();
+            view.heights.clear();
+            view.wrapped.clear();
+            view.dirty_from = 0;
+        }
+        // only lines not seen yet are read and measured
+        size_t measured = view.widths.size();
+        if (count > measured) {
+            view.widths.resize(count);
+            view.heights.resize(count);
+            auto measure = [&view](size_t i, const std::string& line) {
+                ImVec2 size = ImGui::CalcTextSize(line.data(), 
+                    line.data() + line.size());
+                view.widths[i] = size.x;
+                view.heights[i] = size.y;
+            };
+            if (queue.store) {
+                queue.store->scan(measured, count, measure);
+            } else {
+                for (size_t i = measured; i < count; ++i) measure(i, (*view.lines)[i]);
+            }
+        }
+    }
+
+    const size_t count = view.widths.size();
+    float wrap_width = ImGui::GetContentRegionAvail().x;
+    auto estimate = [&view, wrap_width](size_t i) {
+        float rows = wrap_width > 0.f ? 
+            std::max(1.f, std::ceil(view.widths[i] / wrap_width)) : 1.f;
+        return view.heights[i] * rows;
+    };
+    if (wrap_width != view.wrap_width) {
+        view.wrap_width = wrap_width;
+        view.wrapped.clear();
+        view.dirty_from = 0;
+    }
+    if (view.wrapped.size() != count) {
+        size_t from = std::min(view.wrapped.size(), count);
+        view.wrapped.resize(count);
+        for (size_t i = from; i < count; ++i) view.wrapped[i] = estimate(i);
+        view.dirty_from = std::min(view.dirty_from, from);
+    }
+    if (view.dirty_from < count || view.offsets.size() != count + 1) {
+        size_t from = std::min(view.dirty_from, view.offsets.empty() ? 
+            size_t(0) : view.offsets.size() - 1);
+        view.offsets.resize(count + 1);
+        view.offsets[0] = 0.f;
+        for (size_t i = from; i < count; ++i) {
+            view.offsets[i + 1] = view.offsets[i] + view.wrapped[i] + spacing;
+        }
+        view.dirty_from = count;
+    }
+
+    float top = ImGui::GetScrollY();
+    float bottom = top + ImGui::GetWindowHeight();
+    size_t first = std::upper_bound(view.offsets.begin(), view.offsets.end() - 1, 
+        top) - view.offsets.begin();
+    first = first > 0 ? first - 1 : 0;
+    size_t last = std::lower_bound(view.offsets.begin() + first, 
+        view.offsets.end() - 1, bottom) - view.offsets.begin();
+    lines_t visible = queue.store ? queue.store->lines(first, last) :
+        lines_t(view.lines->begin() + first, view.lines->begin() + last);
+    // each item advances the cursor by its height plus the item spacing
+    if (first > 0) ImGui::Dummy(ImVec2(0.f, view.offsets[first] - spacing));
+    ImGui::PushTextWrapPos(0.f);
+    for (size_t i = 0; i < visible.size(); ++i) {
+        const auto& line = visible[i];
+        instance().font_atlas.require(line);
+        ImGui::TextUnformatted(line.data(), line.data() + line.size());
+        // the estimate is replaced by the real height for the next frame
+        float height = ImGui::CalcTextSize(line.data(), line.data() + line.size(), 
+            false, wrap_width).y;
+        if (std::fabs(height - view.wrapped[first + i]) > 0.5f) {
+            view.wrapped[first + i] = height;
+            view.dirty_from = std::min(view.dirty_from, first + i);
+        }
+    }
+    ImGui::PopTextWrapPos();
+    if (last < count) {
+        ImGui::Dummy(ImVec2(0.f, view.offsets.back() - view.offsets[last] - spacing));
+    }
+
+    if (auto_scroll) {
+        float delta_y = ImGui::GetScrollMaxY() - ImGui::GetScrollY();
+        if (delta_y <= 1.0f) ImGui::SetScrollHereY(1.0f);
+    }
+}
+
 // name: "asr", "refine", "summarize", "log"
 void EchoNote::UI::show(const std::string& name, const std::string& text) {
     if (name == "asr") asr_messages.push(text);
     if (name == "refine") refine_messages.push(text);
-    if (name == "summarize") summarize_message = text;
+    if (name == "summarize") summarize_message.set(text);
     if (name == "log") log_messages.push(text);
+    wake();
+}
+
+// the files are read on the loader thread, the panels switch at once when
+// it is done. The live refine and summarize slots keep their cache,
+// refining goes on with the live transcript
+int EchoNote::UI::load_session(const std::string& name, Audio * audio) {
+    if (audio->isRecording()) {
+        log("Cannot load history while recording.");
+        return -1;
+    }
+    history.load(name, [this, audio](
+        std::shared_ptr<const History::transcript_t> transcript) {
+        // a recording started meanwhile owns the panels
+        if (audio->isRecording()) return;
+        asr_messages.assign(transcript->asr);
+        refine_messages.assign(transcript->refine);
+        summarize_message.set(transcript->summary);
+        wake();
+    });
+    return 0;
+}
+
+void EchoNote::UI::wake() {
+    std::lock_guard<std::mutex> lk(window_mtx);
+    if (window_open) glfwPostEmptyEvent();
 }
 
 void EchoNote::UI::clear() {
     asr_messages.clear();
     refine_messages.clear();
     summarize_message.clear(); 
+    wake();
 }
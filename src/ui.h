@@ -1,12 +1,21 @@
 #pragma once
 
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 #include <nlohmann/json.hpp>
 
 #include "audio.h"
+#include "fonts.h"
+#include "history.h"
 #include "llm.h"
+#include "search.h"
+#include "semantic.h"
+#include "transcript.h"
 
 namespace EchoNote {
 class UI {
@@ -34,31 +43,136 @@ private:
     UI() = default;
     ~UI() = default;
 
+    typedef std::vector<std::string> lines_t;
+
+    // writers publish a new immutable copy of the lines and bump version,
+    // the render thread only takes the lock when version moved. A queue
+    // with a store keeps every line on disk instead and the render thread
+    // reads back the ones on screen; generation moves whenever the lines
+    // are replaced rather than appended to.
     typedef struct _queue_t {
-        std::deque<std::string> q;
+        std::shared_ptr<const lines_t> lines = std::make_shared<lines_t>();
+        std::unique_ptr<Transcript> store;
+        std::atomic<uint64_t> version = 0;
+        uint64_t generation = 0;
         std::mutex mtx;
-        const int max_size = 150;
+        const size_t max_size = 150;
+
+        // keep every line in filename from now on, the lines so far move
+        // there too; set up before the render loop starts
+        int open(const std::string& filename) {
+            std::lock_guard<std::mutex> lk(mtx);
+            auto next = std::make_unique<Transcript>();
+            if (next->open(filename) != 0) return -1;
+            for (const auto& line: *lines) next->append(line);
+            lines = std::make_shared<lines_t>();
+            store = std::move(next);
+            ++generation;
+            ++version;
+            return 0;
+        }
 
         void push(const std::string& text) {
             std::lock_guard<std::mutex> lk(mtx);
-            if (q.size() >= max_size) q.pop_front();
-            q.push_back(text);
+            if (store) {
+                store->append(text);
+                ++version;
+                return;
+            }
+            auto next = std::make_shared<lines_t>();
+            size_t skip = lines->size() >= max_size ? 1 : 0;
+            next->reserve(lines->size() + 1 - skip);
+            next->assign(lines->begin() + skip, lines->end());
+            next->push_back(text);
+            lines = std::move(next);
+            ++generation;
+            ++version;
         }
 
-        std::deque<std::string> snapshot() {
+        // replace all lines at once, a loaded session is shown whole
+        void assign(const lines_t& text) {
             std::lock_guard<std::mutex> lk(mtx);
-            return q;
+            if (store) {
+                store->clear();
+                for (const auto& line: text) store->append(line);
+            } else {
+                lines = std::make_shared<lines_t>(text);
+            }
+            ++generation;
+            ++version;
         }
 
-        void clear() {
+        // replace all lines with text
+        void set(const std::string& text) {
+            assign(lines_t(1, text));
+        }
+
+        // count is the number of lines at snapshot_version
+        std::shared_ptr<const lines_t> snapshot(uint64_t& snapshot_version, 
+            uint64_t& snapshot_generation, size_t& count) {
             std::lock_guard<std::mutex> lk(mtx);
-            q.clear();
+            snapshot_version = version;
+            snapshot_generation = generation;
+            count = store ? store->size() : lines->size();
+            return lines;
+        }
+
+        void clear() {
+            assign(lines_t());
         }
     } queue_t;
 
+    // what a panel last drew, owned by the render thread. Every line is
+    // measured once unwrapped; its wrapped height is estimated from that
+    // and corrected when the line is actually drawn.
+    typedef struct _view_t {
+        uint64_t version = UINT64_MAX;
+        uint64_t generation = UINT64_MAX;
+        std::shared_ptr<const lines_t> lines;
+        std::vector<float> widths; // unwrapped
+        std::vector<float> heights; // unwrapped
+        float wrap_width = -1.f; // wrapped was estimated for
+        std::vector<float> wrapped;
+        size_t dirty_from = 0; // offsets past this are stale
+        std::vector<float> offsets; // top of each line, then the total height
+    } view_t;
+
     queue_t asr_messages;
     queue_t refine_messages;
-    std::string summarize_message;
+    queue_t summarize_message;
     queue_t log_messages;
+
+    view_t asr_view;
+    view_t refine_view;
+    view_t summarize_view;
+    view_t log_view;
+
+    History history;
+    // the list as last drawn, owned by the render thread
+    std::shared_ptr<const History::entries_t> history_entries;
+    uint64_t history_version = UINT64_MAX;
+    int load_session(const std::string& name, Audio * audio);
+
+    SearchIndex index;
+    char search_query[256] = "";
+    std::vector<SearchIndex::hit_t> search_hits;
+    SemanticIndex semantic;
+    bool search_by_meaning = false;
+
+    Fonts font_atlas;
+
+    // the performance panel reads the metrics once a second
+    nlohmann::json metrics_snapshot;
+    std::chrono::steady_clock::time_point metrics_time;
+    void draw_metrics();
+
+    // lays out only the lines inside the scrolled region
+    static void draw(queue_t& queue, view_t& view, bool auto_scroll = true);
+
+    // the render loop sleeps in glfwWaitEventsTimeout; new text wakes it
+    // with an empty event, guarded against the window going away
+    std::mutex window_mtx;
+    bool window_open = false;
+    void wake();
 };
 };
@@ -0,0 +1,199 @@
+// Replays audio files into a voicelint --serve instance, one session per
+// file and client, paced like a live stream, and reports how long the
+// captions trail the audio and what the server did with each session.
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <sndfile.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+static std::mutex print_mtx;
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, 
+        static_cast<size_t>(p * (values.size() - 1) + 0.5));
+    return values[index];
+}
+
+typedef struct _result_t {
+    std::string id;
+    std::string mode; // "full", "degraded" or the rejection
+    std::vector<double> lag_ms; // caption end to when its audio was sent
+    nlohmann::json summary;
+} result_t;
+
+// interleaved 16 bit samples and the file's rate and channels
+static bool load(const std::string& path, std::vector<int16_t>& samples, 
+    int& rate, int& channels) {
+    SF_INFO info = {};
+    SNDFILE * file = sf_open(path.c_str(), SFM_READ, &info);
+    if (!file) {
+        std::cerr << "Failed to open " << path << ": " << sf_strerror(nullptr) << std::endl;
+        return false;
+    }
+    samples.resize(static_cast<size_t>(info.frames) * info.channels);
+    sf_readf_short(file, samples.data(), info.frames);
+    sf_close(file);
+    rate = info.samplerate;
+    channels = info.channels;
+    return true;
+}
+
+static void replay(const std::string& url, const std::string& path, 
+    double speed, int chunk_ms, bool refine, bool verbose, result_t& result) {
+    std::vector<int16_t> samples;
+    int rate = 16000, channels = 1;
+    if (!load(path, samples, rate, channels)) {
+        result.mode = "unreadable";
+        return;
+    }
+
+    httplib::Client client(url);
+    client.set_read_timeout(600);
+    auto opened = client.Post("/sessions", nlohmann::json{{"refine", refine}}.dump(), 
+        "application/json");
+    if (!opened || opened->status != 201) {
+        result.mode = opened ? "rejected " + std::to_string(opened->status) + " " +
+            opened->body : httplib::to_string(opened.error());
+        return;
+    }
+    auto session = nlohmann::json::parse(opened->body);
+    result.id = session.value("id", "");
+    result.mode = session.value("mode", "");
+
+    // when each ms of audio left, to measure the caption lag against
+    std::vector<time_point> sent;
+    std::mutex sent_mtx;
+
+    std::thread events([&]() {
+        httplib::Client reader(url);
+        reader.set_read_timeout(600);
+        std::string buffer;
+        reader.Get("/sessions/" + result.id + "/events", [&](const char * data, size_t size) {
+            buffer.append(data, size);
+            size_t end;
+            while ((end = buffer.find('\n')) != std::string::npos) {
+                auto event = nlohmann::json::parse(buffer.substr(0, end), nullptr, false);
+                buffer.erase(0, end + 1);
+                if (!event.is_object()) continue;
+                auto now = std::chrono::steady_clock::now();
+                uint64_t t1 = event.value("t1", 0ull);
+                if (event.value("event", "") == "asr") {
+                    std::lock_guard<std::mutex> lk(sent_mtx);
+                    if (t1 > 0 && t1 <= sent.size()) {
+                        result.lag_ms.push_back(std::chrono::duration<double, std::milli>(
+                            now - sent[t1 - 1]).count());
+                    }
+                }
+                if (verbose) {
+                    std::lock_guard<std::mutex> lk(print_mtx);
+                    std::printf("[%s %8.1f s] %-9s %s\n", result.id.c_str(), t1 / 1000.0, 
+                        event.value("event", "").c_str(), event.value("text", "").c_str());
+                }
+            }
+            return true;
+        });
+    });
+
+    size_t frame_samples = static_cast<size_t>(rate) * chunk_ms / 1000 * channels;
+    size_t offset = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::string query = "/sessions/" + result.id + "/audio?format=s16le&rate=" +
+        std::to_string(rate) + "&channels=" + std::to_string(channels);
+    auto uploaded = client.Post(query, httplib::Headers(), [&](size_t, httplib::DataSink& sink) {
+        if (offset >= samples.size()) {
+            sink.done();
+            return true;
+        }
+        size_t n = std::min(frame_samples, samples.size() - offset);
+        double audio_ms = (offset + n) / channels * 1000.0 / rate;
+        if (speed > 0) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(
+                static_cast<int64_t>(audio_ms * 1000 / speed)));
+        }
+        if (!sink.write(reinterpret_cast<const char *>(samples.data() + offset), 
+            n * sizeof(int16_t))) return false;
+        offset += n;
+        std::lock_guard<std::mutex> lk(sent_mtx);
+        sent.resize(static_cast<size_t>(audio_ms), std::chrono::steady_clock::now());
+        return true;
+    }, "application/octet-stream");
+    if (!uploaded || uploaded->status != 200) {
+        std::lock_guard<std::mutex> lk(print_mtx);
+        std::cerr << result.id << ": upload failed " << (uploaded ? uploaded->body :
+            httplib::to_string(uploaded.error())) << std::endl;
+    }
+
+    auto closed = client.Delete("/sessions/" + result.id);
+    if (closed && closed->status == 200) {
+        result.summary = nlohmann::json::parse(closed->body, nullptr, false);
+    }
+    events.join();
+}
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("url,u", po::value<std::string>()->default_value("http://127.0.0.1:8090"), 
+            "server address")
+        ("input,i", po::value<std::vector<std::string>>()->multitoken()->required(), 
+            "audio files, anything libsndfile reads")
+        ("clients,n", po::value<int>()->default_value(1), 
+            "concurrent sessions, the files are used in turn")
+        ("speed,s", po::value<double>()->default_value(1.0), 
+            "replay speed, 1 for real time, 0 for as fast as the server takes it")
+        ("chunk", po::value<int>()->default_value(100), "ms of audio per write")
+        ("no-refine", "ask for captions only")
+        ("verbose,v", "print the events as they arrive");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error parsing command line options: " << e.what() << std::endl;
+        return 1;
+    }
+
+    auto inputs = vm["input"].as<std::vector<std::string>>();
+    int clients = std::max(vm["clients"].as<int>(), 1);
+    std::vector<result_t> results(clients);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back(replay, vm["url"].as<std::string>(), inputs[i % inputs.size()], 
+            vm["speed"].as<double>(), std::max(vm["chunk"].as<int>(), 10), 
+            !vm.count("no-refine"), vm.count("verbose") > 0, std::ref(results[i]));
+    }
+    for (auto& thread: threads) thread.join();
+
+    std::vector<double> all;
+    for (const auto& result: results) {
+        std::printf("%-18s %-10s %6.1f s audio  %4zu captions  lag p50 %7.1f  p90 %7.1f ms\n", 
+            result.id.empty() ? "-" : result.id.c_str(), result.mode.c_str(), 
+            result.summary.is_object() ? result.summary.value("seconds", 0.0) : 0.0, 
+            result.lag_ms.size(), percentile(result.lag_ms, 0.5), 
+            percentile(result.lag_ms, 0.9));
+        all.insert(all.end(), result.lag_ms.begin(), result.lag_ms.end());
+    }
+    std::printf("caption lag  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f ms\n", 
+        percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99), 
+        percentile(all, 1.0));
+    return 0;
+}
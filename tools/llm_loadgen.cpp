@@ -0,0 +1,218 @@
+// Replays a stream of ASR segments into LLM::refine / summarize and reports
+// queue wait, request latency and end-to-end refine lag percentiles.
+#include <algorithm>
+#include <atomic>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "llm.h"
+
+static std::atomic<int> refine_results = 0;
+static std::atomic<int> summarize_results = 0;
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1, 
+        static_cast<size_t>(p * (values.size() - 1) + 0.5));
+    return values[index];
+}
+
+static void report(const std::string& name, const std::vector<double>& values, 
+    const char * unit = "ms") {
+    std::printf("  %-10s p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f %s\n", 
+        name.c_str(), percentile(values, 0.5), percentile(values, 0.9), 
+        percentile(values, 0.99), percentile(values, 1.0), unit);
+}
+
+static std::vector<std::string> load_segments(const std::string& path) {
+    std::vector<std::string> segments;
+    if (!path.empty()) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty()) segments.push_back(line);
+        }
+    }
+    if (segments.empty()) {
+        segments = {
+            "<|zh|><|NEUTRAL|><|Speech|><|withitn|> 嗯，今天我们主要讨论一下下个季度的产品计划。",
+            "<|zh|><|NEUTRAL|><|Speech|><|withitn|> 然后这个，首先是语音识别的准确率，我们希望能够再提升一些。",
+            "<|zh|><|NEUTRAL|><|Speech|><|withitn|> 第二个是延迟的问题，会议结束以后要尽快拿到整理好的文字。",
+            "<|en|><|NEUTRAL|><|Speech|><|withitn|> So the main risk is the refine backlog during long meetings.",
+            "<|zh|><|NEUTRAL|><|Speech|><|withitn|> 对，还有就是摘要的质量，要把关键的决定都列出来。"
+        };
+    }
+    return segments;
+}
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("config,c", 
+            po::value<std::string>()->default_value("config/config.json"), 
+            "set configuration file")
+        ("server,s", po::value<std::vector<std::string>>()->composing(), 
+            "override llm.backends.servers, e.g. http://127.0.0.1:8080, repeatable")
+        ("input,i", po::value<std::string>()->default_value(""), 
+            "text file with one ASR segment per line")
+        ("rate,r", po::value<double>()->default_value(1.0), 
+            "segments per second")
+        ("duration,d", po::value<int>()->default_value(60), 
+            "seconds to replay segments")
+        ("max-latency", po::value<int>()->default_value(10), 
+            "override llm.refine.max_latency in seconds")
+        ("refine-mode", po::value<std::string>(), 
+            "override llm.refine.mode, full or edits")
+        ("summarize-every", po::value<int>()->default_value(0), 
+            "request a summary every n seconds, 0 to disable")
+        ("drain-timeout", po::value<int>()->default_value(300), 
+            "seconds to wait for the backlog after replay")
+        ("cache", "keep the response cache enabled");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error parsing command line options: " << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    nlohmann::json config;
+    try {
+        std::ifstream f(vm["config"].as<std::string>());
+        if (!f.is_open()) {
+            throw std::runtime_error("Could not open configuration file");
+        }
+        f >> config;
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading configuration file: " << e.what() << std::endl;
+        return 1;
+    }
+    nlohmann::json llm_config = config["llm"];
+    if (vm.count("server")) {
+        llm_config["backends"]["servers"] = vm["server"].as<std::vector<std::string>>();
+    }
+    llm_config["refine"]["max_latency"] = vm["max-latency"].as<int>();
+    if (vm.count("refine-mode")) {
+        llm_config["refine"]["mode"] = vm["refine-mode"].as<std::string>();
+    }
+    llm_config["refine"]["save"] = false;
+    // the app's own spool must survive a benchmark run
+    llm_config["refine"]["spool"] = (std::filesystem::temp_directory_path() /
+        ("llm_loadgen-" + std::to_string(::getpid()) + ".spool")).string();
+    llm_config["summarize"]["save"] = false;
+    if (!vm.count("cache")) llm_config["cache"]["enabled"] = false;
+
+    auto segments = load_segments(vm["input"].as<std::string>());
+    double rate = std::max(0.01, vm["rate"].as<double>());
+    int duration = vm["duration"].as<int>();
+    int summarize_every = vm["summarize-every"].as<int>();
+
+    LLM& llm = LLM::instance();
+    if (llm.init(llm_config, [](const std::string& name, const std::string& text) {
+        if (name == "refine") ++refine_results;
+        if (name == "summarize") ++summarize_results;
+    }) != 0) {
+        std::cerr << "LLM initialization failed." << std::endl;
+        llm.shutdown();
+        return 1;
+    }
+
+    std::cout << "replaying " << segments.size() << " segments at " << rate
+        << "/s for " << duration << "s" << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto next_summary = start + std::chrono::seconds(summarize_every);
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+    auto next = start;
+    size_t pushed = 0;
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(duration)) {
+        llm.refine(segments[pushed++ % segments.size()]);
+        auto now = std::chrono::steady_clock::now();
+        if (summarize_every > 0 && now >= next_summary) {
+            llm.summarize();
+            next_summary += std::chrono::seconds(summarize_every);
+        }
+        next += interval;
+        std::this_thread::sleep_until(next);
+    }
+
+    // flush the tail and wait for the backlog to drain
+    llm.refine("");
+    auto replay_end = std::chrono::steady_clock::now();
+    auto deadline = replay_end + std::chrono::seconds(vm["drain-timeout"].as<int>());
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if (llm.getPendingSize() == 0 && !llm.isRefine() && !llm.isSummarize()) break;
+    }
+    double drain_s = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - replay_end).count();
+    llm.shutdown();
+    std::error_code ec;
+    std::filesystem::remove(llm_config["refine"]["spool"].get<std::string>(), ec);
+
+    std::map<std::string, std::vector<LLM::request_stats_t>> by_stage;
+    for (const auto& stats: llm.getStats()) {
+        by_stage[stats.stage].push_back(stats);
+    }
+
+    std::printf("pushed %zu segments, %d refine results, %d summaries, "
+        "drained in %.1fs, %d bytes left\n", pushed, refine_results.load(), 
+        summarize_results.load(), drain_s, llm.getPendingSize());
+    for (const auto& [stage, requests]: by_stage) {
+        std::vector<double> queue, latency, lag, generated, speed;
+        int ok = 0, cached = 0, truncated = 0, fallback = 0;
+        int64_t completion = 0, drafted = 0, accepted = 0;
+        for (const auto& stats: requests) {
+            queue.push_back(stats.queue_ms);
+            latency.push_back(stats.latency_ms);
+            lag.push_back(stats.lag_ms);
+            ok += stats.ok;
+            cached += stats.cached;
+            truncated += stats.truncated;
+            fallback += stats.fallback;
+            if (stats.ok && !stats.cached) {
+                generated.push_back(stats.completion_tokens);
+                speed.push_back(stats.tokens_per_second);
+                completion += stats.completion_tokens;
+                drafted += stats.draft_tokens;
+                accepted += stats.accepted_tokens;
+            }
+        }
+        std::printf("%s: %zu requests, %d ok, %d cached, %d truncated\n", 
+            stage.c_str(), requests.size(), ok, cached, truncated);
+        report("queue", queue);
+        report("latency", latency);
+        report("lag", lag);
+        report("generated", generated, "tokens");
+        report("speed", speed, "tokens/s");
+        if (fallback > 0) {
+            std::printf("  edits: %d of %zu rejected and rewritten in full\n", 
+                fallback, requests.size());
+        }
+        if (drafted > 0) {
+            // every accepted draft token is a decode step saved
+            std::printf("  speculative: %.1f%% of %lld draft tokens accepted, "
+                "%.2fx fewer decode steps\n", 100.0 * accepted / drafted, 
+                (long long)drafted, double(completion) /
+                std::max<int64_t>(1, completion - accepted));
+        }
+    }
+    return 0;
+}
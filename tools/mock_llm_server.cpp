@@ -0,0 +1,361 @@
+// Offline stand-in for llama-server: OpenAI-compatible chat completions that
+// echo the user text back with a configurable timing profile, for driving
+// the LLM pipeline without a model.
+#include <algorithm>
+#include <atomic>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "httplib.h"
+
+typedef struct _mock_config_t {
+    int ttft_ms = 200; // time to first token
+    int prompt_tps = 0; // prompt tokens per second added to ttft, 0 = off
+    double tps = 20.0; // generated tokens per second
+    int think_tokens = 0; // tokens of <think> block emitted before the text
+    double fail_rate = 0.0;
+    int fail_status = 500;
+    int stall_ms = 0; // a failing request first stalls this long
+    int slots = 4; // requests decoded concurrently, the rest wait
+    double spec_accept = 0.0; // share of tokens accepted from a draft
+} mock_config_t;
+
+static mock_config_t mock_config;
+
+typedef struct _slots_t {
+    std::mutex mtx;
+    std::condition_variable cv;
+    int free = 0;
+
+    void acquire() {
+        std::unique_lock<std::mutex> lk(mtx);
+        cv.wait(lk, [this] { return free > 0; });
+        --free;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lk(mtx);
+        ++free;
+        cv.notify_one();
+    }
+} slots_t;
+
+static slots_t slots;
+static std::atomic<uint64_t> request_id = 0;
+
+// rough token pieces: one per CJK character or punctuation mark, one per
+// Latin word together with the space in front of it
+static std::vector<std::string> split_tokens(const std::string& text) {
+    std::vector<std::string> tokens;
+    std::string word;
+    for (size_t i = 0; i < text.size(); ) {
+        unsigned char c = text[i];
+        size_t n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        n = std::min(n, text.size() - i);
+        bool alnum = n == 1 && std::isalnum(c);
+        if (alnum || (n == 1 && c == ' ' && word.empty())) {
+            word += text.substr(i, n);
+        } else {
+            if (!word.empty()) tokens.push_back(word);
+            word.clear();
+            if (n == 1 && c == ' ') {
+                word = " ";
+            } else {
+                tokens.push_back(text.substr(i, n));
+            }
+        }
+        i += n;
+    }
+    if (!word.empty()) tokens.push_back(word);
+    return tokens;
+}
+
+static std::string user_text(const nlohmann::json& request) {
+    std::string text;
+    for (const auto& message: request.value("messages", nlohmann::json::array())) {
+        if (message.value("role", "") == "user") {
+            text = message.value("content", "");
+        }
+    }
+    // refine requests carry the previous context first, it is not echoed
+    const std::string context_end = "</context>\n";
+    auto pos = text.find(context_end);
+    if (text.rfind("<context>", 0) == 0 && pos != std::string::npos) {
+        text = text.substr(pos + context_end.size());
+    }
+    return text;
+}
+
+static int prompt_tokens(const nlohmann::json& request) {
+    int n = 0;
+    for (const auto& message: request.value("messages", nlohmann::json::array())) {
+        n += split_tokens(message.value("content", "")).size();
+    }
+    return n;
+}
+
+static bool should_fail() {
+    static std::mutex mtx;
+    static std::mt19937 gen(std::random_device{}());
+    std::lock_guard<std::mutex> lk(mtx);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(gen) <
+        mock_config.fail_rate;
+}
+
+static void sleep_ms(double ms) {
+    if (ms > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(
+            static_cast<int64_t>(ms * 1000)));
+    }
+}
+
+static void chat_completions(const httplib::Request& req, httplib::Response& res) {
+    nlohmann::json request;
+    try {
+        request = nlohmann::json::parse(req.body);
+    } catch (const std::exception& e) {
+        res.status = 400;
+        res.set_content(nlohmann::json({{"error", e.what()}}).dump(), 
+            "application/json");
+        return;
+    }
+
+    if (should_fail()) {
+        sleep_ms(mock_config.stall_ms);
+        res.status = mock_config.fail_status;
+        res.set_content(R"({"error":{"message":"injected failure"}})", 
+            "application/json");
+        return;
+    }
+
+    std::vector<std::string> tokens;
+    bool thinking = request.value("chat_template_kwargs", 
+        nlohmann::json::object()).value("enable_thinking", true);
+    if (thinking && mock_config.think_tokens > 0) {
+        tokens.push_back("<think>\n");
+        for (int i = 0; i < mock_config.think_tokens; ++i) tokens.push_back(" hmm");
+        tokens.push_back("\n</think>\n\n");
+    }
+    auto text_tokens = split_tokens(user_text(request));
+    tokens.insert(tokens.end(), text_tokens.begin(), text_tokens.end());
+    std::vector<std::string> stop;
+    if (request.contains("stop")) stop = request["stop"].get<std::vector<std::string>>();
+    std::string text;
+    for (size_t i = 0; i < tokens.size() && !stop.empty(); ++i) {
+        text += tokens[i];
+        bool stopped = std::any_of(stop.begin(), stop.end(), 
+            [&](const std::string& s) { return text.find(s) != std::string::npos; });
+        if (stopped) {
+            tokens.resize(i);
+            break;
+        }
+    }
+    int max_tokens = request.value("max_tokens", -1);
+    std::string finish_reason = "stop";
+    if (max_tokens >= 0 && tokens.size() > size_t(max_tokens)) {
+        tokens.resize(max_tokens);
+        finish_reason = "length";
+    }
+
+    int n_prompt = prompt_tokens(request);
+    double ttft_ms = mock_config.ttft_ms;
+    if (mock_config.prompt_tps > 0) ttft_ms += 1000.0 * n_prompt / mock_config.prompt_tps;
+    double token_ms = mock_config.tps > 0 ? 1000.0 / mock_config.tps : 0;
+    // speculation: accepted draft tokens come without a decode step of
+    // their own, so the average token gets cheaper
+    int draft_n = 0;
+    int draft_accepted = 0;
+    if (request.value("speculative.n_max", 0) > 0 && mock_config.spec_accept > 0) {
+        draft_n = tokens.size();
+        draft_accepted = int(draft_n * std::min(1.0, mock_config.spec_accept));
+        token_ms *= 1.0 - double(draft_accepted) / std::max(1, draft_n);
+    }
+    std::string id = "chatcmpl-mock-" + std::to_string(++request_id);
+    std::string model = request.value("model", "mock");
+
+    auto timings = [=](size_t n) {
+        nlohmann::json result = {
+            {"prompt_n", n_prompt},
+            {"prompt_ms", ttft_ms},
+            {"predicted_n", n},
+            {"predicted_ms", n * token_ms},
+            {"predicted_per_second", token_ms > 0 ? 1000.0 / token_ms : 0}
+        };
+        if (draft_n > 0) {
+            result["draft_n"] = draft_n;
+            result["draft_n_accepted"] = draft_accepted;
+        }
+        return result;
+    };
+
+    if (request.value("stream", false)) {
+        res.set_chunked_content_provider("text/event-stream", 
+            [=](size_t, httplib::DataSink& sink) {
+                slots.acquire();
+                sleep_ms(ttft_ms);
+                for (size_t i = 0; i < tokens.size(); ++i) {
+                    if (i > 0) sleep_ms(token_ms);
+                    nlohmann::json chunk = {
+                        {"id", id},
+                        {"object", "chat.completion.chunk"},
+                        {"model", model},
+                        {"choices", {{
+                            {"index", 0},
+                            {"delta", {{"content", tokens[i]}}},
+                            {"finish_reason", nullptr}
+                        }}}
+                    };
+                    std::string event = "data: " + chunk.dump() + "\n\n";
+                    if (!sink.write(event.data(), event.size())) {
+                        slots.release();
+                        return false;
+                    }
+                }
+                nlohmann::json last = {
+                    {"id", id},
+                    {"object", "chat.completion.chunk"},
+                    {"model", model},
+                    {"choices", {{
+                        {"index", 0},
+                        {"delta", nlohmann::json::object()},
+                        {"finish_reason", finish_reason}
+                    }}},
+                    {"timings", timings(tokens.size())}
+                };
+                std::string event = "data: " + last.dump() + "\n\ndata: [DONE]\n\n";
+                sink.write(event.data(), event.size());
+                sink.done();
+                slots.release();
+                return true;
+            });
+        return;
+    }
+
+    slots.acquire();
+    sleep_ms(ttft_ms + token_ms * (tokens.size() > 0 ? tokens.size() - 1 : 0));
+    slots.release();
+
+    std::string content;
+    for (const auto& token: tokens) content += token;
+    nlohmann::json response = {
+        {"id", id},
+        {"object", "chat.completion"},
+        {"model", model},
+        {"choices", {{
+            {"index", 0},
+            {"message", {{"role", "assistant"}, {"content", content}}},
+            {"finish_reason", finish_reason}
+        }}},
+        {"usage", {
+            {"prompt_tokens", n_prompt},
+            {"completion_tokens", tokens.size()},
+            {"total_tokens", n_prompt + tokens.size()}
+        }},
+        {"timings", timings(tokens.size())}
+    };
+    res.set_content(response.dump(), "application/json");
+}
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    std::string host;
+    int port = 0;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("host", po::value<std::string>(&host)->default_value("127.0.0.1"), 
+            "listen address")
+        ("port,p", po::value<int>(&port)->default_value(8080), "listen port")
+        ("ttft", po::value<int>(&mock_config.ttft_ms)->default_value(200), 
+            "time to first token in ms")
+        ("prompt-tps", po::value<int>(&mock_config.prompt_tps)->default_value(0), 
+            "prompt tokens per second added to ttft, 0 to disable")
+        ("tps", po::value<double>(&mock_config.tps)->default_value(20.0), 
+            "generated tokens per second")
+        ("think", po::value<int>(&mock_config.think_tokens)->default_value(0), 
+            "tokens of <think> block to emit before the answer")
+        ("fail-rate", po::value<double>(&mock_config.fail_rate)->default_value(0.0), 
+            "probability of a failed completion")
+        ("fail-status", po::value<int>(&mock_config.fail_status)->default_value(500), 
+            "HTTP status of a failed completion")
+        ("stall", po::value<int>(&mock_config.stall_ms)->default_value(0), 
+            "ms a failing completion stalls before answering")
+        ("slots", po::value<int>(&mock_config.slots)->default_value(4), 
+            "completions decoded concurrently")
+        ("spec-accept", po::value<double>(&mock_config.spec_accept)->default_value(0.0), 
+            "share of draft tokens accepted for speculative requests");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error parsing command line options: " << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    slots.free = std::max(1, mock_config.slots);
+
+    httplib::Server server;
+    server.Post("/v1/chat/completions", chat_completions);
+    server.Post("/chat/completions", chat_completions);
+    server.Post("/tokenize", [](const httplib::Request& req, httplib::Response& res) {
+        nlohmann::json tokens = nlohmann::json::array();
+        try {
+            auto request = nlohmann::json::parse(req.body);
+            auto pieces = split_tokens(request.value("content", ""));
+            bool with_pieces = request.value("with_pieces", false);
+            for (size_t i = 0; i < pieces.size(); ++i) {
+                if (!with_pieces) {
+                    tokens.push_back(i);
+                    continue;
+                }
+                // like llama-server, a piece that is not valid UTF-8 goes
+                // out as its bytes
+                nlohmann::json piece = pieces[i];
+                try {
+                    piece.dump();
+                } catch (const nlohmann::json::type_error&) {
+                    piece = std::vector<uint8_t>(pieces[i].begin(), pieces[i].end());
+                }
+                tokens.push_back({{"id", i}, {"piece", piece}});
+            }
+        } catch (const std::exception& e) {
+            res.status = 400;
+            return;
+        }
+        res.set_content(nlohmann::json({{"tokens", tokens}}).dump(), 
+            "application/json");
+    });
+    server.Post(R"(/slots/(\d+))", [](const httplib::Request& req, httplib::Response& res) {
+        nlohmann::json response = {
+            {"id_slot", std::stoi(req.matches[1].str())},
+            {"action", req.get_param_value("action")}
+        };
+        res.set_content(response.dump(), "application/json");
+    });
+    server.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(R"({"status":"ok"})", "application/json");
+    });
+    server.Get("/v1/models", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content(R"({"object":"list","data":[{"id":"mock","object":"model"}]})", 
+            "application/json");
+    });
+
+    std::cout << "mock llm server listening on " << host << ":" << port << std::endl;
+    if (!server.listen(host, port)) {
+        std::cerr << "Failed to listen on " << host << ":" << port << std::endl;
+        return 1;
+    }
+    return 0;
+}
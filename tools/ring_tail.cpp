@@ -0,0 +1,75 @@
+// Follows the shared-memory event ring of a running voicelint and prints
+// the events as JSON lines, a live replacement for tailing asr.txt.
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+
+#include "publisher.h"
+
+static const char * type_name(uint16_t type) {
+    switch (type) {
+        case 2: return "asr";
+        case 3: return "refine";
+        case 4: return "summarize";
+    }
+    return "unknown";
+}
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("ring,r", po::value<std::string>()->default_value("/voicelint-events"), 
+            "shared memory name, publish.ring.name")
+        ("all,a", "start from the oldest event still in the ring")
+        ("type,t", po::value<std::string>()->default_value(""), 
+            "only asr, refine or summarize")
+        ("poll", po::value<int>()->default_value(20), "ms between polls");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error parsing command line options: " << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    std::string name = vm["ring"].as<std::string>();
+    std::string type = vm["type"].as<std::string>();
+    auto poll = std::chrono::milliseconds(std::max(vm["poll"].as<int>(), 1));
+    ring::Reader reader;
+    while (reader.open(name, vm.count("all") > 0) != 0) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    ring::record_t record;
+    std::string text;
+    uint64_t lost = 0;
+    while (true) {
+        if (!reader.next(record, text)) {
+            std::this_thread::sleep_for(poll);
+            continue;
+        }
+        if (reader.getLost() != lost) {
+            std::cerr << "lost " << reader.getLost() - lost << " events" << std::endl;
+            lost = reader.getLost();
+        }
+        if (!type.empty() && type != type_name(record.type)) continue;
+        nlohmann::json event = {
+            {"seq", record.seq},
+            {"event", type_name(record.type)},
+            {"text", text},
+            {"t0", record.t0},
+            {"t1", record.t1}
+        };
+        std::cout << event.dump(-1, ' ', false, 
+            nlohmann::json::error_handler_t::replace) << std::endl;
+    }
+}
@@ -0,0 +1,95 @@
+// Lists the chunks of a session container or exports a time range of it
+// back to the loose files: asr.txt, refine.txt, summarize.txt and the audio.
+#include <boost/program_options.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "session_file.h"
+
+static const char * type_name(uint16_t type) {
+    switch (type) {
+        case SessionFile::chunk_audio: return "audio";
+        case SessionFile::chunk_asr: return "asr";
+        case SessionFile::chunk_refine: return "refine";
+        case SessionFile::chunk_summary: return "summary";
+        case SessionFile::chunk_meta: return "meta";
+    }
+    return "unknown";
+}
+
+int main(int argc, char* argv[]) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("input,i", po::value<std::string>()->default_value("output/session.vls"), 
+            "session container, e.g. data/<session>/session.vls")
+        ("output,o", po::value<std::string>()->default_value("."), 
+            "directory for the exported files")
+        ("from", po::value<double>()->default_value(0), 
+            "start of the range in seconds")
+        ("to", po::value<double>()->default_value(-1), 
+            "end of the range in seconds, -1 for the end of the session")
+        ("audio", po::value<std::string>()->default_value("mp3"), 
+            "audio format: mp3, flac, wav or none")
+        ("list,l", "list the chunks instead of exporting")
+        ("repair", "index a container that was not closed, in place");
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (const po::error& e) {
+        std::cerr << "Error parsing command line options: " << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    std::string input = vm["input"].as<std::string>();
+    if (vm.count("repair") && SessionFile::repair(input) != 0) {
+        std::cerr << "Failed to repair " << input << std::endl;
+        return 1;
+    }
+    SessionFile file;
+    if (file.open(input) != 0) return 1;
+
+    uint64_t t0 = static_cast<uint64_t>(std::max(vm["from"].as<double>(), 0.0) * 1000);
+    double to = vm["to"].as<double>();
+    uint64_t t1 = to < 0 ? UINT64_MAX : static_cast<uint64_t>(to * 1000);
+
+    if (vm.count("list")) {
+        std::map<uint16_t, std::pair<size_t, uint64_t>> totals;
+        for (uint16_t type = SessionFile::chunk_audio; type <= SessionFile::chunk_meta; ++type) {
+            for (const auto& entry: file.find(type, t0, t1)) {
+                if (type != SessionFile::chunk_audio) {
+                    std::printf("%10.3f %10.3f  %-8s %8u bytes\n", entry.t0 / 1000.0, 
+                        entry.t1 / 1000.0, type_name(type), entry.size);
+                }
+                totals[type].first++;
+                totals[type].second += entry.size;
+            }
+        }
+        std::printf("duration %.3f s, %d Hz\n", file.duration() / 1000.0, file.sampleRate());
+        for (const auto& [type, total]: totals) {
+            std::printf("  %-8s %6zu chunks %12llu bytes\n", type_name(type), 
+                total.first, static_cast<unsigned long long>(total.second));
+        }
+        return 0;
+    }
+
+    std::string output = vm["output"].as<std::string>();
+    std::filesystem::create_directories(output);
+    int ret = 0;
+    ret |= file.exportText(SessionFile::chunk_asr, output + "/asr.txt", t0, t1);
+    ret |= file.exportText(SessionFile::chunk_refine, output + "/refine.txt", t0, t1);
+    ret |= file.exportText(SessionFile::chunk_summary, output + "/summarize.txt", t0, t1);
+    std::string format = vm["audio"].as<std::string>();
+    if (format != "none") {
+        ret |= file.exportAudio(output + "/output." + format, t0, t1);
+    }
+    return ret == 0 ? 0 : 1;
+}